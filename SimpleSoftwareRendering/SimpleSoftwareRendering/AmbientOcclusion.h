@@ -0,0 +1,518 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "Instrumentor.h"
+
+#include "Geometry.h"
+#include "ThreadPool.h"
+#include "PixelKernelsSIMD.h"
+#include "RenderGeometry.h"
+#include "TileRenderer.h"
+#include "WorldConstants.h"
+
+// Screen space ambient occlusion as a pass over the finished frame, worked out from the depth buffer alone so it darkens
+// creases and contacts the same whatever drew them. It runs at half resolution and is blurred along x then y with taps
+// across a depth edge left out, then the colour is scaled by it. Every stage is split by the render tiles, 4 pixels at a time with SSE.
+// AVX2 takes the SSE path too, the scattered depth reads around each pixel cost more than the arithmetic.
+
+bool useAmbientOcclusion = false;
+
+// CAMERA SPACE!!! Positions are rebuilt from the pixel and its distance along the view direction, mirrored or not doesn't matter to the angles between them.
+struct AmbientOcclusionBuffers {
+
+	int width, height;					// Half the screen's, rounded up.
+	std::vector<float> viewDepth;		// Of the nearest of the 2x2 pixels, 0 where none had anything drawn.
+	std::vector<float> occlusion;		// 1 is fully open. The finished blur ends back up in here.
+	std::vector<float> blurred;			// Only blurred along x.
+
+	// Spiral of sample offsets in the unit disc, each pixel turns it by one of 16 angles picked by its place in a 4x4 block so the blur can average the noise away.
+	float sampleOffsetX[ssaoNumSamples];
+	float sampleOffsetY[ssaoNumSamples];
+	float rotationCos[16];
+	float rotationSin[16];
+	float blurWeights[ssaoBlurRadius + 1];
+
+	// Of the last frame, in half resolution pixels.
+	float focalLengthX, focalLengthY;
+	float centreX, centreY;
+
+	// Of the last frame's projection, view depth = viewDepthNumerator / (NDC z + viewDepthOffset).
+	float viewDepthNumerator, viewDepthOffset;
+};
+
+void InitAmbientOcclusionBuffers(AmbientOcclusionBuffers& buffers, int imageWidth, int imageHeight) {
+
+	buffers.width = (imageWidth + 1) / 2;
+	buffers.height = (imageHeight + 1) / 2;
+	buffers.viewDepth.resize(buffers.width * buffers.height);
+	buffers.occlusion.resize(buffers.width * buffers.height);
+	buffers.blurred.resize(buffers.width * buffers.height);
+
+	const float goldenAngle = 2.39996323f;
+	for (int i = 0; i < ssaoNumSamples; i++)
+	{
+		float radius = ((float)i + 0.5f) / ssaoNumSamples;
+		buffers.sampleOffsetX[i] = std::cos(goldenAngle * i) * radius;
+		buffers.sampleOffsetY[i] = std::sin(goldenAngle * i) * radius;
+	}
+
+	// 4x4 Bayer order, neighbouring pixels get angles far apart.
+	const int bayer[16] = { 0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5 };
+	for (int i = 0; i < 16; i++)
+	{
+		float angle = (bayer[i] / 16.0f) * 2.0f * glm::pi<float>();
+		buffers.rotationCos[i] = std::cos(angle);
+		buffers.rotationSin[i] = std::sin(angle);
+	}
+
+	float sigma = std::max(ssaoBlurRadius * 0.5f, 0.5f);
+	for (int i = 0; i <= ssaoBlurRadius; i++)
+	{
+		buffers.blurWeights[i] = std::exp(-(float)(i * i) / (2.0f * sigma * sigma));
+	}
+}
+
+// Undoes NDC z = (f + n) / (f - n) + 2fn / ((f - n) * w) of the camera's negated projection, 0 stays 0.
+float NDCDepthToViewDepth(const AmbientOcclusionBuffers& buffers, float depth) {
+
+	if (depth <= 0.0f) {
+		return 0.0f;
+	}
+
+	return buffers.viewDepthNumerator / (depth + buffers.viewDepthOffset);
+}
+
+Vector3 AmbientOcclusionViewPosition(const AmbientOcclusionBuffers& buffers, float x, float y, float viewDepth) {
+
+	return Vector3{ ((x + 0.5f - buffers.centreX) * viewDepth) / buffers.focalLengthX, ((y + 0.5f - buffers.centreY) * viewDepth) / buffers.focalLengthY, viewDepth };
+}
+
+// Of the two neighbours along an axis the one nearer in depth is taken, so a silhouette behind or in front doesn't bend the normal.
+Vector3 AmbientOcclusionTangent(const AmbientOcclusionBuffers& buffers, const Vector3& position, int x, int y, int stepX, int stepY) {
+
+	int index = x + (y * buffers.width);
+	int stride = stepX + (stepY * buffers.width);
+	float depth = buffers.viewDepth[index];
+	float forwardDepth = buffers.viewDepth[index + stride];
+	float backwardDepth = buffers.viewDepth[index - stride];
+
+	if (std::abs(forwardDepth - depth) < std::abs(backwardDepth - depth)) {
+		return AmbientOcclusionViewPosition(buffers, (float)(x + stepX), (float)(y + stepY), forwardDepth) - position;
+	}
+	return position - AmbientOcclusionViewPosition(buffers, (float)(x - stepX), (float)(y - stepY), backwardDepth);
+}
+
+// Samples above the surface within ssaoRadius occlude it by the cosine of their angle over it, fading out towards the radius.
+// x and y have to have a neighbour on every side, pixels on the border of the image stay open.
+float ComputeAmbientOcclusionAtPixel(const AmbientOcclusionBuffers& buffers, int x, int y) {
+
+	float depth = buffers.viewDepth[x + (y * buffers.width)];
+	if (depth <= 0.0f || x <= 0 || y <= 0 || x >= buffers.width - 1 || y >= buffers.height - 1) {
+		return 1.0f;
+	}
+
+	Vector3 position = AmbientOcclusionViewPosition(buffers, (float)x, (float)y, depth);
+	Vector3 normal = glm::cross(AmbientOcclusionTangent(buffers, position, x, y, 1, 0), AmbientOcclusionTangent(buffers, position, x, y, 0, 1));
+	if (glm::dot(normal, position) > 0.0f) {
+		normal = -normal;
+	}
+	normal = normal / std::sqrt(glm::dot(normal, normal));
+
+	// Close up the radius covers more of the screen than is worth reading, it's clamped so the cost doesn't grow with it.
+	float radiusPixels = std::min((ssaoRadius * buffers.focalLengthY) / depth, ssaoMaxRadiusPixels);
+	float invRadiusSquared = 1.0f / (ssaoRadius * ssaoRadius);
+	int pattern = (x & 3) + ((y & 3) * 4);
+	float rotationCos = buffers.rotationCos[pattern];
+	float rotationSin = buffers.rotationSin[pattern];
+
+	float occlusion = 0.0f;
+	for (int i = 0; i < ssaoNumSamples; i++)
+	{
+		float offsetX = (buffers.sampleOffsetX[i] * rotationCos) - (buffers.sampleOffsetY[i] * rotationSin);
+		float offsetY = (buffers.sampleOffsetX[i] * rotationSin) + (buffers.sampleOffsetY[i] * rotationCos);
+		int sampleX = (int)std::min(std::max((float)x + 0.5f + (offsetX * radiusPixels), 0.0f), buffers.width - 0.5f);
+		int sampleY = (int)std::min(std::max((float)y + 0.5f + (offsetY * radiusPixels), 0.0f), buffers.height - 0.5f);
+
+		float sampleDepth = buffers.viewDepth[sampleX + (sampleY * buffers.width)];
+		Vector3 toSample = AmbientOcclusionViewPosition(buffers, (float)sampleX, (float)sampleY, sampleDepth) - position;
+		float distanceSquared = glm::dot(toSample, toSample);
+		float falloff = 1.0f - (distanceSquared * invRadiusSquared);
+		if (sampleDepth <= 0.0f || distanceSquared <= 0.0f || falloff <= 0.0f) {
+			continue;
+		}
+
+		float cosAngle = glm::dot(toSample, normal) / std::sqrt(distanceSquared);
+		occlusion += std::max(cosAngle - ssaoAngleBias, 0.0f) * falloff;
+	}
+
+	return std::max(1.0f - (occlusion * (ssaoIntensity / ssaoNumSamples)), 0.0f);
+}
+
+// 4 pixels along x, all of them with a neighbour on every side.
+void ComputeAmbientOcclusionBlockSSE(const AmbientOcclusionBuffers& buffers, int x, int y, float* occlusionOut) {
+
+	const float* depthRow = &buffers.viewDepth[y * buffers.width];
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 invFocalLengthX = _mm_set1_ps(1.0f / buffers.focalLengthX);
+	const __m128 invFocalLengthY = _mm_set1_ps(1.0f / buffers.focalLengthY);
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+
+	__m128 depth = _mm_loadu_ps(depthRow + x);
+	__m128 drawn = _mm_cmpgt_ps(depth, zero);
+	if (_mm_movemask_ps(drawn) == 0) {
+		_mm_storeu_ps(occlusionOut, one);
+		return;
+	}
+
+	// Pixel centres relative to the image centre, still to be scaled by depth / focal length.
+	__m128 rayX = _mm_add_ps(_mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), _mm_set1_ps((float)x - buffers.centreX));
+	__m128 rayY = _mm_set1_ps((float)y + 0.5f - buffers.centreY);
+	__m128 positionX = _mm_mul_ps(_mm_mul_ps(rayX, depth), invFocalLengthX);
+	__m128 positionY = _mm_mul_ps(_mm_mul_ps(rayY, depth), invFocalLengthY);
+
+	// Tangents, same choice of neighbour as AmbientOcclusionTangent.
+	__m128 tangent[2][3];
+	for (int axis = 0; axis < 2; axis++)
+	{
+		const float* forwardRow = axis == 0 ? depthRow + 1 : depthRow + buffers.width;
+		const float* backwardRow = axis == 0 ? depthRow - 1 : depthRow - buffers.width;
+		__m128 forwardDepth = _mm_loadu_ps(forwardRow + x);
+		__m128 backwardDepth = _mm_loadu_ps(backwardRow + x);
+		__m128 useForward = _mm_cmplt_ps(_mm_andnot_ps(signMask, _mm_sub_ps(forwardDepth, depth)), _mm_andnot_ps(signMask, _mm_sub_ps(backwardDepth, depth)));
+
+		__m128 step = _mm_or_ps(_mm_and_ps(useForward, one), _mm_andnot_ps(useForward, _mm_set1_ps(-1.0f)));
+		__m128 neighbourDepth = _mm_or_ps(_mm_and_ps(useForward, forwardDepth), _mm_andnot_ps(useForward, backwardDepth));
+		__m128 neighbourRayX = axis == 0 ? _mm_add_ps(rayX, step) : rayX;
+		__m128 neighbourRayY = axis == 1 ? _mm_add_ps(rayY, step) : rayY;
+
+		// (neighbour - position) * step points forward either way.
+		tangent[axis][0] = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_mul_ps(neighbourRayX, neighbourDepth), invFocalLengthX), positionX), step);
+		tangent[axis][1] = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_mul_ps(neighbourRayY, neighbourDepth), invFocalLengthY), positionY), step);
+		tangent[axis][2] = _mm_mul_ps(_mm_sub_ps(neighbourDepth, depth), step);
+	}
+
+	__m128 normalX = _mm_sub_ps(_mm_mul_ps(tangent[0][1], tangent[1][2]), _mm_mul_ps(tangent[0][2], tangent[1][1]));
+	__m128 normalY = _mm_sub_ps(_mm_mul_ps(tangent[0][2], tangent[1][0]), _mm_mul_ps(tangent[0][0], tangent[1][2]));
+	__m128 normalZ = _mm_sub_ps(_mm_mul_ps(tangent[0][0], tangent[1][1]), _mm_mul_ps(tangent[0][1], tangent[1][0]));
+	__m128 facingAway = _mm_cmpgt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX, positionX), _mm_mul_ps(normalY, positionY)), _mm_mul_ps(normalZ, depth)), zero);
+	__m128 flipSign = _mm_and_ps(facingAway, signMask);
+	__m128 invNormalLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX, normalX), _mm_mul_ps(normalY, normalY)), _mm_mul_ps(normalZ, normalZ))));
+	invNormalLength = _mm_xor_ps(invNormalLength, flipSign);
+	normalX = _mm_mul_ps(normalX, invNormalLength);
+	normalY = _mm_mul_ps(normalY, invNormalLength);
+	normalZ = _mm_mul_ps(normalZ, invNormalLength);
+
+	__m128 radiusPixels = _mm_min_ps(_mm_div_ps(_mm_set1_ps(ssaoRadius * buffers.focalLengthY), depth), _mm_set1_ps(ssaoMaxRadiusPixels));
+	const __m128 invRadiusSquared = _mm_set1_ps(1.0f / (ssaoRadius * ssaoRadius));
+	const __m128 angleBias = _mm_set1_ps(ssaoAngleBias);
+	const __m128 maxSampleX = _mm_set1_ps(buffers.width - 0.5f);
+	const __m128 maxSampleY = _mm_set1_ps(buffers.height - 0.5f);
+
+	int patternRow = (y & 3) * 4;
+	__m128 rotationCos = _mm_setr_ps(buffers.rotationCos[patternRow + (x & 3)], buffers.rotationCos[patternRow + ((x + 1) & 3)], buffers.rotationCos[patternRow + ((x + 2) & 3)], buffers.rotationCos[patternRow + ((x + 3) & 3)]);
+	__m128 rotationSin = _mm_setr_ps(buffers.rotationSin[patternRow + (x & 3)], buffers.rotationSin[patternRow + ((x + 1) & 3)], buffers.rotationSin[patternRow + ((x + 2) & 3)], buffers.rotationSin[patternRow + ((x + 3) & 3)]);
+	__m128 pixelX = _mm_add_ps(_mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), _mm_set1_ps((float)x));
+	__m128 pixelY = _mm_set1_ps((float)y + 0.5f);
+
+	__m128 occlusion = zero;
+	for (int i = 0; i < ssaoNumSamples; i++)
+	{
+		__m128 sampleOffsetX = _mm_set1_ps(buffers.sampleOffsetX[i]);
+		__m128 sampleOffsetY = _mm_set1_ps(buffers.sampleOffsetY[i]);
+		__m128 offsetX = _mm_sub_ps(_mm_mul_ps(sampleOffsetX, rotationCos), _mm_mul_ps(sampleOffsetY, rotationSin));
+		__m128 offsetY = _mm_add_ps(_mm_mul_ps(sampleOffsetX, rotationSin), _mm_mul_ps(sampleOffsetY, rotationCos));
+		__m128i sampleX = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(pixelX, _mm_mul_ps(offsetX, radiusPixels)), zero), maxSampleX));
+		__m128i sampleY = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(pixelY, _mm_mul_ps(offsetY, radiusPixels)), zero), maxSampleY));
+
+		alignas(16) int sampleXs[4];
+		alignas(16) int sampleYs[4];
+		_mm_store_si128((__m128i*)sampleXs, sampleX);
+		_mm_store_si128((__m128i*)sampleYs, sampleY);
+		__m128 sampleDepth = _mm_setr_ps(buffers.viewDepth[sampleXs[0] + (sampleYs[0] * buffers.width)], buffers.viewDepth[sampleXs[1] + (sampleYs[1] * buffers.width)],
+			buffers.viewDepth[sampleXs[2] + (sampleYs[2] * buffers.width)], buffers.viewDepth[sampleXs[3] + (sampleYs[3] * buffers.width)]);
+
+		__m128 sampleRayX = _mm_add_ps(_mm_cvtepi32_ps(sampleX), _mm_set1_ps(0.5f - buffers.centreX));
+		__m128 sampleRayY = _mm_add_ps(_mm_cvtepi32_ps(sampleY), _mm_set1_ps(0.5f - buffers.centreY));
+		__m128 toSampleX = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(sampleRayX, sampleDepth), invFocalLengthX), positionX);
+		__m128 toSampleY = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(sampleRayY, sampleDepth), invFocalLengthY), positionY);
+		__m128 toSampleZ = _mm_sub_ps(sampleDepth, depth);
+		__m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(toSampleX, toSampleX), _mm_mul_ps(toSampleY, toSampleY)), _mm_mul_ps(toSampleZ, toSampleZ));
+		__m128 falloff = _mm_sub_ps(one, _mm_mul_ps(distanceSquared, invRadiusSquared));
+		__m128 valid = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(sampleDepth, zero), _mm_cmpgt_ps(distanceSquared, zero)), _mm_cmpgt_ps(falloff, zero));
+
+		// A sample on the pixel itself divides by 0, valid masks whatever that made. The estimated reciprocal square root is plenty for a blurred term.
+		__m128 dotNormal = _mm_add_ps(_mm_add_ps(_mm_mul_ps(toSampleX, normalX), _mm_mul_ps(toSampleY, normalY)), _mm_mul_ps(toSampleZ, normalZ));
+		__m128 cosAngle = _mm_mul_ps(dotNormal, _mm_rsqrt_ps(distanceSquared));
+		__m128 contribution = _mm_mul_ps(_mm_max_ps(_mm_sub_ps(cosAngle, angleBias), zero), falloff);
+		occlusion = _mm_add_ps(occlusion, _mm_and_ps(valid, contribution));
+	}
+
+	__m128 result = _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(occlusion, _mm_set1_ps(ssaoIntensity / ssaoNumSamples))), zero);
+	_mm_storeu_ps(occlusionOut, _mm_or_ps(_mm_and_ps(drawn, result), _mm_andnot_ps(drawn, one)));
+}
+
+// One side of the separable blur, along (stepX, stepY). Taps further off in depth than the pixel's own depth / ssaoBlurDepthSharpness don't count.
+float BlurAmbientOcclusionAtPixel(const AmbientOcclusionBuffers& buffers, const std::vector<float>& source, int x, int y, int stepX, int stepY) {
+
+	int index = x + (y * buffers.width);
+	float depth = buffers.viewDepth[index];
+	if (depth <= 0.0f) {
+		return 1.0f;
+	}
+
+	float sharpness = ssaoBlurDepthSharpness / depth;
+	float sum = source[index] * buffers.blurWeights[0];
+	float totalWeight = buffers.blurWeights[0];
+	for (int i = -ssaoBlurRadius; i <= ssaoBlurRadius; i++)
+	{
+		int sampleX = x + (i * stepX);
+		int sampleY = y + (i * stepY);
+		if (i == 0 || sampleX < 0 || sampleY < 0 || sampleX >= buffers.width || sampleY >= buffers.height) {
+			continue;
+		}
+
+		int sampleIndex = sampleX + (sampleY * buffers.width);
+		float weight = buffers.blurWeights[std::abs(i)] * std::max(1.0f - (std::abs(buffers.viewDepth[sampleIndex] - depth) * sharpness), 0.0f);
+		sum += source[sampleIndex] * weight;
+		totalWeight += weight;
+	}
+	return sum / totalWeight;
+}
+
+// 4 pixels along x, every tap has to be inside the image along x. Taps off the top or bottom are skipped for all 4 at once.
+void BlurAmbientOcclusionBlockSSE(const AmbientOcclusionBuffers& buffers, const std::vector<float>& source, int x, int y, int stepX, int stepY, float* blurredOut) {
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+
+	int index = x + (y * buffers.width);
+	__m128 depth = _mm_loadu_ps(&buffers.viewDepth[index]);
+	__m128 drawn = _mm_cmpgt_ps(depth, zero);
+	if (_mm_movemask_ps(drawn) == 0) {
+		_mm_storeu_ps(blurredOut, one);
+		return;
+	}
+
+	// Lanes with nothing drawn divide by 1 instead of 0, their result is thrown away below.
+	__m128 sharpness = _mm_div_ps(_mm_set1_ps(ssaoBlurDepthSharpness), _mm_or_ps(_mm_and_ps(drawn, depth), _mm_andnot_ps(drawn, one)));
+
+	__m128 centreWeight = _mm_set1_ps(buffers.blurWeights[0]);
+	__m128 sum = _mm_mul_ps(_mm_loadu_ps(&source[index]), centreWeight);
+	__m128 totalWeight = centreWeight;
+	for (int i = -ssaoBlurRadius; i <= ssaoBlurRadius; i++)
+	{
+		int sampleY = y + (i * stepY);
+		if (i == 0 || sampleY < 0 || sampleY >= buffers.height) {
+			continue;
+		}
+
+		int sampleIndex = x + (i * stepX) + (sampleY * buffers.width);
+		__m128 depthDifference = _mm_andnot_ps(signMask, _mm_sub_ps(_mm_loadu_ps(&buffers.viewDepth[sampleIndex]), depth));
+		__m128 weight = _mm_mul_ps(_mm_set1_ps(buffers.blurWeights[std::abs(i)]), _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(depthDifference, sharpness)), zero));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&source[sampleIndex]), weight));
+		totalWeight = _mm_add_ps(totalWeight, weight);
+	}
+
+	__m128 result = _mm_div_ps(sum, totalWeight);
+	_mm_storeu_ps(blurredOut, _mm_or_ps(_mm_and_ps(drawn, result), _mm_andnot_ps(drawn, one)));
+}
+
+// Colour scaled in 8.8 fixed point, pixels with nothing drawn keep the background as it is.
+void ModulatePixelByAmbientOcclusion(unsigned char* colour, float depth, float occlusion) {
+
+	if (depth <= 0.0f) {
+		return;
+	}
+
+	int factor = (int)((occlusion * 256.0f) + 0.5f);
+	colour[0] = (unsigned char)((colour[0] * factor) >> 8);
+	colour[1] = (unsigned char)((colour[1] * factor) >> 8);
+	colour[2] = (unsigned char)((colour[2] * factor) >> 8);
+}
+
+// 4 pixels along x starting on an even one, so 2 half resolution occlusion values.
+void ModulatePixelBlockByAmbientOcclusionSSE(unsigned char* colour, const float* depth, float leftOcclusion, float rightOcclusion) {
+
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128 drawn = _mm_cmpgt_ps(_mm_loadu_ps(depth), _mm_setzero_ps());
+	if (_mm_movemask_ps(drawn) == 0) {
+		return;
+	}
+
+	__m128 occlusion = _mm_or_ps(_mm_and_ps(drawn, _mm_setr_ps(leftOcclusion, leftOcclusion, rightOcclusion, rightOcclusion)), _mm_andnot_ps(drawn, _mm_set1_ps(1.0f)));
+	__m128i factor = _mm_cvtps_epi32(_mm_mul_ps(occlusion, _mm_set1_ps(256.0f)));
+
+	// Each pixel's factor spread over its r, g and b, alpha is left at 256 so it comes out unchanged.
+	__m128i factor16 = _mm_packs_epi32(factor, factor);
+	factor16 = _mm_unpacklo_epi16(factor16, factor16);
+	const __m128i alphaLanes = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+	const __m128i alphaFactor = _mm_and_si128(alphaLanes, _mm_set1_epi16(256));
+	__m128i lowFactors = _mm_or_si128(_mm_andnot_si128(alphaLanes, _mm_unpacklo_epi32(factor16, factor16)), alphaFactor);
+	__m128i highFactors = _mm_or_si128(_mm_andnot_si128(alphaLanes, _mm_unpackhi_epi32(factor16, factor16)), alphaFactor);
+
+	__m128i colours = _mm_loadu_si128((const __m128i*)colour);
+	__m128i lowColours = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(colours, zero), lowFactors), 8);
+	__m128i highColours = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(colours, zero), highFactors), 8);
+	_mm_storeu_si128((__m128i*)colour, _mm_packus_epi16(lowColours, highColours));
+}
+
+// Half resolution pixels under a render tile, the tiles are an even number of pixels wide so they split the half resolution image exactly.
+void GetAmbientOcclusionTileBounds(const AmbientOcclusionBuffers& buffers, int tileIndex, const RenderTileGrid& tileGrid, Vector2Int& halfMin, Vector2Int& halfMax) {
+
+	Vector2Int tileCoords = { tileIndex % tileGrid.numTiles.x, tileIndex / tileGrid.numTiles.x };
+	halfMin = tileCoords * (renderTileSize / 2);
+	halfMax = { std::min(halfMin.x + (renderTileSize / 2), buffers.width) - 1, std::min(halfMin.y + (renderTileSize / 2), buffers.height) - 1 };
+}
+
+void DownsampleDepthForTile(AmbientOcclusionBuffers& buffers, const std::vector<float>& imageDepthData, int imageWidth, int imageHeight, const Vector2Int& halfMin, const Vector2Int& halfMax, bool useSSE) {
+
+	for (int y = halfMin.y; y <= halfMax.y; y++)
+	{
+		int fullY = y * 2;
+		const float* topRow = &imageDepthData[fullY * imageWidth];
+		const float* bottomRow = fullY + 1 < imageHeight ? topRow + imageWidth : topRow;
+		float* depthOut = &buffers.viewDepth[y * buffers.width];
+
+		int x = halfMin.x;
+		if (useSSE) {
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 numerator = _mm_set1_ps(buffers.viewDepthNumerator);
+			const __m128 offset = _mm_set1_ps(buffers.viewDepthOffset);
+			for (; x + 3 <= halfMax.x && (x * 2) + 8 <= imageWidth; x += 4)
+			{
+				__m128 left = _mm_max_ps(_mm_loadu_ps(topRow + (x * 2)), _mm_loadu_ps(bottomRow + (x * 2)));
+				__m128 right = _mm_max_ps(_mm_loadu_ps(topRow + (x * 2) + 4), _mm_loadu_ps(bottomRow + (x * 2) + 4));
+				__m128 nearest = _mm_max_ps(_mm_shuffle_ps(left, right, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(left, right, _MM_SHUFFLE(3, 1, 3, 1)));
+				__m128 viewDepth = _mm_div_ps(numerator, _mm_add_ps(nearest, offset));
+				_mm_storeu_ps(depthOut + x, _mm_and_ps(_mm_cmpgt_ps(nearest, zero), viewDepth));
+			}
+		}
+		for (; x <= halfMax.x; x++)
+		{
+			int fullX = x * 2;
+			int rightX = std::min(fullX + 1, imageWidth - 1);
+			float nearest = std::max(std::max(topRow[fullX], topRow[rightX]), std::max(bottomRow[fullX], bottomRow[rightX]));
+			depthOut[x] = NDCDepthToViewDepth(buffers, nearest);
+		}
+	}
+}
+
+void ComputeAmbientOcclusionForTile(AmbientOcclusionBuffers& buffers, const Vector2Int& halfMin, const Vector2Int& halfMax, bool useSSE) {
+
+	for (int y = halfMin.y; y <= halfMax.y; y++)
+	{
+		bool rowHasNeighbours = y > 0 && y < buffers.height - 1;
+		float* occlusionOut = &buffers.occlusion[y * buffers.width];
+		for (int x = halfMin.x; x <= halfMax.x;)
+		{
+			if (useSSE && rowHasNeighbours && x > 0 && x + 3 <= halfMax.x && x + 4 < buffers.width) {
+				ComputeAmbientOcclusionBlockSSE(buffers, x, y, occlusionOut + x);
+				x += 4;
+			}
+			else {
+				occlusionOut[x] = ComputeAmbientOcclusionAtPixel(buffers, x, y);
+				x++;
+			}
+		}
+	}
+}
+
+void BlurAmbientOcclusionForTile(AmbientOcclusionBuffers& buffers, const std::vector<float>& source, std::vector<float>& destination, int stepX, int stepY,
+	const Vector2Int& halfMin, const Vector2Int& halfMax, bool useSSE) {
+
+	for (int y = halfMin.y; y <= halfMax.y; y++)
+	{
+		float* blurredOut = &destination[y * buffers.width];
+		for (int x = halfMin.x; x <= halfMax.x;)
+		{
+			bool tapsInside = x - (ssaoBlurRadius * stepX) >= 0 && x + 3 + (ssaoBlurRadius * stepX) < buffers.width;
+			if (useSSE && tapsInside && x + 3 <= halfMax.x) {
+				BlurAmbientOcclusionBlockSSE(buffers, source, x, y, stepX, stepY, blurredOut + x);
+				x += 4;
+			}
+			else {
+				blurredOut[x] = BlurAmbientOcclusionAtPixel(buffers, source, x, y, stepX, stepY);
+				x++;
+			}
+		}
+	}
+}
+
+void ModulateTileByAmbientOcclusion(std::vector<unsigned char>& imageData, const std::vector<float>& imageDepthData, int imageWidth, int imageHeight,
+	const AmbientOcclusionBuffers& buffers, const Vector2Int& scissorMin, const Vector2Int& scissorMax, bool useSSE) {
+
+	for (int y = scissorMin.y; y <= scissorMax.y; y++)
+	{
+		const float* occlusionRow = &buffers.occlusion[(y / 2) * buffers.width];
+		for (int x = scissorMin.x; x <= scissorMax.x;)
+		{
+			int index = GetFlattenedImageDataSlotForDepthData(Vector2Int{ x, y }, imageWidth);
+			if (useSSE && x + 3 <= scissorMax.x) {
+				ModulatePixelBlockByAmbientOcclusionSSE(&imageData[index * NUM_COMPONENTS_IN_PIXEL], &imageDepthData[index], occlusionRow[x / 2], occlusionRow[(x / 2) + 1]);
+				x += 4;
+			}
+			else {
+				ModulatePixelByAmbientOcclusion(&imageData[index * NUM_COMPONENTS_IN_PIXEL], imageDepthData[index], occlusionRow[x / 2]);
+				x++;
+			}
+		}
+	}
+}
+
+// Each stage reads pixels of the neighbouring tiles the one before wrote, so they run one after the other, the tiles of a stage in parallel.
+// The vertical blur only reads the horizontal one, so it shares its stage with scaling the colour.
+void ApplyAmbientOcclusionInTiles(std::vector<unsigned char>& imageData, const std::vector<float>& imageDepthData, int imageWidth, int imageHeight,
+	AmbientOcclusionBuffers& buffers, const Mat4x4& projectionMatrix, RenderTileGrid& tileGrid, ThreadPool& threadPool) {
+
+	PROFILE_FUNCTION();
+
+	buffers.focalLengthX = std::abs(projectionMatrix[0][0]) * buffers.width * 0.5f;
+	buffers.focalLengthY = std::abs(projectionMatrix[1][1]) * buffers.height * 0.5f;
+	buffers.centreX = buffers.width * 0.5f;
+	buffers.centreY = buffers.height * 0.5f;
+	// NDC z of the negated projection is -[2][2] - [3][2] / w, with w the view depth.
+	buffers.viewDepthNumerator = -projectionMatrix[3][2];
+	buffers.viewDepthOffset = projectionMatrix[2][2];
+
+	bool useSSE = activePixelKernel != PIXEL_KERNEL_SCALAR;
+	int numTiles = tileGrid.numTiles.x * tileGrid.numTiles.y;
+
+	threadPool.ParallelFor(numTiles, [&](int tileIndex) {
+
+		Vector2Int halfMin, halfMax;
+		GetAmbientOcclusionTileBounds(buffers, tileIndex, tileGrid, halfMin, halfMax);
+		DownsampleDepthForTile(buffers, imageDepthData, imageWidth, imageHeight, halfMin, halfMax, useSSE);
+	});
+
+	threadPool.ParallelFor(numTiles, [&](int tileIndex) {
+
+		Vector2Int halfMin, halfMax;
+		GetAmbientOcclusionTileBounds(buffers, tileIndex, tileGrid, halfMin, halfMax);
+		ComputeAmbientOcclusionForTile(buffers, halfMin, halfMax, useSSE);
+	});
+
+	threadPool.ParallelFor(numTiles, [&](int tileIndex) {
+
+		Vector2Int halfMin, halfMax;
+		GetAmbientOcclusionTileBounds(buffers, tileIndex, tileGrid, halfMin, halfMax);
+		BlurAmbientOcclusionForTile(buffers, buffers.occlusion, buffers.blurred, 1, 0, halfMin, halfMax, useSSE);
+	});
+
+	threadPool.ParallelFor(numTiles, [&](int tileIndex) {
+
+		Vector2Int halfMin, halfMax;
+		GetAmbientOcclusionTileBounds(buffers, tileIndex, tileGrid, halfMin, halfMax);
+		BlurAmbientOcclusionForTile(buffers, buffers.blurred, buffers.occlusion, 0, 1, halfMin, halfMax, useSSE);
+
+		Vector2Int tileCoords = { tileIndex % tileGrid.numTiles.x, tileIndex / tileGrid.numTiles.x };
+		Vector2Int scissorMin = tileCoords * renderTileSize;
+		Vector2Int scissorMax = { std::min(scissorMin.x + renderTileSize, imageWidth) - 1, std::min(scissorMin.y + renderTileSize, imageHeight) - 1 };
+		ModulateTileByAmbientOcclusion(imageData, imageDepthData, imageWidth, imageHeight, buffers, scissorMin, scissorMax, useSSE);
+	});
+}
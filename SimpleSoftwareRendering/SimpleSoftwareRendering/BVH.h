@@ -0,0 +1,454 @@
+#pragma once
+
+#include <vector>
+#include <cfloat>
+#include <cstdint>
+#include <algorithm>
+#include <immintrin.h>
+
+#include "Instrumentor.h"
+
+#include "Geometry.h"
+#include "Model.h"
+#include "Bounds.h"
+#include "ThreadPool.h"
+#include "WorldConstants.h"
+
+// Two nodes per 64 byte cache line. Children are always stored next to each other, so a node only needs the index of the first one.
+struct BVHNode {
+
+	Vector3 boundsMin;
+	uint32_t leftFirst;			// First child for interior nodes, the second one is right after it. First triangle for leaves.
+	Vector3 boundsMax;
+	uint32_t numTriangles;		// 0 for interior nodes.
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode is loaded straight into SSE registers and packed two per cache line.");
+
+// Stored ready for the Moller-Trumbore test, in the order the leaves reference them.
+struct BVHTriangle {
+
+	Vector3 vertex0;
+	Vector3 edge1;
+	Vector3 edge2;
+	uint32_t meshIndex;
+	uint32_t triangleIndex;		// Into the mesh's indices, the triangle's vertices are indices[triangleIndex * 3 + 0 .. 2].
+	CullMode cullMode;			// Its mesh's, only looked at by rays that stand in for the rasterizer (see TraceRayClosestHit).
+};
+
+// OBJECT SPACE!!! Built over every triangle of one model, rays have to be brought into the model's space before being traced.
+struct BVH {
+
+	std::vector<BVHNode> nodes;		// nodes[0] is the root.
+	std::vector<BVHTriangle> triangles;
+};
+
+struct Ray {
+
+	Vector3 origin;
+	Vector3 direction;
+	Vector3 invDirection;
+};
+
+struct RayHit {
+
+	bool hit = false;
+	float distance = FLT_MAX;	// In units of the ray's direction, so a world distance only when it's normalized.
+	float u = 0.0f, v = 0.0f;	// Barycentric weights of the triangle's second and third vertex.
+	uint32_t meshIndex = 0;
+	uint32_t triangleIndex = 0;
+};
+
+Ray MakeRay(const Vector3& origin, const Vector3& direction) {
+	return Ray{ origin, direction, 1.0f / direction };
+}
+
+//--------------------------------------------------------Build--------------------------------------------------------
+
+float SurfaceArea(const AABB& aabb) {
+
+	Vector3 extent = aabb.max - aabb.min;
+	return 2.0f * ((extent.x * extent.y) + (extent.y * extent.z) + (extent.z * extent.x));
+}
+
+// Everything the recursive build reads, triangleOrder is partitioned in place as nodes are split.
+struct BVHBuildData {
+
+	std::vector<AABB> triangleBounds;
+	std::vector<Vector3> triangleCentroids;
+	std::vector<uint32_t> triangleOrder;
+};
+
+// A subtree left for later so it can be built on another thread, its node is a placeholder until then.
+struct BVHSubtreeTask {
+
+	uint32_t nodeIndex;
+	uint32_t first;
+	uint32_t count;
+	int depth;
+};
+
+// Picks the split with binned SAH, the cost of a split is the triangles on each side weighted by how likely a ray is to hit that side's box.
+// False when keeping the node as a leaf is cheaper. Otherwise returns the axis and the bin the right side starts at.
+bool FindBestSAHSplit(const BVHBuildData& buildData, uint32_t first, uint32_t count, const AABB& nodeBounds, const AABB& centroidBounds, int& bestAxis, int& bestSplitBin) {
+
+	float bestCost = FLT_MAX;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float axisMin = centroidBounds.min[axis];
+		float axisExtent = centroidBounds.max[axis] - axisMin;
+		if (axisExtent <= 0.0f) {
+			continue;
+		}
+
+		AABB binBounds[bvhNumBins];
+		uint32_t binCounts[bvhNumBins] = { 0 };
+		float binScale = bvhNumBins / axisExtent;
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			uint32_t triangle = buildData.triangleOrder[i];
+			int bin = std::min((int)((buildData.triangleCentroids[triangle][axis] - axisMin) * binScale), bvhNumBins - 1);
+			binCounts[bin]++;
+			MergeAABB(binBounds[bin], buildData.triangleBounds[triangle]);
+		}
+
+		// Sweeping from the right first leaves every split's right side cost ready for the left to right sweep.
+		float rightCosts[bvhNumBins];
+		AABB rightBounds;
+		uint32_t rightCount = 0;
+		for (int bin = bvhNumBins - 1; bin > 0; bin--)
+		{
+			MergeAABB(rightBounds, binBounds[bin]);
+			rightCount += binCounts[bin];
+			rightCosts[bin] = rightCount > 0 ? rightCount * SurfaceArea(rightBounds) : 0.0f;
+		}
+
+		AABB leftBounds;
+		uint32_t leftCount = 0;
+		for (int bin = 1; bin < bvhNumBins; bin++)
+		{
+			MergeAABB(leftBounds, binBounds[bin - 1]);
+			leftCount += binCounts[bin - 1];
+			if (leftCount == 0 || leftCount == count) {
+				continue;
+			}
+
+			float cost = (leftCount * SurfaceArea(leftBounds)) + rightCosts[bin];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplitBin = bin;
+			}
+		}
+	}
+
+	if (bestCost == FLT_MAX) {
+		return false;
+	}
+
+	float splitCost = bvhTraversalCost + (bestCost / SurfaceArea(nodeBounds));
+	float leafCost = (float)count;
+	return splitCost < leafCost || count > bvhMaxLeafTriangles;
+}
+
+// Builds the subtree for triangleOrder[first, first + count) into nodes[nodeIndex], depth levels below the root. Subtrees of up to
+// deferThreshold triangles are added to deferredTasks instead when it's given, the caller builds those later.
+void BuildBVHSubtree(BVHBuildData& buildData, std::vector<BVHNode>& nodes, uint32_t nodeIndex, uint32_t first, uint32_t count, int depth,
+	uint32_t deferThreshold, std::vector<BVHSubtreeTask>* deferredTasks) {
+
+	if (deferredTasks != nullptr && count <= deferThreshold) {
+		deferredTasks->push_back({ nodeIndex, first, count, depth });
+		return;
+	}
+
+	AABB nodeBounds;
+	AABB centroidBounds;
+	for (uint32_t i = first; i < first + count; i++)
+	{
+		uint32_t triangle = buildData.triangleOrder[i];
+		MergeAABB(nodeBounds, buildData.triangleBounds[triangle]);
+		GrowAABB(centroidBounds, buildData.triangleCentroids[triangle]);
+	}
+
+	nodes[nodeIndex].boundsMin = nodeBounds.min;
+	nodes[nodeIndex].boundsMax = nodeBounds.max;
+	nodes[nodeIndex].leftFirst = first;
+	nodes[nodeIndex].numTriangles = count;
+
+	// Traversal stacks hold bvhMaxTraversalDepth nodes and a level can leave one more on them than it took off,
+	// so clustered or degenerate input that keeps SAH splitting off a few triangles at a time ends in a (big) leaf here instead.
+	if (count <= 1 || depth >= bvhMaxTraversalDepth - 1) {
+		return;
+	}
+
+	int splitAxis = 0;
+	int splitBin = 0;
+	uint32_t leftCount = 0;
+	if (FindBestSAHSplit(buildData, first, count, nodeBounds, centroidBounds, splitAxis, splitBin)) {
+
+		float axisMin = centroidBounds.min[splitAxis];
+		float binScale = bvhNumBins / (centroidBounds.max[splitAxis] - axisMin);
+		uint32_t* middle = std::partition(&buildData.triangleOrder[first], &buildData.triangleOrder[first] + count, [&](uint32_t triangle) {
+			return std::min((int)((buildData.triangleCentroids[triangle][splitAxis] - axisMin) * binScale), bvhNumBins - 1) < splitBin;
+		});
+		leftCount = middle - &buildData.triangleOrder[first];
+	}
+	else if (count > bvhMaxLeafTriangles) {
+
+		// Every centroid in the same place, SAH can't tell them apart. Halving keeps leaves small.
+		leftCount = count / 2;
+	}
+
+	if (leftCount == 0 || leftCount == count) {
+		return;
+	}
+
+	uint32_t leftChild = nodes.size();
+	nodes.push_back(BVHNode());
+	nodes.push_back(BVHNode());
+	nodes[nodeIndex].leftFirst = leftChild;
+	nodes[nodeIndex].numTriangles = 0;
+
+	BuildBVHSubtree(buildData, nodes, leftChild, first, leftCount, depth + 1, deferThreshold, deferredTasks);
+	BuildBVHSubtree(buildData, nodes, leftChild + 1, first + leftCount, count - leftCount, depth + 1, deferThreshold, deferredTasks);
+}
+
+// The top of the tree is built on this thread until subtrees get small enough, then those are built in parallel into their own node
+// arrays and appended. Triangle ranges of different subtrees never overlap, so they can be partitioned at the same time.
+void BuildBVH(BVH& bvh, const Model& model, ThreadPool& threadPool) {
+
+	PROFILE_FUNCTION();
+
+	BVHBuildData buildData;
+	std::vector<BVHTriangle> unorderedTriangles;
+
+	for (uint32_t meshIndex = 0; meshIndex < model.meshes.size(); meshIndex++)
+	{
+		const Mesh& mesh = model.meshes[meshIndex];
+		for (uint32_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+		{
+			const Vector3& a = mesh.vertices[mesh.indices[i + 0]].position;
+			const Vector3& b = mesh.vertices[mesh.indices[i + 1]].position;
+			const Vector3& c = mesh.vertices[mesh.indices[i + 2]].position;
+
+			AABB triangleBounds;
+			GrowAABB(triangleBounds, a);
+			GrowAABB(triangleBounds, b);
+			GrowAABB(triangleBounds, c);
+
+			buildData.triangleBounds.push_back(triangleBounds);
+			buildData.triangleCentroids.push_back((a + b + c) * (1.0f / 3.0f));
+			unorderedTriangles.push_back({ a, b - a, c - a, meshIndex, i / 3, mesh.cullMode });
+		}
+	}
+
+	uint32_t numTriangles = unorderedTriangles.size();
+	buildData.triangleOrder.resize(numTriangles);
+	for (uint32_t i = 0; i < numTriangles; i++)
+	{
+		buildData.triangleOrder[i] = i;
+	}
+
+	bvh.nodes.clear();
+	bvh.nodes.reserve(2 * numTriangles);
+	bvh.nodes.push_back({ Vector3(0.0f), 0, Vector3(0.0f), 0 });
+
+	if (numTriangles > 0) {
+
+		// Enough subtrees that the threads stay busy even when they come out uneven.
+		uint32_t deferThreshold = std::max(numTriangles / (threadPool.NumThreads() * 8), bvhMinParallelSubtreeTriangles);
+		std::vector<BVHSubtreeTask> deferredTasks;
+		BuildBVHSubtree(buildData, bvh.nodes, 0, 0, numTriangles, 0, deferThreshold, &deferredTasks);
+
+		std::vector<std::vector<BVHNode>> subtreeNodes(deferredTasks.size());
+		threadPool.ParallelFor(deferredTasks.size(), [&](int taskIndex) {
+			const BVHSubtreeTask& task = deferredTasks[taskIndex];
+			subtreeNodes[taskIndex].push_back(BVHNode());
+			BuildBVHSubtree(buildData, subtreeNodes[taskIndex], 0, task.first, task.count, task.depth, 0, nullptr);
+		});
+
+		// Subtree root goes into its placeholder, the rest is appended. Child pairs keep their order, so only interior node indices shift.
+		for (int taskIndex = 0; taskIndex < deferredTasks.size(); taskIndex++)
+		{
+			const std::vector<BVHNode>& nodes = subtreeNodes[taskIndex];
+			uint32_t indexOffset = bvh.nodes.size() - 1;
+			for (int i = 0; i < nodes.size(); i++)
+			{
+				BVHNode node = nodes[i];
+				if (node.numTriangles == 0) {
+					node.leftFirst += indexOffset;
+				}
+
+				if (i == 0) {
+					bvh.nodes[deferredTasks[taskIndex].nodeIndex] = node;
+				}
+				else {
+					bvh.nodes.push_back(node);
+				}
+			}
+		}
+	}
+
+	bvh.triangles.resize(numTriangles);
+	for (uint32_t i = 0; i < numTriangles; i++)
+	{
+		bvh.triangles[i] = unorderedTriangles[buildData.triangleOrder[i]];
+	}
+}
+
+//--------------------------------------------------------Queries--------------------------------------------------------
+
+// The ray's origin and 1 / direction broadcast into registers once, every box test then only loads the node.
+struct RaySSE {
+
+	__m128 origin;
+	__m128 invDirection;
+};
+
+RaySSE MakeRaySSE(const Ray& ray) {
+	return RaySSE{ _mm_setr_ps(ray.origin.x, ray.origin.y, ray.origin.z, 0.0f), _mm_setr_ps(ray.invDirection.x, ray.invDirection.y, ray.invDirection.z, 0.0f) };
+}
+
+// Slab test on all three axes at once. Returns the distance the ray enters the box at, or FLT_MAX when it misses it or only gets there past maxDistance.
+float IntersectRayNodeSSE(const RaySSE& ray, const BVHNode& node, float maxDistance) {
+
+	// The fourth lane holds leftFirst and numTriangles, it's overwritten with x before the lanes are combined.
+	__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.boundsMin.x), ray.origin), ray.invDirection);
+	__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.boundsMax.x), ray.origin), ray.invDirection);
+
+	__m128 tNear = _mm_min_ps(t0, t1);
+	__m128 tFar = _mm_max_ps(t0, t1);
+	tNear = _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(0, 2, 1, 0));
+	tFar = _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(0, 2, 1, 0));
+
+	tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 3, 0, 1)));
+	tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 0, 3, 2)));
+	tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 3, 0, 1)));
+	tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 0, 3, 2)));
+
+	float entry = std::max(_mm_cvtss_f32(tNear), 0.0f);
+	float exit = std::min(_mm_cvtss_f32(tFar), maxDistance);
+	return entry <= exit ? entry : FLT_MAX;
+}
+
+// The determinant is -dot(ray direction, face normal), so it's positive when the ray comes at the triangle's front face.
+bool IsRayTriangleHitCulled(float determinant, CullMode cullMode) {
+
+	if (cullMode == CULL_MODE_BACK) {
+		return determinant <= 0.0f;
+	}
+	if (cullMode == CULL_MODE_FRONT) {
+		return determinant >= 0.0f;
+	}
+	return determinant == 0.0f;
+}
+
+// Moller-Trumbore. With cullFaces the triangle's cull mode is applied like the rasterizer does, otherwise hits from both sides count.
+bool IntersectRayTriangle(const Ray& ray, const BVHTriangle& triangle, float maxDistance, bool cullFaces, float& distance, float& u, float& v) {
+
+	Vector3 p = glm::cross(ray.direction, triangle.edge2);
+	float determinant = glm::dot(triangle.edge1, p);
+	if (IsRayTriangleHitCulled(determinant, cullFaces ? triangle.cullMode : CULL_MODE_NONE)) {
+		return false;
+	}
+
+	float invDeterminant = 1.0f / determinant;
+	Vector3 originToVertex0 = ray.origin - triangle.vertex0;
+	u = glm::dot(originToVertex0, p) * invDeterminant;
+	if (u < 0.0f || u > 1.0f) {
+		return false;
+	}
+
+	Vector3 q = glm::cross(originToVertex0, triangle.edge1);
+	v = glm::dot(ray.direction, q) * invDeterminant;
+	if (v < 0.0f || u + v > 1.0f) {
+		return false;
+	}
+
+	distance = glm::dot(triangle.edge2, q) * invDeterminant;
+	return distance > 0.0f && distance < maxDistance;
+}
+
+// Walks nearer children first and skips anything that starts past the closest hit found so far.
+// With anyHit it stops at the first triangle hit, which is all shadow or visibility rays need.
+bool TraceRay(const BVH& bvh, const Ray& ray, float maxDistance, bool anyHit, bool cullFaces, RayHit& rayHit, uint32_t* nodesVisited = nullptr) {
+
+	rayHit = RayHit();
+	if (bvh.triangles.empty()) {
+		return false;
+	}
+
+	RaySSE raySSE = MakeRaySSE(ray);
+	float closestDistance = maxDistance;
+
+	if (IntersectRayNodeSSE(raySSE, bvh.nodes[0], closestDistance) == FLT_MAX) {
+		return false;
+	}
+
+	uint32_t nodeStack[bvhMaxTraversalDepth];
+	float nodeStackDistances[bvhMaxTraversalDepth];
+	int stackSize = 0;
+
+	uint32_t nodeIndex = 0;
+	while (true)
+	{
+		const BVHNode& node = bvh.nodes[nodeIndex];
+		if (nodesVisited) {
+			(*nodesVisited)++;
+		}
+		if (node.numTriangles > 0) {
+			for (uint32_t i = node.leftFirst; i < node.leftFirst + node.numTriangles; i++)
+			{
+				float distance, u, v;
+				if (IntersectRayTriangle(ray, bvh.triangles[i], closestDistance, cullFaces, distance, u, v)) {
+					closestDistance = distance;
+					rayHit = { true, distance, u, v, bvh.triangles[i].meshIndex, bvh.triangles[i].triangleIndex };
+					if (anyHit) {
+						return true;
+					}
+				}
+			}
+		}
+		else {
+			uint32_t nearChild = node.leftFirst;
+			uint32_t farChild = node.leftFirst + 1;
+			float nearDistance = IntersectRayNodeSSE(raySSE, bvh.nodes[nearChild], closestDistance);
+			float farDistance = IntersectRayNodeSSE(raySSE, bvh.nodes[farChild], closestDistance);
+			if (farDistance < nearDistance) {
+				std::swap(nearChild, farChild);
+				std::swap(nearDistance, farDistance);
+			}
+
+			if (nearDistance != FLT_MAX) {
+				if (farDistance != FLT_MAX) {
+					nodeStack[stackSize] = farChild;
+					nodeStackDistances[stackSize] = farDistance;
+					stackSize++;
+				}
+				nodeIndex = nearChild;
+				continue;
+			}
+		}
+
+		// Nodes pushed before a closer hit turned up may now start past it.
+		do {
+			if (stackSize == 0) {
+				return rayHit.hit;
+			}
+			stackSize--;
+		} while (nodeStackDistances[stackSize] > closestDistance);
+		nodeIndex = nodeStack[stackSize];
+	}
+}
+
+// Camera rays want cullFaces so they see what the rasterizer would, anything else (picking, shadows) hits both sides.
+bool TraceRayClosestHit(const BVH& bvh, const Ray& ray, float maxDistance, RayHit& rayHit, bool cullFaces = false) {
+	return TraceRay(bvh, ray, maxDistance, false, cullFaces, rayHit);
+}
+
+// nodesVisited, when given, is added to so callers can keep a budget of how much tracing they do.
+bool TraceRayAnyHit(const BVH& bvh, const Ray& ray, float maxDistance, uint32_t* nodesVisited = nullptr) {
+
+	RayHit rayHit;
+	return TraceRay(bvh, ray, maxDistance, true, false, rayHit, nodesVisited);
+}
\ No newline at end of file
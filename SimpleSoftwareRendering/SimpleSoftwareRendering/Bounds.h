@@ -0,0 +1,132 @@
+#pragma once
+
+#include <vector>
+#include <cfloat>
+#include <algorithm>
+
+#include "Geometry.h"
+
+// OBJECT SPACE!!! Both are built once at load time from the untransformed vertices.
+struct AABB {
+
+	Vector3 min = Vector3(FLT_MAX);
+	Vector3 max = Vector3(-FLT_MAX);
+};
+
+struct BoundingSphere {
+
+	Vector3 centre = Vector3(0.0f);
+	float radius = 0.0f;
+};
+
+bool IsAABBEmpty(const AABB& aabb) {
+	return aabb.min.x > aabb.max.x;
+}
+
+Vector3 GetAABBCentre(const AABB& aabb) {
+	return (aabb.min + aabb.max) * 0.5f;
+}
+
+Vector3 GetAABBHalfExtents(const AABB& aabb) {
+	return (aabb.max - aabb.min) * 0.5f;
+}
+
+void GrowAABB(AABB& aabb, const Vector3& position) {
+
+	aabb.min = glm::min(aabb.min, position);
+	aabb.max = glm::max(aabb.max, position);
+}
+
+void MergeAABB(AABB& aabb, const AABB& other) {
+
+	aabb.min = glm::min(aabb.min, other.min);
+	aabb.max = glm::max(aabb.max, other.max);
+}
+
+// The sphere is centred on the box, its radius is the furthest vertex from there. That's never bigger than the box's half diagonal and usually a lot smaller.
+void ComputeBounds(const std::vector<Point>& vertices, AABB& aabb, BoundingSphere& boundingSphere) {
+
+	aabb = AABB();
+	for (int i = 0; i < vertices.size(); i++)
+	{
+		GrowAABB(aabb, vertices[i].position);
+	}
+
+	if (IsAABBEmpty(aabb)) {
+		boundingSphere = BoundingSphere();
+		return;
+	}
+
+	boundingSphere.centre = GetAABBCentre(aabb);
+	float furthestDistanceSquared = 0.0f;
+	for (int i = 0; i < vertices.size(); i++)
+	{
+		Vector3 offset = vertices[i].position - boundingSphere.centre;
+		furthestDistanceSquared = std::max(furthestDistanceSquared, glm::dot(offset, offset));
+	}
+	boundingSphere.radius = sqrtf(furthestDistanceSquared);
+}
+
+// Object space copies of the clip space planes, for one model view projection matrix. Normalized, so distances to them are in object space units.
+struct Frustum {
+
+	Vector4 planes[6];
+	int numPlanes;
+};
+
+enum FrustumTestResult {
+	FRUSTUM_OUTSIDE,		// Entirely outside at least one plane.
+	FRUSTUM_INTERSECTING,
+	FRUSTUM_INSIDE			// Entirely inside every plane, nothing in it needs clipping.
+};
+
+// A clip space plane (coefficients . clipPosition + offset) pulled back through the matrix that takes object space points to clip space,
+// which is the Gribb and Hartmann plane extraction done for whatever planes the clipper uses instead of only the canonical six.
+Frustum ExtractFrustum(const Mat4x4& modelViewProjectionMatrix, const ClipSpacePlane* clipPlanes, int numPlanes) {
+
+	Frustum frustum;
+	frustum.numPlanes = numPlanes;
+
+	Mat4x4 transposedMatrix = glm::transpose(modelViewProjectionMatrix);
+	for (int i = 0; i < numPlanes; i++)
+	{
+		Vector4 plane = transposedMatrix * clipPlanes[i].coefficients;
+		plane.w += clipPlanes[i].offset;
+
+		float normalLength = glm::length(Vector3(plane));
+		frustum.planes[i] = normalLength > 0.0f ? plane / normalLength : plane;
+	}
+	return frustum;
+}
+
+// The sphere is tried first since it's one dot product per plane. Where it straddles a plane the box usually settles it, its extent along the normal is often smaller.
+FrustumTestResult TestBoundsAgainstFrustum(const Frustum& frustum, const AABB& aabb, const BoundingSphere& boundingSphere) {
+
+	Vector3 boxCentre = GetAABBCentre(aabb);
+	Vector3 boxHalfExtents = GetAABBHalfExtents(aabb);
+
+	FrustumTestResult result = FRUSTUM_INSIDE;
+	for (int i = 0; i < frustum.numPlanes; i++)
+	{
+		const Vector4& plane = frustum.planes[i];
+		Vector3 normal = Vector3(plane);
+
+		float sphereDistance = glm::dot(normal, boundingSphere.centre) + plane.w;
+		if (sphereDistance < -boundingSphere.radius) {
+			return FRUSTUM_OUTSIDE;
+		}
+		if (sphereDistance >= boundingSphere.radius) {
+			continue;
+		}
+
+		float boxDistance = glm::dot(normal, boxCentre) + plane.w;
+		float boxExtent = glm::dot(glm::abs(normal), boxHalfExtents);
+		if (boxDistance < -boxExtent) {
+			return FRUSTUM_OUTSIDE;
+		}
+		if (boxDistance < boxExtent) {
+			result = FRUSTUM_INTERSECTING;
+		}
+	}
+	return result;
+}
\ No newline at end of file
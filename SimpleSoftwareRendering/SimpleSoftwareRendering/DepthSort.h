@@ -0,0 +1,123 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "Instrumentor.h"
+
+#include "Geometry.h"
+#include "Model.h"
+#include "WorldConstants.h"
+
+// Drawing near things first lets the early depth test kill the fragments of whatever is behind them before they're shaded.
+enum DepthSortMode {
+	DEPTH_SORT_NONE,						// Meshes and triangles in the order they were loaded.
+	DEPTH_SORT_MESHES,						// Meshes front to back by the view depth of their bounding sphere centre.
+	DEPTH_SORT_MESHES_AND_CLUSTERS,			// Also every mesh's meshlets, front to back by their nearest vertex.
+	NUM_DEPTH_SORT_MODES
+};
+
+const char* depthSortModeNames[NUM_DEPTH_SORT_MODES] = { "None", "Meshes", "Meshes and clusters" };
+
+DepthSortMode activeDepthSortMode = DEPTH_SORT_MESHES_AND_CLUSTERS;
+
+// What's being sorted (a mesh or cluster index) and its view depth quantized to 16 bits, nearer is smaller.
+struct DepthSortEntry {
+
+	uint16_t key;
+	uint32_t index;
+};
+
+// View space depth of a point, the w the negated model view projection matrix gives it (see clipSpacePlanesScreen).
+float GetViewDepth(const Mat4x4& modelViewProjectionMatrix, const Vector3& position) {
+
+	const Mat4x4& m = modelViewProjectionMatrix;
+	return ((m[0][3] * position.x) + (m[1][3] * position.y)) + ((m[2][3] * position.z) + m[3][3]);
+}
+
+// Keys are spread over the depth range of this batch of entries rather than the whole near to far range,
+// so a scene that only covers a few units still gets all 65536 steps.
+void QuantizeViewDepths(const std::vector<float>& viewDepths, std::vector<DepthSortEntry>& entries) {
+
+	entries.resize(viewDepths.size());
+	if (viewDepths.empty()) {
+		return;
+	}
+
+	float minDepth = *std::min_element(viewDepths.begin(), viewDepths.end());
+	float maxDepth = *std::max_element(viewDepths.begin(), viewDepths.end());
+	float scale = maxDepth > minDepth ? 65535.0f / (maxDepth - minDepth) : 0.0f;
+
+	for (uint32_t i = 0; i < viewDepths.size(); i++)
+	{
+		entries[i].key = (uint16_t)((viewDepths[i] - minDepth) * scale);
+		entries[i].index = i;
+	}
+}
+
+// Two 8 bit passes of an LSD radix sort. It's stable, so entries at the same quantized depth keep their submission order.
+void RadixSortDepthSortEntries(std::vector<DepthSortEntry>& entries, std::vector<DepthSortEntry>& scratch) {
+
+	PROFILE_FUNCTION();
+
+	scratch.resize(entries.size());
+
+	for (int shift = 0; shift < 16; shift += 8)
+	{
+		uint32_t offsets[256] = { 0 };
+		for (int i = 0; i < entries.size(); i++)
+		{
+			offsets[(entries[i].key >> shift) & 0xFF]++;
+		}
+
+		// Counts to the first output slot of each digit.
+		uint32_t runningTotal = 0;
+		for (int digit = 0; digit < 256; digit++)
+		{
+			uint32_t count = offsets[digit];
+			offsets[digit] = runningTotal;
+			runningTotal += count;
+		}
+
+		for (int i = 0; i < entries.size(); i++)
+		{
+			scratch[offsets[(entries[i].key >> shift) & 0xFF]++] = entries[i];
+		}
+
+		entries.swap(scratch);
+	}
+}
+
+// Fills meshOrder with the model's mesh indices, nearest mesh first unless sorting is turned off.
+void SortMeshesFrontToBack(const Model& model, const Mat4x4& modelViewProjectionMatrix, std::vector<unsigned int>& meshOrder) {
+
+	PROFILE_FUNCTION();
+
+	meshOrder.resize(model.meshes.size());
+	if (activeDepthSortMode == DEPTH_SORT_NONE) {
+		for (unsigned int i = 0; i < meshOrder.size(); i++)
+		{
+			meshOrder[i] = i;
+		}
+		return;
+	}
+
+	static std::vector<float> viewDepths;
+	static std::vector<DepthSortEntry> entries;
+	static std::vector<DepthSortEntry> scratch;
+
+	viewDepths.resize(model.meshes.size());
+	for (int i = 0; i < model.meshes.size(); i++)
+	{
+		viewDepths[i] = GetViewDepth(modelViewProjectionMatrix, model.meshes[i].boundingSphere.centre);
+	}
+
+	QuantizeViewDepths(viewDepths, entries);
+	RadixSortDepthSortEntries(entries, scratch);
+
+	for (int i = 0; i < entries.size(); i++)
+	{
+		meshOrder[i] = entries[i].index;
+	}
+}
\ No newline at end of file
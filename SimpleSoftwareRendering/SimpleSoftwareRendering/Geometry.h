@@ -53,6 +53,13 @@ public:
 	Point pointOnPlane;
 };
 
+// Plane in homogeneous clip space, a position is on the inside when dot(coefficients, position) + offset >= 0.
+struct ClipSpacePlane {
+
+	Vector4 coefficients;
+	float offset;
+};
+
 Vector4 ColourToVector4(const Colour& curColour) {
 	return Vector4{ curColour.r, curColour.g, curColour.b, curColour.a };
 }
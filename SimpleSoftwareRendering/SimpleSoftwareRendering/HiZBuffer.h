@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "Geometry.h"
+#include "WorldConstants.h"
+
+// Coarse copy of imageDepthData, the smallest and largest depth of every hiZTileSize x hiZTileSize block of pixels.
+// Larger depth is nearer, so nothing already in a tile is further away than its minDepth, anything that can't get nearer than that can be skipped.
+// Hi-Z tiles sit inside render tiles, so they're only ever touched by the thread rasterizing that render tile.
+struct HiZBuffer {
+
+	Vector2Int numTiles;
+	std::vector<float> minDepth;
+	std::vector<float> maxDepth;
+
+	// Set when a pixel in the tile passed the depth test since minDepth and maxDepth were last rebuilt, see RefreshDirtyHiZTiles.
+	// Bytes rather than vector<bool> so threads marking tiles of different render tiles never share a word.
+	std::vector<unsigned char> dirty;
+};
+
+// When false the rasterizer walks every tile, to compare against the Hi-Z rejection.
+bool useHiZ = true;
+
+// Interpolated depth can round a little past the nearest vertex depth, rejection is only done with at least this much relative margin.
+const float hiZRejectMargin = 1.0f + 1e-5f;
+
+int GetHiZTileIndex(const int& xCoord, const int& yCoord, const int& numTilesX) {
+	return xCoord + (yCoord * numTilesX);
+}
+
+void InitHiZBuffer(HiZBuffer& hiZ, int imageWidth, int imageHeight) {
+
+	hiZ.numTiles = { (imageWidth + hiZTileSize - 1) / hiZTileSize, (imageHeight + hiZTileSize - 1) / hiZTileSize };
+	hiZ.minDepth.resize(hiZ.numTiles.x * hiZ.numTiles.y);
+	hiZ.maxDepth.resize(hiZ.numTiles.x * hiZ.numTiles.y);
+	hiZ.dirty.resize(hiZ.numTiles.x * hiZ.numTiles.y);
+}
+
+// Has to be called with the same value whenever imageDepthData is cleared.
+void ClearHiZBuffer(HiZBuffer& hiZ, float clearValue) {
+
+	std::fill(hiZ.minDepth.begin(), hiZ.minDepth.end(), clearValue);
+	std::fill(hiZ.maxDepth.begin(), hiZ.maxDepth.end(), clearValue);
+	std::fill(hiZ.dirty.begin(), hiZ.dirty.end(), 0);
+}
+
+// True when nothing nearer than nearestDepth can pass the depth test anywhere in the tile.
+// A dirty tile's minDepth is from before its latest writes, depth only gets nearer so it can only reject less than an exact one would.
+bool IsHiZTileOccluded(const HiZBuffer& hiZ, int tileX, int tileY, float nearestDepth) {
+	return nearestDepth * hiZRejectMargin <= hiZ.minDepth[GetHiZTileIndex(tileX, tileY, hiZ.numTiles.x)];
+}
+
+// True when every tile in the (inclusive) range is occluded.
+bool IsHiZRegionOccluded(const HiZBuffer& hiZ, const Vector2Int& tileStart, const Vector2Int& tileEnd, float nearestDepth) {
+
+	for (int y = tileStart.y; y <= tileEnd.y; y++)
+	{
+		for (int x = tileStart.x; x <= tileEnd.x; x++)
+		{
+			if (!IsHiZTileOccluded(hiZ, x, y, nearestDepth)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Rebuilds one tile's min and max from imageDepthData after pixels in it may have been written.
+// Depth only ever gets nearer, but the pixel that was holding the minimum may be one of the written ones, so a full rescan is the only exact update.
+void UpdateHiZTile(HiZBuffer& hiZ, const std::vector<float>& imageDepthData, int imageWidth, int imageHeight, int tileX, int tileY) {
+
+	int startX = tileX * hiZTileSize;
+	int startY = tileY * hiZTileSize;
+	int endX = std::min(startX + hiZTileSize, imageWidth);
+	int endY = std::min(startY + hiZTileSize, imageHeight);
+
+	float tileMinDepth = imageDepthData[startX + (startY * imageWidth)];
+	float tileMaxDepth = tileMinDepth;
+	for (int y = startY; y < endY; y++)
+	{
+		const float* depthRow = &imageDepthData[startX + (y * imageWidth)];
+		for (int x = 0; x < endX - startX; x++)
+		{
+			tileMinDepth = std::min(tileMinDepth, depthRow[x]);
+			tileMaxDepth = std::max(tileMaxDepth, depthRow[x]);
+		}
+	}
+
+	int tileIndex = GetHiZTileIndex(tileX, tileY, hiZ.numTiles.x);
+	hiZ.minDepth[tileIndex] = tileMinDepth;
+	hiZ.maxDepth[tileIndex] = tileMaxDepth;
+}
+
+void MarkHiZTileDirty(HiZBuffer& hiZ, int tileX, int tileY) {
+	hiZ.dirty[GetHiZTileIndex(tileX, tileY, hiZ.numTiles.x)] = 1;
+}
+
+// Rebuilds the dirty tiles in the (inclusive) range, tiles nothing has passed the depth test in since their last rebuild are left alone.
+void RefreshDirtyHiZTiles(HiZBuffer& hiZ, const std::vector<float>& imageDepthData, int imageWidth, int imageHeight, const Vector2Int& tileStart, const Vector2Int& tileEnd) {
+
+	for (int y = tileStart.y; y <= tileEnd.y; y++)
+	{
+		for (int x = tileStart.x; x <= tileEnd.x; x++)
+		{
+			unsigned char& tileDirty = hiZ.dirty[GetHiZTileIndex(x, y, hiZ.numTiles.x)];
+			if (tileDirty) {
+				UpdateHiZTile(hiZ, imageDepthData, imageWidth, imageHeight, x, y);
+				tileDirty = 0;
+			}
+		}
+	}
+}
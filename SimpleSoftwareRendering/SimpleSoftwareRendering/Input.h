@@ -44,6 +44,17 @@ enum KeyCode {
 	KEY_P					= 80,
 	KEY_I					= 73,
 	KEY_O					= 79,
+	KEY_K					= 75,
+	KEY_G					= 71,
+	KEY_H					= 72,
+	KEY_F					= 70,
+	KEY_V					= 86,
+	KEY_Z					= 90,
+	KEY_C					= 67,
+	KEY_L					= 76,
+	KEY_J					= 74,
+	KEY_X					= 88,
+	KEY_U					= 85,
 	// Mouse buttons
 	MOUSE_BUTTON_LEFT		= 0,
 	MOUSE_BUTTON_RIGHT		= 1
@@ -93,9 +104,42 @@ int KeyIndex(KeyCode keyCode) {
 	if (keyCode == KEY_O) {
 		return 11;
 	}
+	if (keyCode == KEY_K) {
+		return 12;
+	}
+	if (keyCode == KEY_G) {
+		return 13;
+	}
+	if (keyCode == KEY_H) {
+		return 14;
+	}
+	if (keyCode == KEY_F) {
+		return 15;
+	}
+	if (keyCode == KEY_V) {
+		return 16;
+	}
+	if (keyCode == KEY_Z) {
+		return 17;
+	}
+	if (keyCode == KEY_C) {
+		return 18;
+	}
+	if (keyCode == KEY_L) {
+		return 19;
+	}
+	if (keyCode == KEY_J) {
+		return 20;
+	}
+	if (keyCode == KEY_X) {
+		return 21;
+	}
+	if (keyCode == KEY_U) {
+		return 22;
+	}
 }
 
-constexpr int numKeys = 12;
+constexpr int numKeys = 23;
 
 std::vector<bool> keyPressedInThisFrame(numKeys);
 std::vector<bool> keyHeld(numKeys);
@@ -162,6 +206,17 @@ void ResetKeysReleased() {
 	keyReleasedInThisFrame[KeyIndex(KEY_P)] = false;
 	keyReleasedInThisFrame[KeyIndex(KEY_I)] = false;
 	keyReleasedInThisFrame[KeyIndex(KEY_O)] = false;
+	keyReleasedInThisFrame[KeyIndex(KEY_K)] = false;
+	keyReleasedInThisFrame[KeyIndex(KEY_G)] = false;
+	keyReleasedInThisFrame[KeyIndex(KEY_H)] = false;
+	keyReleasedInThisFrame[KeyIndex(KEY_F)] = false;
+	keyReleasedInThisFrame[KeyIndex(KEY_V)] = false;
+	keyReleasedInThisFrame[KeyIndex(KEY_Z)] = false;
+	keyReleasedInThisFrame[KeyIndex(KEY_C)] = false;
+	keyReleasedInThisFrame[KeyIndex(KEY_L)] = false;
+	keyReleasedInThisFrame[KeyIndex(KEY_J)] = false;
+	keyReleasedInThisFrame[KeyIndex(KEY_X)] = false;
+	keyReleasedInThisFrame[KeyIndex(KEY_U)] = false;
 
 	keyReleasedInThisFrame[KeyIndex(MOUSE_BUTTON_LEFT)] = false;
 	keyReleasedInThisFrame[KeyIndex(MOUSE_BUTTON_RIGHT)] = false;
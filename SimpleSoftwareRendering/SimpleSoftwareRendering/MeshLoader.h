@@ -48,7 +48,9 @@ Mesh ProcessMesh(aiMesh* mesh, const aiScene* scene, std::string& directory)
     Mesh meshToPopulateWithData;
 
     // data to fill
-    std::vector<Point> points;
+    std::vector<Point>& points = meshToPopulateWithData.vertices;
+    points.reserve(mesh->mNumVertices);
+    meshToPopulateWithData.hasVertexColours = mesh->HasVertexColors(0);
 
     // walk through each of the mesh's vertices
     for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -119,11 +121,9 @@ Mesh ProcessMesh(aiMesh* mesh, const aiScene* scene, std::string& directory)
         aiFace face = mesh->mFaces[i];
         // retrieve all indices of the face and store them in the indices vector
         if (face.mNumIndices == 3) {
-            Triangle curTriangle = { points[face.mIndices[0]], points[face.mIndices[1]], points[face.mIndices[2]], colour_white };
-
-            //PrintThisTriangleInfo(curTriangle, i);
-
-            meshToPopulateWithData.triangles.push_back(curTriangle);
+            meshToPopulateWithData.indices.push_back(face.mIndices[0]);
+            meshToPopulateWithData.indices.push_back(face.mIndices[1]);
+            meshToPopulateWithData.indices.push_back(face.mIndices[2]);
         }
         else {
             std::cout << "FACES ARE NOT TRIANGLES!!!!!\n\t-> Number of indicies in face excede 3!!! := " << face.mNumIndices << std::endl;
@@ -144,7 +144,17 @@ Mesh ProcessMesh(aiMesh* mesh, const aiScene* scene, std::string& directory)
     LoadMaterialTextures(Model::textures, material, aiTextureType_DIFFUSE, "texture_diffuse", directory, meshToPopulateWithData);
     //textures.insert(textures.end(), textures.begin(), textures.end());
 
-    //std::cout << "Total number of triangles := " << meshToPopulateWithData.triangles.size() << std::endl;
+    // Materials exported without shading (OBJ's illum 0, glTF's KHR_materials_unlit) keep their colours as they are.
+    int shadingMode = aiShadingMode_Gouraud;
+    if (material->Get(AI_MATKEY_SHADING_MODEL, shadingMode) == AI_SUCCESS) {
+        meshToPopulateWithData.isLit = shadingMode != aiShadingMode_NoShading;
+    }
+
+    //std::cout << "Total number of triangles := " << meshToPopulateWithData.indices.size() / 3 << std::endl;
+
+    BuildMeshlets(meshToPopulateWithData.vertices, meshToPopulateWithData.indices, meshToPopulateWithData.meshlets);
+    BuildVertexStreams(meshToPopulateWithData.vertices, meshToPopulateWithData.vertexStreams);
+    ComputeBounds(meshToPopulateWithData.vertices, meshToPopulateWithData.bounds, meshToPopulateWithData.boundingSphere);
 
     // return a mesh object created from the extracted mesh data
     return meshToPopulateWithData;
@@ -186,6 +196,8 @@ void LoadModel(std::string const& path, Model& modelToLoadInto)
 
     // process ASSIMP's root node recursively
     ProcessNode(scene->mRootNode, scene, modelToLoadInto);
+
+    ComputeModelBounds(modelToLoadInto);
 }
 
 
@@ -212,20 +224,26 @@ void LoadMeshFromOBJFile(Mesh& meshToFill, std::string filePath, std::string fil
             textureCoordinates.push_back(curTextureCoordinate);
         }
         else if (tokens[0] == "f") {
-            Triangle curTriangle;
+            uint32_t indexA = std::stoi(tokens[1]) - 1; 
+            uint32_t indexB = std::stoi(tokens[2]) - 1;
+            uint32_t indexC = std::stoi(tokens[3]) - 1;
 
-            int indexA = std::stoi(tokens[1]) - 1; 
-            int indexB = std::stoi(tokens[2]) - 1;
-            int indexC = std::stoi(tokens[3]) - 1;
-
-            curTriangle.a = Point{ vertices[indexA], textureCoordinates[indexA] };
-            curTriangle.b = Point{ vertices[indexB], textureCoordinates[indexB] };
-            curTriangle.c = Point{ vertices[indexC], textureCoordinates[indexC] };
-
-            meshToFill.triangles.push_back(curTriangle);
+            meshToFill.indices.push_back(indexA);
+            meshToFill.indices.push_back(indexB);
+            meshToFill.indices.push_back(indexC);
         }
 
 		//std::cout << curLineText << std::endl;
 	}
-    //std::cout << meshToFill.triangles.size() << std::endl;
+
+    // Faces index positions and texture coordinates with the same index, so every position becomes one vertex.
+    meshToFill.vertices.reserve(vertices.size());
+    for (int i = 0; i < vertices.size(); i++)
+    {
+        meshToFill.vertices.push_back(Point{ vertices[i], textureCoordinates[i] });
+    }
+    BuildMeshlets(meshToFill.vertices, meshToFill.indices, meshToFill.meshlets);
+    BuildVertexStreams(meshToFill.vertices, meshToFill.vertexStreams);
+    ComputeBounds(meshToFill.vertices, meshToFill.bounds, meshToFill.boundingSphere);
+    //std::cout << meshToFill.indices.size() / 3 << std::endl;
 }
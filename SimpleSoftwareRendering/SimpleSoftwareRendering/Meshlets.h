@@ -0,0 +1,198 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "Instrumentor.h"
+
+#include "Geometry.h"
+#include "Bounds.h"
+#include "WorldConstants.h"
+
+// A run of up to maxMeshletTriangles triangles that sit next to each other on the mesh, culled as a whole before any of its triangles are looked at.
+// OBJECT SPACE!!! Like the mesh bounds.
+struct Meshlet {
+
+	uint32_t firstIndex;		// Into the mesh's indices, the meshlet's triangles are the next numTriangles * 3 of them.
+	uint32_t numTriangles;
+
+	AABB bounds;
+	BoundingSphere boundingSphere;
+
+	// Every face normal is within the cone around coneAxis, coneCutoff is the sine of its half angle.
+	// Cones of 90 degrees or wider can't ever be all back facing, hasNormalCone is false for them.
+	bool hasNormalCone;
+	Vector3 coneAxis;
+	float coneCutoff;
+};
+
+// Face normal the way the rasterizer sees front faces, counter clockwise in object space is front.
+Vector3 ComputeFaceNormal(const Vector3& a, const Vector3& b, const Vector3& c) {
+	return glm::cross(b - a, c - a);
+}
+
+void ComputeMeshletBoundsAndCone(const std::vector<Point>& vertices, const std::vector<uint32_t>& indices, Meshlet& meshlet) {
+
+	uint32_t endIndex = meshlet.firstIndex + (meshlet.numTriangles * 3);
+
+	meshlet.bounds = AABB();
+	for (uint32_t i = meshlet.firstIndex; i < endIndex; i++)
+	{
+		GrowAABB(meshlet.bounds, vertices[indices[i]].position);
+	}
+
+	meshlet.boundingSphere.centre = GetAABBCentre(meshlet.bounds);
+	float furthestDistanceSquared = 0.0f;
+	for (uint32_t i = meshlet.firstIndex; i < endIndex; i++)
+	{
+		Vector3 offset = vertices[indices[i]].position - meshlet.boundingSphere.centre;
+		furthestDistanceSquared = std::max(furthestDistanceSquared, glm::dot(offset, offset));
+	}
+	meshlet.boundingSphere.radius = sqrtf(furthestDistanceSquared);
+
+	// Axis is the average of the unit face normals, the cone then has to open up to the one furthest from it.
+	Vector3 normalSum = Vector3(0.0f);
+	for (uint32_t i = meshlet.firstIndex; i < endIndex; i += 3)
+	{
+		Vector3 faceNormal = ComputeFaceNormal(vertices[indices[i]].position, vertices[indices[i + 1]].position, vertices[indices[i + 2]].position);
+		float faceNormalLength = glm::length(faceNormal);
+		if (faceNormalLength > 0.0f) {
+			normalSum += faceNormal / faceNormalLength;
+		}
+	}
+
+	meshlet.hasNormalCone = false;
+	meshlet.coneAxis = Vector3(0.0f);
+	meshlet.coneCutoff = 1.0f;
+
+	float normalSumLength = glm::length(normalSum);
+	if (normalSumLength == 0.0f) {
+		return;
+	}
+	meshlet.coneAxis = normalSum / normalSumLength;
+
+	float minAxisDot = 1.0f;
+	for (uint32_t i = meshlet.firstIndex; i < endIndex; i += 3)
+	{
+		Vector3 faceNormal = ComputeFaceNormal(vertices[indices[i]].position, vertices[indices[i + 1]].position, vertices[indices[i + 2]].position);
+		float faceNormalLength = glm::length(faceNormal);
+		if (faceNormalLength > 0.0f) {
+			minAxisDot = std::min(minAxisDot, glm::dot(meshlet.coneAxis, faceNormal / faceNormalLength));
+		}
+	}
+
+	if (minAxisDot > 0.0f) {
+		meshlet.hasNormalCone = true;
+		meshlet.coneCutoff = sqrtf(1.0f - (minAxisDot * minAxisDot));
+	}
+}
+
+// Grows each meshlet outwards from a seed triangle through triangles that share a vertex with it, then reorders indices so every meshlet is one contiguous run.
+// Whenever there's nothing connected left to grow through it continues in index order, so meshes that don't share vertices get runs of consecutive triangles.
+void BuildMeshlets(const std::vector<Point>& vertices, std::vector<uint32_t>& indices, std::vector<Meshlet>& meshlets) {
+
+	PROFILE_FUNCTION();
+
+	meshlets.clear();
+
+	uint32_t numTriangles = indices.size() / 3;
+	if (numTriangles == 0) {
+		return;
+	}
+
+	// Triangles using each vertex, packed one vertex after the other.
+	std::vector<uint32_t> vertexTriangleOffsets(vertices.size() + 1, 0);
+	for (uint32_t i = 0; i < numTriangles * 3; i++)
+	{
+		vertexTriangleOffsets[indices[i] + 1]++;
+	}
+	for (int i = 0; i < vertices.size(); i++)
+	{
+		vertexTriangleOffsets[i + 1] += vertexTriangleOffsets[i];
+	}
+	std::vector<uint32_t> vertexTriangles(numTriangles * 3);
+	std::vector<uint32_t> vertexTriangleFill(vertexTriangleOffsets.begin(), vertexTriangleOffsets.end() - 1);
+	for (uint32_t i = 0; i < numTriangles * 3; i++)
+	{
+		vertexTriangles[vertexTriangleFill[indices[i]]++] = i / 3;
+	}
+
+	std::vector<bool> triangleAssigned(numTriangles, false);
+	std::vector<bool> triangleQueued(numTriangles, false);
+	std::vector<uint32_t> frontier;
+	std::vector<uint32_t> reorderedIndices;
+	reorderedIndices.reserve(numTriangles * 3);
+
+	uint32_t nextUnassignedTriangle = 0;
+	while (reorderedIndices.size() < numTriangles * 3)
+	{
+		Meshlet meshlet;
+		meshlet.firstIndex = reorderedIndices.size();
+		meshlet.numTriangles = 0;
+
+		// The next meshlet starts from where the last one stopped growing, so neighbouring meshlets stay neighbours in memory too.
+		uint32_t seed = numTriangles;
+		for (int i = 0; i < frontier.size(); i++)
+		{
+			if (!triangleAssigned[frontier[i]]) {
+				seed = frontier[i];
+				break;
+			}
+		}
+		for (int i = 0; i < frontier.size(); i++)
+		{
+			triangleQueued[frontier[i]] = false;
+		}
+		frontier.clear();
+
+		if (seed != numTriangles) {
+			frontier.push_back(seed);
+			triangleQueued[seed] = true;
+		}
+
+		int f = 0;
+		while (meshlet.numTriangles < maxMeshletTriangles && reorderedIndices.size() < numTriangles * 3)
+		{
+			// Ran out of connected triangles before the meshlet filled up, carry on from the next unassigned one in index order.
+			if (f == frontier.size()) {
+				while (triangleAssigned[nextUnassignedTriangle]) {
+					nextUnassignedTriangle++;
+				}
+				frontier.push_back(nextUnassignedTriangle);
+				triangleQueued[nextUnassignedTriangle] = true;
+			}
+
+			uint32_t triangle = frontier[f++];
+			if (triangleAssigned[triangle]) {
+				continue;
+			}
+
+			triangleAssigned[triangle] = true;
+			meshlet.numTriangles++;
+			for (int corner = 0; corner < 3; corner++)
+			{
+				uint32_t vertex = indices[(triangle * 3) + corner];
+				reorderedIndices.push_back(vertex);
+
+				for (uint32_t t = vertexTriangleOffsets[vertex]; t < vertexTriangleOffsets[vertex + 1]; t++)
+				{
+					uint32_t neighbour = vertexTriangles[t];
+					if (!triangleAssigned[neighbour] && !triangleQueued[neighbour]) {
+						triangleQueued[neighbour] = true;
+						frontier.push_back(neighbour);
+					}
+				}
+			}
+		}
+
+		meshlets.push_back(meshlet);
+	}
+
+	indices.swap(reorderedIndices);
+
+	for (int i = 0; i < meshlets.size(); i++)
+	{
+		ComputeMeshletBoundsAndCone(vertices, indices, meshlets[i]);
+	}
+}
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <cstdint>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -10,13 +11,57 @@
 
 #include "Geometry.h"
 #include "Texture.h"
+#include "VertexStreams.h"
+#include "Bounds.h"
+#include "Meshlets.h"
+
+// Which triangles of a mesh are skipped, by the way they face the camera. Front faces are the ones wound the way the model was authored.
+enum CullMode {
+    CULL_MODE_BACK,
+    CULL_MODE_FRONT,
+    CULL_MODE_NONE
+};
+
+// Determinant of the x, y and w clip space rows of the three vertices. While every w is positive it's w_a * w_b * w_c times the signed screen area,
+// and it keeps giving the side of the triangle the camera is on when some vertices are behind it, so faces can be culled before clipping.
+// Shared by the main draw and the occluder rasterizer, which have to drop exactly the same faces.
+float ClipSpaceWindingDeterminant(const Vector4& a, const Vector4& b, const Vector4& c) {
+    return (a.x * ((b.y * c.w) - (b.w * c.y))) - (a.y * ((b.x * c.w) - (b.w * c.x))) + (a.w * ((b.x * c.y) - (b.y * c.x)));
+}
+
+// Zero is a triangle seen exactly edge on, it can't cover anything whatever the cull mode.
+bool IsTriangleCulled(float windingDeterminant, CullMode cullMode) {
+
+    if (windingDeterminant == 0.0f) {
+        return true;
+    }
+
+    bool frontFacing = windingDeterminant > 0.0f;
+    return (cullMode == CULL_MODE_BACK && !frontFacing) || (cullMode == CULL_MODE_FRONT && frontFacing);
+}
 
 class Mesh {
 
 public:
 
-    std::vector<Triangle> triangles;
-    int textureIndex;
+    // Every vertex is stored once, triangles are three consecutive indices into vertices.
+    std::vector<Point> vertices;
+    std::vector<uint32_t> indices;
+    int textureIndex = -1;		// -1 when the mesh's material has no diffuse texture.
+    bool hasVertexColours = false;	// False when every vertex got the default white, see ProcessMesh.
+    bool isLit = true;				// Unlit meshes are drawn with their unshaded colours, see GetMeshPixelFeatures.
+    CullMode cullMode = CULL_MODE_BACK;
+    bool isOccluder = false;		// Rasterized into the occlusion buffer before anything is drawn, see BuildOcclusionBuffer.
+
+    // SoA copy of vertices built at load time, this is what gets transformed every frame.
+    VertexStreams vertexStreams;
+
+    // Built at load time with the vertex streams, see ComputeBounds.
+    AABB bounds;
+    BoundingSphere boundingSphere;
+
+    // Built at load time, indices are reordered so each meshlet's triangles are consecutive, see BuildMeshlets.
+    std::vector<Meshlet> meshlets;
 };
 
 
@@ -26,12 +71,36 @@ public:
 
     std::vector<Mesh> meshes;
 
+    // Around every mesh, so a model that's entirely off screen is skipped without looking at its meshes.
+    AABB bounds;
+    BoundingSphere boundingSphere;
+
     std::string directory;
     std::vector<std::string> loadedTexturesFilePaths;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
 
     static std::vector<Texture> textures;
 };
 
+// Has to be called again whenever meshes are added to the model.
+void ComputeModelBounds(Model& model) {
+
+    model.bounds = AABB();
+    for (int i = 0; i < model.meshes.size(); i++)
+    {
+        MergeAABB(model.bounds, model.meshes[i].bounds);
+    }
+
+    // Grown to reach around every mesh's sphere, but never looser than the sphere around the merged box.
+    model.boundingSphere.centre = GetAABBCentre(model.bounds);
+    model.boundingSphere.radius = 0.0f;
+    for (int i = 0; i < model.meshes.size(); i++)
+    {
+        const BoundingSphere& meshSphere = model.meshes[i].boundingSphere;
+        model.boundingSphere.radius = std::max(model.boundingSphere.radius, glm::length(meshSphere.centre - model.boundingSphere.centre) + meshSphere.radius);
+    }
+    model.boundingSphere.radius = std::min(model.boundingSphere.radius, glm::length(GetAABBHalfExtents(model.bounds)));
+}
+
 void PrintThisTriangleInfo(const Triangle& curTriangle, int triangleIndex) {
     std::cout << "\tCur triangle := " << triangleIndex;
     std::cout << "\n\t\t Point A Position : " << curTriangle.a.position.x << ", " << curTriangle.a.position.y << ", " << curTriangle.a.position.z;
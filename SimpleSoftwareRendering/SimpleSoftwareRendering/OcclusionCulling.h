@@ -0,0 +1,369 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <immintrin.h>
+
+#include "Instrumentor.h"
+
+#include "Geometry.h"
+#include "Model.h"
+#include "Bounds.h"
+#include "WorldConstants.h"
+#include "PixelKernelsSIMD.h"
+
+// Small depth only copy of the screen that occluder meshes are rasterized into each frame, before anything else is drawn.
+// Holds 1 / view depth, which is linear across a triangle in screen space. Larger is nearer, 0 is nothing drawn.
+struct OcclusionBuffer {
+
+	std::vector<float> invDepth;
+	std::vector<float> scratch;
+
+	// Of the current frame, reset by ClearOcclusionBuffer.
+	int numBoundsTested;
+	int numBoundsOccluded;
+};
+
+// When false nothing is rasterized into the buffer and no bounds are ever reported as occluded.
+bool useOcclusionCulling = true;
+
+// Bounds only count as hidden when every occluder pixel under them is at least this much nearer.
+const float occlusionRejectMargin = 1.0f + 1e-4f;
+
+void InitOcclusionBuffer(OcclusionBuffer& occlusionBuffer) {
+
+	occlusionBuffer.invDepth.resize(occlusionBufferWidth * occlusionBufferHeight);
+	occlusionBuffer.scratch.resize(occlusionBufferWidth * occlusionBufferHeight);
+}
+
+void ClearOcclusionBuffer(OcclusionBuffer& occlusionBuffer) {
+
+	std::fill(occlusionBuffer.invDepth.begin(), occlusionBuffer.invDepth.end(), 0.0f);
+	occlusionBuffer.numBoundsTested = 0;
+	occlusionBuffer.numBoundsOccluded = 0;
+}
+
+// Screen space triangle in occlusion buffer pixels, set up as three edge functions and a 1 / depth plane, all of the form a * x + b * y + c.
+// Edge functions are positive inside whichever way the triangle was wound, faces the mesh's cull mode drops are left out before this is set up.
+struct OccluderTriangle {
+
+	float edgeA[3], edgeB[3], edgeC[3];
+	float invDepthA, invDepthB, invDepthC;
+	int startX, startY, endX, endY;
+};
+
+// False when the triangle has no area or misses every pixel centre of the buffer.
+bool SetupOccluderTriangle(const Vector3& a, const Vector3& b, const Vector3& c, OccluderTriangle& triangle) {
+
+	float area = ((b.x - a.x) * (c.y - a.y)) - ((b.y - a.y) * (c.x - a.x));
+	if (area == 0.0f) {
+		return false;
+	}
+
+	// Pixel centres are at + 0.5.
+	triangle.startX = std::max((int)ceilf(std::min(a.x, std::min(b.x, c.x)) - 0.5f), 0);
+	triangle.startY = std::max((int)ceilf(std::min(a.y, std::min(b.y, c.y)) - 0.5f), 0);
+	triangle.endX = std::min((int)floorf(std::max(a.x, std::max(b.x, c.x)) - 0.5f), occlusionBufferWidth - 1);
+	triangle.endY = std::min((int)floorf(std::max(a.y, std::max(b.y, c.y)) - 0.5f), occlusionBufferHeight - 1);
+	if (triangle.startX > triangle.endX || triangle.startY > triangle.endY) {
+		return false;
+	}
+
+	// Edge i is opposite vertex i, so edge i / area is that vertex's barycentric weight.
+	const Vector3* vertices[3] = { &a, &b, &c };
+	float invArea = 1.0f / area;
+	for (int i = 0; i < 3; i++)
+	{
+		const Vector3& start = *vertices[(i + 1) % 3];
+		const Vector3& end = *vertices[(i + 2) % 3];
+		triangle.edgeA[i] = -(end.y - start.y) * invArea;
+		triangle.edgeB[i] = (end.x - start.x) * invArea;
+		triangle.edgeC[i] = (((end.y - start.y) * start.x) - ((end.x - start.x) * start.y)) * invArea;
+	}
+
+	triangle.invDepthA = (triangle.edgeA[0] * a.z) + (triangle.edgeA[1] * b.z) + (triangle.edgeA[2] * c.z);
+	triangle.invDepthB = (triangle.edgeB[0] * a.z) + (triangle.edgeB[1] * b.z) + (triangle.edgeB[2] * c.z);
+	triangle.invDepthC = (triangle.edgeC[0] * a.z) + (triangle.edgeC[1] * b.z) + (triangle.edgeC[2] * c.z);
+
+	return true;
+}
+
+void RasterizeOccluderTriangleScalar(const OccluderTriangle& triangle, float* invDepth) {
+
+	for (int y = triangle.startY; y <= triangle.endY; y++)
+	{
+		float pixelCentreY = y + 0.5f;
+		for (int x = triangle.startX; x <= triangle.endX; x++)
+		{
+			float pixelCentreX = x + 0.5f;
+
+			bool inside = true;
+			for (int i = 0; i < 3; i++)
+			{
+				inside &= (triangle.edgeA[i] * pixelCentreX) + (triangle.edgeB[i] * pixelCentreY) + triangle.edgeC[i] >= 0.0f;
+			}
+
+			float pixelInvDepth = (triangle.invDepthA * pixelCentreX) + (triangle.invDepthB * pixelCentreY) + triangle.invDepthC;
+			float& existing = invDepth[x + (y * occlusionBufferWidth)];
+			if (inside && pixelInvDepth > existing) {
+				existing = pixelInvDepth;
+			}
+		}
+	}
+}
+
+// Rows are walked 4 pixels at a time from the block holding startX. Buffer rows are a whole number of blocks,
+// so blocks never reach past a row, and lanes outside the bounding box are outside the triangle too.
+void RasterizeOccluderTriangleSSE(const OccluderTriangle& triangle, float* invDepth) {
+
+	const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	int blockStartX = triangle.startX & ~3;
+	for (int y = triangle.startY; y <= triangle.endY; y++)
+	{
+		__m128 pixelCentreY = _mm_set1_ps(y + 0.5f);
+		float* row = &invDepth[y * occlusionBufferWidth];
+		for (int x = blockStartX; x <= triangle.endX; x += 4)
+		{
+			__m128 pixelCentreX = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int i = 0; i < 3; i++)
+			{
+				__m128 edge = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA[i]), pixelCentreX), _mm_mul_ps(_mm_set1_ps(triangle.edgeB[i]), pixelCentreY)), _mm_set1_ps(triangle.edgeC[i]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, zero));
+			}
+
+			__m128 pixelInvDepth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.invDepthA), pixelCentreX), _mm_mul_ps(_mm_set1_ps(triangle.invDepthB), pixelCentreY)), _mm_set1_ps(triangle.invDepthC));
+			__m128 existing = _mm_loadu_ps(&row[x]);
+			__m128 nearer = _mm_max_ps(existing, pixelInvDepth);
+			_mm_storeu_ps(&row[x], _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, existing)));
+		}
+	}
+}
+
+// Same as the SSE one 8 pixels at a time.
+TARGET_AVX2 void RasterizeOccluderTriangleAVX2(const OccluderTriangle& triangle, float* invDepth) {
+
+	const __m256 laneOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+	const __m256 zero = _mm256_setzero_ps();
+
+	__m256 edgeA[3], edgeB[3], edgeC[3];
+	for (int i = 0; i < 3; i++)
+	{
+		edgeA[i] = _mm256_set1_ps(triangle.edgeA[i]);
+		edgeB[i] = _mm256_set1_ps(triangle.edgeB[i]);
+		edgeC[i] = _mm256_set1_ps(triangle.edgeC[i]);
+	}
+	__m256 invDepthA = _mm256_set1_ps(triangle.invDepthA);
+	__m256 invDepthB = _mm256_set1_ps(triangle.invDepthB);
+	__m256 invDepthC = _mm256_set1_ps(triangle.invDepthC);
+
+	int blockStartX = triangle.startX & ~7;
+	for (int y = triangle.startY; y <= triangle.endY; y++)
+	{
+		__m256 pixelCentreY = _mm256_set1_ps(y + 0.5f);
+		float* row = &invDepth[y * occlusionBufferWidth];
+		for (int x = blockStartX; x <= triangle.endX; x += 8)
+		{
+			__m256 pixelCentreX = _mm256_add_ps(_mm256_set1_ps((float)x), laneOffsets);
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int i = 0; i < 3; i++)
+			{
+				__m256 edge = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edgeA[i], pixelCentreX), _mm256_mul_ps(edgeB[i], pixelCentreY)), edgeC[i]);
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(edge, zero, _CMP_GE_OQ));
+			}
+
+			__m256 pixelInvDepth = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(invDepthA, pixelCentreX), _mm256_mul_ps(invDepthB, pixelCentreY)), invDepthC);
+			__m256 existing = _mm256_loadu_ps(&row[x]);
+			_mm256_storeu_ps(&row[x], _mm256_blendv_ps(existing, _mm256_max_ps(existing, pixelInvDepth), inside));
+		}
+	}
+}
+
+// Occluder vertices only need their position, in buffer pixels with 1 / view depth as z. w is 0 for vertices too close to project.
+// The clip space positions are kept too, for the same face culling the main draw does.
+void TransformOccluderVertices(const Mesh& mesh, const Mat4x4& modelViewProjectionMatrix, std::vector<Vector4>& clipPositions, std::vector<Vector4>& occluderVertices) {
+
+	clipPositions.resize(mesh.vertices.size());
+	occluderVertices.resize(mesh.vertices.size());
+	for (int i = 0; i < mesh.vertices.size(); i++)
+	{
+		Vector4& clipPosition = clipPositions[i];
+		clipPosition = modelViewProjectionMatrix * Vector4(mesh.vertices[i].position, 1.0f);
+		if (clipPosition.w < nearPlaneDistance) {
+			occluderVertices[i] = Vector4(0.0f);
+			continue;
+		}
+
+		float invW = 1.0f / clipPosition.w;
+		occluderVertices[i] = Vector4((clipPosition.x * invW + 1.0f) * (0.5f * occlusionBufferWidth), (clipPosition.y * invW + 1.0f) * (0.5f * occlusionBufferHeight), invW, 1.0f);
+	}
+}
+
+// Triangles reaching in front of the near plane are left out instead of clipped, an occluder with holes only culls less.
+// Faces are culled like the main draw culls them, a single sided occluder seen from behind draws nothing and mustn't hide what's past it.
+void RasterizeOccluderMesh(OcclusionBuffer& occlusionBuffer, const Mesh& mesh, const Mat4x4& modelViewProjectionMatrix) {
+
+	PROFILE_FUNCTION();
+
+	static std::vector<Vector4> clipPositions;
+	static std::vector<Vector4> occluderVertices;
+	TransformOccluderVertices(mesh, modelViewProjectionMatrix, clipPositions, occluderVertices);
+
+	PixelKernel pixelKernel = activePixelKernel;
+	for (int i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		uint32_t indexA = mesh.indices[i + 0];
+		uint32_t indexB = mesh.indices[i + 1];
+		uint32_t indexC = mesh.indices[i + 2];
+		const Vector4& a = occluderVertices[indexA];
+		const Vector4& b = occluderVertices[indexB];
+		const Vector4& c = occluderVertices[indexC];
+		if (a.w == 0.0f || b.w == 0.0f || c.w == 0.0f) {
+			continue;
+		}
+
+		if (IsTriangleCulled(ClipSpaceWindingDeterminant(clipPositions[indexA], clipPositions[indexB], clipPositions[indexC]), mesh.cullMode)) {
+			continue;
+		}
+
+		OccluderTriangle triangle;
+		if (!SetupOccluderTriangle(Vector3(a), Vector3(b), Vector3(c), triangle)) {
+			continue;
+		}
+
+		if (pixelKernel == PIXEL_KERNEL_AVX2) {
+			RasterizeOccluderTriangleAVX2(triangle, occlusionBuffer.invDepth.data());
+		}
+		else if (pixelKernel == PIXEL_KERNEL_SSE) {
+			RasterizeOccluderTriangleSSE(triangle, occlusionBuffer.invDepth.data());
+		}
+		else {
+			RasterizeOccluderTriangleScalar(triangle, occlusionBuffer.invDepth.data());
+		}
+	}
+}
+
+// Each pixel becomes the furthest of itself and its 8 neighbours. Occluders are sampled at pixel centres, and a pixel half covered by one
+// would otherwise hide things seen past its edge. A plane's furthest point over a pixel is at one of its corners, and those lie between
+// the 9 centres, so after this every pixel is never nearer than the occluders anywhere inside it.
+void ErodeOcclusionBuffer(OcclusionBuffer& occlusionBuffer) {
+
+	PROFILE_FUNCTION();
+
+	const std::vector<float>& source = occlusionBuffer.invDepth;
+	std::vector<float>& horizontal = occlusionBuffer.scratch;
+
+	for (int y = 0; y < occlusionBufferHeight; y++)
+	{
+		const float* row = &source[y * occlusionBufferWidth];
+		float* outRow = &horizontal[y * occlusionBufferWidth];
+		for (int x = 0; x < occlusionBufferWidth; x++)
+		{
+			outRow[x] = std::min(row[x], std::min(row[std::max(x - 1, 0)], row[std::min(x + 1, occlusionBufferWidth - 1)]));
+		}
+	}
+
+	for (int y = 0; y < occlusionBufferHeight; y++)
+	{
+		const float* rowAbove = &horizontal[std::max(y - 1, 0) * occlusionBufferWidth];
+		const float* row = &horizontal[y * occlusionBufferWidth];
+		const float* rowBelow = &horizontal[std::min(y + 1, occlusionBufferHeight - 1) * occlusionBufferWidth];
+		float* outRow = &occlusionBuffer.invDepth[y * occlusionBufferWidth];
+		for (int x = 0; x < occlusionBufferWidth; x++)
+		{
+			outRow[x] = std::min(row[x], std::min(rowAbove[x], rowBelow[x]));
+		}
+	}
+}
+
+// Fills the buffer for this frame from the model's occluder meshes, nearest first like the main draw.
+void BuildOcclusionBuffer(OcclusionBuffer& occlusionBuffer, const Model& model, const std::vector<unsigned int>& meshDrawOrder, const Mat4x4& modelViewProjectionMatrix) {
+
+	PROFILE_FUNCTION();
+
+	ClearOcclusionBuffer(occlusionBuffer);
+	if (!useOcclusionCulling) {
+		return;
+	}
+
+	for (int i = 0; i < meshDrawOrder.size(); i++)
+	{
+		const Mesh& mesh = model.meshes[meshDrawOrder[i]];
+		if (mesh.isOccluder) {
+			RasterizeOccluderMesh(occlusionBuffer, mesh, modelViewProjectionMatrix);
+		}
+	}
+
+	ErodeOcclusionBuffer(occlusionBuffer);
+}
+
+// True when the box is entirely behind occluders. Its 8 corners give a screen rectangle and its nearest 1 / depth,
+// every buffer pixel the rectangle touches has to hold something nearer than that.
+bool IsAABBOccluded(OcclusionBuffer& occlusionBuffer, const AABB& aabb, const Mat4x4& modelViewProjectionMatrix) {
+
+	if (!useOcclusionCulling) {
+		return false;
+	}
+
+	occlusionBuffer.numBoundsTested++;
+
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	float nearestInvDepth = 0.0f;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		Vector3 cornerPosition = { (corner & 1) ? aabb.max.x : aabb.min.x, (corner & 2) ? aabb.max.y : aabb.min.y, (corner & 4) ? aabb.max.z : aabb.min.z };
+		Vector4 clipPosition = modelViewProjectionMatrix * Vector4(cornerPosition, 1.0f);
+
+		// Reaches up to the camera, can't be behind anything.
+		if (clipPosition.w < nearPlaneDistance) {
+			return false;
+		}
+
+		float invW = 1.0f / clipPosition.w;
+		float bufferX = (clipPosition.x * invW + 1.0f) * (0.5f * occlusionBufferWidth);
+		float bufferY = (clipPosition.y * invW + 1.0f) * (0.5f * occlusionBufferHeight);
+		minX = std::min(minX, bufferX);
+		minY = std::min(minY, bufferY);
+		maxX = std::max(maxX, bufferX);
+		maxY = std::max(maxY, bufferY);
+		nearestInvDepth = std::max(nearestInvDepth, invW);
+	}
+
+	int startX = std::max((int)floorf(minX), 0);
+	int startY = std::max((int)floorf(minY), 0);
+	int endX = std::min((int)floorf(maxX), occlusionBufferWidth - 1);
+	int endY = std::min((int)floorf(maxY), occlusionBufferHeight - 1);
+	if (startX > endX || startY > endY) {
+		return false;
+	}
+
+	float occludedIfNearerThan = nearestInvDepth * occlusionRejectMargin;
+	for (int y = startY; y <= endY; y++)
+	{
+		const float* row = &occlusionBuffer.invDepth[y * occlusionBufferWidth];
+		for (int x = startX; x <= endX; x++)
+		{
+			if (row[x] <= occludedIfNearerThan) {
+				return false;
+			}
+		}
+	}
+
+	occlusionBuffer.numBoundsOccluded++;
+	return true;
+}
+
+// Meshes that are big next to the whole model (terrain, buildings) are the ones likely to hide the rest, only they get rasterized into the buffer.
+void MarkLargeMeshesAsOccluders(Model& model) {
+
+	for (int i = 0; i < model.meshes.size(); i++)
+	{
+		model.meshes[i].isOccluder = model.meshes[i].boundingSphere.radius >= model.boundingSphere.radius * occluderMinRadiusFraction;
+	}
+}
\ No newline at end of file
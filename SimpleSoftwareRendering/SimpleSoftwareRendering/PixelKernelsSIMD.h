@@ -0,0 +1,503 @@
+#pragma once
+
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC lets any function use AVX2 intrinsics, it's up to us to only call them when the CPU has it.
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include "Geometry.h"
+#include "Texture.h"
+#include "WorldConstants.h"
+
+// Which code path shades the pixels inside a triangle, switchable at runtime to compare them on the same frame.
+enum PixelKernel {
+	PIXEL_KERNEL_SCALAR,
+	PIXEL_KERNEL_SSE,		// 4x1 pixel blocks.
+	PIXEL_KERNEL_AVX2,		// 8x1 pixel blocks.
+	NUM_PIXEL_KERNELS
+};
+
+const char* pixelKernelNames[NUM_PIXEL_KERNELS] = { "Scalar", "SSE (4 wide)", "AVX2 (8 wide)" };
+
+bool CPUSupportsAVX2() {
+
+#if defined(_MSC_VER)
+	int cpuInfo[4];
+	__cpuid(cpuInfo, 1);
+
+	bool osSavesYMMRegisters = (cpuInfo[2] & (1 << 27)) && (cpuInfo[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+	if (!osSavesYMMRegisters) {
+		return false;
+	}
+
+	__cpuidex(cpuInfo, 7, 0);
+	return (cpuInfo[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// SSE2 is always there on x64, so only AVX2 needs checking.
+PixelKernel GetBestSupportedPixelKernel() {
+	return CPUSupportsAVX2() ? PIXEL_KERNEL_AVX2 : PIXEL_KERNEL_SSE;
+}
+
+PixelKernel GetNextSupportedPixelKernel(PixelKernel currentKernel) {
+
+	PixelKernel nextKernel = (PixelKernel)((currentKernel + 1) % NUM_PIXEL_KERNELS);
+	if (nextKernel == PIXEL_KERNEL_AVX2 && !CPUSupportsAVX2()) {
+		nextKernel = PIXEL_KERNEL_SCALAR;
+	}
+	return nextKernel;
+}
+
+PixelKernel activePixelKernel = GetBestSupportedPixelKernel();
+
+// What the pixels of a draw need, the pixel functions are instantiated per combination so unused features cost nothing per pixel.
+// Picked once per mesh by GetMeshPixelFeatures, see GetPixelPipeline for the combinations that have an instantiation.
+enum PixelFeature {
+	PIXEL_FEATURE_TEXTURED = 1 << 0,
+	PIXEL_FEATURE_VERTEX_COLOUR = 1 << 1,	// Mixed with the texel by colourTextureMixFactor when textured.
+	PIXEL_FEATURE_LIT = 1 << 2,
+	PIXEL_FEATURE_FIXED_COLOUR = 1 << 3,	// The triangle's flat colour, for meshes with neither a texture nor vertex colours.
+	PIXEL_FEATURE_DEPTH_ONLY = 1 << 4		// Coverage and depth test only, nothing is interpolated or written but depth.
+};
+
+// Per triangle values the block kernels need, stored as plain floats so each one can be broadcast straight into a register.
+// Index 0, 1, 2 are the values at vertex a, b, c, the same order as the barycentric weights alpha, beta, gamma.
+struct PixelBlockRenderingData {
+
+	// Edge functions are 28.4 fixed point products, exact integers, so coverage is decided without any rounding.
+	int edgeStepX[3];
+	int edgeInsideThreshold[3];		// -1 for top-left edges so a pixel centre exactly on them counts as inside, 0 otherwise.
+	float invAreaOfTriangle;
+
+	float invDepth[3];
+	float texW[3];
+	float texU[3];
+	float texV[3];
+	float lightDotTriangleNormals[3];
+	Vector4 colour[3];
+
+	const Texture* curTex;		// nullptr for untextured triangles.
+	Colour fixedColour;
+};
+
+// What happened to the fragments of a frame, kept per render tile so no two threads ever count into the same one.
+struct FragmentCounters {
+
+	long long fragmentsShaded = 0;
+	long long fragmentsKilledByDepth = 0;	// Covered, but failed the depth test before anything but depth was interpolated.
+	long long hiZTilesRejected = 0;
+	long long shadowRaysTraced = 0;
+	long long shadowRaysReused = 0;		// Pixels that took their 2x2 quad's shadow ray because the tile ran out of budget.
+
+	FragmentCounters& operator+=(const FragmentCounters& other) {
+		fragmentsShaded += other.fragmentsShaded;
+		fragmentsKilledByDepth += other.fragmentsKilledByDepth;
+		hiZTilesRejected += other.hiZTilesRejected;
+		shadowRaysTraced += other.shadowRaysTraced;
+		shadowRaysReused += other.shadowRaysReused;
+		return *this;
+	}
+};
+
+// Lane masks are at most 8 bits, no need for the popcnt instruction.
+int CountSetBits(unsigned int bits) {
+
+	int count = 0;
+	for (; bits != 0; bits &= bits - 1)
+	{
+		count++;
+	}
+	return count;
+}
+
+// Colour as the 32 bit RGBA value it is stored as in imageData and texture data.
+int PackColour(const Colour& colour) {
+	return (int)((unsigned int)colour.r | ((unsigned int)colour.g << 8) | ((unsigned int)colour.b << 16) | ((unsigned int)colour.a << 24));
+}
+
+//--------------------------------------------------------SSE (4 wide)--------------------------------------------------------
+
+__m128i EdgeInsideMaskSSE(const __m128i& edge, int insideThreshold) {
+	return _mm_cmpgt_epi32(edge, _mm_set1_epi32(insideThreshold));
+}
+
+__m128 InterpolateSSE(const __m128& alpha, const __m128& beta, const __m128& gamma, const float values[3]) {
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(values[0])), _mm_mul_ps(beta, _mm_set1_ps(values[1]))), _mm_mul_ps(gamma, _mm_set1_ps(values[2])));
+}
+
+// Turns the lit r, g, b floats of 4 pixels into 4 packed RGBA pixels with alpha 255.
+__m128i PackLitColoursSSE(__m128 r, __m128 g, __m128 b) {
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 maxChannel = _mm_set1_ps(255.0f);
+
+	__m128i ri = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(r, zero), maxChannel));
+	__m128i gi = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(g, zero), maxChannel));
+	__m128i bi = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(b, zero), maxChannel));
+
+	return _mm_or_si128(_mm_or_si128(ri, _mm_slli_epi32(gi, 8)), _mm_or_si128(_mm_slli_epi32(bi, 16), _mm_set1_epi32((int)0xFF000000)));
+}
+
+// Edge functions of the 4 pixels starting at edgeAtFirstPixel, their barycentric weights, and which of them are inside the triangle.
+__m128 BlockCoverageSSE(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, __m128& alpha, __m128& beta, __m128& gamma) {
+
+	// No 32 bit multiply before SSE4.1, the lane offsets are cheap enough to build from scalars.
+	__m128i edgeA = _mm_setr_epi32(edgeAtFirstPixel.x, edgeAtFirstPixel.x + pbd.edgeStepX[0], edgeAtFirstPixel.x + 2 * pbd.edgeStepX[0], edgeAtFirstPixel.x + 3 * pbd.edgeStepX[0]);
+	__m128i edgeB = _mm_setr_epi32(edgeAtFirstPixel.y, edgeAtFirstPixel.y + pbd.edgeStepX[1], edgeAtFirstPixel.y + 2 * pbd.edgeStepX[1], edgeAtFirstPixel.y + 3 * pbd.edgeStepX[1]);
+	__m128i edgeC = _mm_setr_epi32(edgeAtFirstPixel.z, edgeAtFirstPixel.z + pbd.edgeStepX[2], edgeAtFirstPixel.z + 2 * pbd.edgeStepX[2], edgeAtFirstPixel.z + 3 * pbd.edgeStepX[2]);
+
+	__m128 invArea = _mm_set1_ps(pbd.invAreaOfTriangle);
+	alpha = _mm_mul_ps(_mm_cvtepi32_ps(edgeA), invArea);
+	beta = _mm_mul_ps(_mm_cvtepi32_ps(edgeB), invArea);
+	gamma = _mm_mul_ps(_mm_cvtepi32_ps(edgeC), invArea);
+
+	return _mm_castsi128_ps(_mm_and_si128(_mm_and_si128(EdgeInsideMaskSSE(edgeA, pbd.edgeInsideThreshold[0]), EdgeInsideMaskSSE(edgeB, pbd.edgeInsideThreshold[1])), EdgeInsideMaskSSE(edgeC, pbd.edgeInsideThreshold[2])));
+}
+
+// Depth tests the covered lanes and writes the new depth of the ones that pass, returns those lanes.
+__m128 BlockDepthTestSSE(const PixelBlockRenderingData& pbd, const __m128& covered, const __m128& alpha, const __m128& beta, const __m128& gamma, float* depthOut, FragmentCounters& fragmentCounters) {
+
+	__m128 depth = _mm_div_ps(_mm_set1_ps(1.0f), InterpolateSSE(alpha, beta, gamma, pbd.invDepth));
+	__m128 existingDepth = _mm_loadu_ps(depthOut);
+
+	__m128 passed = _mm_and_ps(covered, _mm_cmplt_ps(existingDepth, depth));
+	int numPassed = CountSetBits(_mm_movemask_ps(passed));
+	fragmentCounters.fragmentsKilledByDepth += CountSetBits(_mm_movemask_ps(covered)) - numPassed;
+
+	if (numPassed != 0) {
+		// Lanes outside the mask write back what was already there, the whole block lies inside this thread's tile so that's safe.
+		_mm_storeu_ps(depthOut, _mm_or_ps(_mm_and_ps(passed, depth), _mm_andnot_ps(passed, existingDepth)));
+	}
+	return passed;
+}
+
+// Interpolates what pixelFeatures asks for (never depth) for the lanes in passed, looks up their texels and writes their colours.
+template<unsigned int pixelFeatures>
+void ShadePixelBlockSSE(const PixelBlockRenderingData& pbd, const __m128& alpha, const __m128& beta, const __m128& gamma, const __m128& passed, unsigned char* colourOut) {
+
+	const bool textured = (pixelFeatures & PIXEL_FEATURE_TEXTURED) != 0;
+	const bool vertexColour = (pixelFeatures & PIXEL_FEATURE_VERTEX_COLOUR) != 0;
+	const bool lit = (pixelFeatures & PIXEL_FEATURE_LIT) != 0;
+	const bool fixedColour = (pixelFeatures & PIXEL_FEATURE_FIXED_COLOUR) != 0;
+
+	__m128i result;
+	if (fixedColour && !lit) {
+		result = _mm_set1_epi32(PackColour(pbd.fixedColour) | (int)0xFF000000);
+	}
+	else {
+		// Everything left is perspective correct, so texW is needed whatever the features are.
+		__m128 texW = _mm_div_ps(_mm_set1_ps(1.0f), InterpolateSSE(alpha, beta, gamma, pbd.texW));
+
+		__m128 r, g, b;
+		__m128i texelColours;
+		if (fixedColour) {
+			r = _mm_set1_ps(pbd.fixedColour.r);
+			g = _mm_set1_ps(pbd.fixedColour.g);
+			b = _mm_set1_ps(pbd.fixedColour.b);
+		}
+		else if (textured) {
+			__m128 u = _mm_mul_ps(InterpolateSSE(alpha, beta, gamma, pbd.texU), texW);
+			__m128 v = _mm_mul_ps(InterpolateSSE(alpha, beta, gamma, pbd.texV), texW);
+
+			// No gather before AVX2, so texels are fetched one lane at a time.
+			alignas(16) float laneU[4];
+			alignas(16) float laneV[4];
+			alignas(16) int texels[4];
+			_mm_store_ps(laneU, u);
+			_mm_store_ps(laneV, v);
+			for (int i = 0; i < 4; i++)
+			{
+				texels[i] = PackColour(GetColourFromTexCoord(*pbd.curTex, Vector2{ laneU[i], laneV[i] }));
+			}
+			texelColours = _mm_load_si128((const __m128i*)texels);
+
+			const __m128i channelMask = _mm_set1_epi32(0xFF);
+			r = _mm_cvtepi32_ps(_mm_and_si128(texelColours, channelMask));
+			g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texelColours, 8), channelMask));
+			b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texelColours, 16), channelMask));
+		}
+
+		if (vertexColour) {
+			float colourR[3] = { pbd.colour[0].x, pbd.colour[1].x, pbd.colour[2].x };
+			float colourG[3] = { pbd.colour[0].y, pbd.colour[1].y, pbd.colour[2].y };
+			float colourB[3] = { pbd.colour[0].z, pbd.colour[1].z, pbd.colour[2].z };
+			__m128 vertexR = _mm_mul_ps(InterpolateSSE(alpha, beta, gamma, colourR), texW);
+			__m128 vertexG = _mm_mul_ps(InterpolateSSE(alpha, beta, gamma, colourG), texW);
+			__m128 vertexB = _mm_mul_ps(InterpolateSSE(alpha, beta, gamma, colourB), texW);
+
+			if (textured) {
+				__m128 mix = _mm_set1_ps(colourTextureMixFactor);
+				__m128 oneMinusMix = _mm_set1_ps(1.0f - colourTextureMixFactor);
+				r = _mm_add_ps(_mm_mul_ps(oneMinusMix, r), _mm_mul_ps(mix, vertexR));
+				g = _mm_add_ps(_mm_mul_ps(oneMinusMix, g), _mm_mul_ps(mix, vertexG));
+				b = _mm_add_ps(_mm_mul_ps(oneMinusMix, b), _mm_mul_ps(mix, vertexB));
+			}
+			else {
+				r = vertexR;
+				g = vertexG;
+				b = vertexB;
+			}
+		}
+
+		if (lit) {
+			__m128 lightDotTriangleNormal = _mm_mul_ps(InterpolateSSE(alpha, beta, gamma, pbd.lightDotTriangleNormals), texW);
+			result = PackLitColoursSSE(_mm_mul_ps(r, lightDotTriangleNormal), _mm_mul_ps(g, lightDotTriangleNormal), _mm_mul_ps(b, lightDotTriangleNormal));
+		}
+		else if (textured && !vertexColour) {
+			// Unlit texels go out as they are, only alpha is forced to 255 like every other path does.
+			result = _mm_or_si128(texelColours, _mm_set1_epi32((int)0xFF000000));
+		}
+		else {
+			result = PackLitColoursSSE(r, g, b);
+		}
+	}
+
+	__m128i passedMask = _mm_castps_si128(passed);
+	__m128i existingColours = _mm_loadu_si128((const __m128i*)colourOut);
+	_mm_storeu_si128((__m128i*)colourOut, _mm_or_si128(_mm_and_si128(passedMask, result), _mm_andnot_si128(passedMask, existingColours)));
+}
+
+// Shades the 4 pixels starting at colourOut/depthOut, edgeAtFirstPixel being the three edge functions at the first pixel's centre.
+// Pixels that are outside the triangle or fail the depth test keep their old colour and depth.
+// Only depth is interpolated until the depth test has passed, blocks where every covered pixel fails it stop there.
+// With PIXEL_FEATURE_DEPTH_ONLY (shadow maps) nothing but depth is ever written and colourOut isn't touched.
+// Returns whether any pixel passed the depth test, so the caller knows when the Hi-Z tile under the block has gone stale.
+template<unsigned int pixelFeatures>
+bool DrawPixelBlockSSE(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, unsigned char* colourOut, float* depthOut, FragmentCounters& fragmentCounters) {
+
+	__m128 alpha, beta, gamma;
+	__m128 covered = BlockCoverageSSE(pbd, edgeAtFirstPixel, alpha, beta, gamma);
+	if (_mm_movemask_ps(covered) == 0) {
+		return false;
+	}
+
+	__m128 passed = BlockDepthTestSSE(pbd, covered, alpha, beta, gamma, depthOut, fragmentCounters);
+	int numPassed = CountSetBits(_mm_movemask_ps(passed));
+	if (numPassed == 0 || (pixelFeatures & PIXEL_FEATURE_DEPTH_ONLY)) {
+		return numPassed != 0;
+	}
+	fragmentCounters.fragmentsShaded += numPassed;
+
+	ShadePixelBlockSSE<pixelFeatures>(pbd, alpha, beta, gamma, passed, colourOut);
+	return true;
+}
+
+// Visibility buffer raster pass, the same coverage and depth test as DrawPixelBlockSSE but the pixels that pass only get visibilityID.
+bool DrawVisibilityBlockSSE(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, unsigned int visibilityID, unsigned int* visibilityOut, float* depthOut, FragmentCounters& fragmentCounters) {
+
+	__m128 alpha, beta, gamma;
+	__m128 covered = BlockCoverageSSE(pbd, edgeAtFirstPixel, alpha, beta, gamma);
+	if (_mm_movemask_ps(covered) == 0) {
+		return false;
+	}
+
+	__m128i passedMask = _mm_castps_si128(BlockDepthTestSSE(pbd, covered, alpha, beta, gamma, depthOut, fragmentCounters));
+	__m128i existingIDs = _mm_loadu_si128((const __m128i*)visibilityOut);
+	_mm_storeu_si128((__m128i*)visibilityOut, _mm_or_si128(_mm_and_si128(passedMask, _mm_set1_epi32((int)visibilityID)), _mm_andnot_si128(passedMask, existingIDs)));
+	return _mm_movemask_ps(_mm_castsi128_ps(passedMask)) != 0;
+}
+
+// Visibility buffer shading pass, shades the lanes of the block whose laneMask entry is set, no coverage or depth test.
+template<unsigned int pixelFeatures>
+void ShadePixelBlockWithMaskSSE(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, const int laneMask[4], unsigned char* colourOut) {
+
+	__m128 alpha, beta, gamma;
+	BlockCoverageSSE(pbd, edgeAtFirstPixel, alpha, beta, gamma);
+	ShadePixelBlockSSE<pixelFeatures>(pbd, alpha, beta, gamma, _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)laneMask)), colourOut);
+}
+
+//--------------------------------------------------------AVX2 (8 wide)--------------------------------------------------------
+
+TARGET_AVX2 __m256i EdgeInsideMaskAVX2(const __m256i& edge, int insideThreshold) {
+	return _mm256_cmpgt_epi32(edge, _mm256_set1_epi32(insideThreshold));
+}
+
+TARGET_AVX2 __m256 InterpolateAVX2(const __m256& alpha, const __m256& beta, const __m256& gamma, const float values[3]) {
+	return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(alpha, _mm256_set1_ps(values[0])), _mm256_mul_ps(beta, _mm256_set1_ps(values[1]))), _mm256_mul_ps(gamma, _mm256_set1_ps(values[2])));
+}
+
+TARGET_AVX2 __m256i PackLitColoursAVX2(__m256 r, __m256 g, __m256 b) {
+
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 maxChannel = _mm256_set1_ps(255.0f);
+
+	__m256i ri = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(r, zero), maxChannel));
+	__m256i gi = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(g, zero), maxChannel));
+	__m256i bi = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(b, zero), maxChannel));
+
+	return _mm256_or_si256(_mm256_or_si256(ri, _mm256_slli_epi32(gi, 8)), _mm256_or_si256(_mm256_slli_epi32(bi, 16), _mm256_set1_epi32((int)0xFF000000)));
+}
+
+// Same lookup as GetColourFromTexCoord for 8 lanes at once, using a masked gather for the texel reads.
+TARGET_AVX2 __m256i GatherTexelColoursAVX2(const Texture& texture, const __m256& u, const __m256& v, const __m256& activeLanes) {
+
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	__m256 inTextureRange = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LT_OQ)),
+										  _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, one, _CMP_LT_OQ)));
+
+	__m256i texelX = _mm256_cvttps_epi32(_mm256_mul_ps(u, _mm256_set1_ps((float)(texture.width - 1))));
+	__m256i texelY = _mm256_cvttps_epi32(_mm256_mul_ps(v, _mm256_set1_ps((float)(texture.height - 1))));
+	texelX = _mm256_max_epi32(_mm256_min_epi32(texelX, _mm256_set1_epi32(texture.width - 1)), _mm256_setzero_si256());
+	texelY = _mm256_max_epi32(_mm256_min_epi32(texelY, _mm256_set1_epi32(texture.height - 1)), _mm256_setzero_si256());
+
+	__m256i byteOffset = _mm256_slli_epi32(_mm256_add_epi32(texelX, _mm256_mullo_epi32(texelY, _mm256_set1_epi32(texture.width))), 2);
+	__m256i inDataRange = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)texture.data.size() - 3), byteOffset);
+
+	__m256i gatherLanes = _mm256_and_si256(_mm256_castps_si256(_mm256_and_ps(activeLanes, inTextureRange)), inDataRange);
+
+	__m256i texels = _mm256_blendv_epi8(_mm256_set1_epi32(PackColour(colour_black)), _mm256_set1_epi32(PackColour(colour_pink)), _mm256_castps_si256(inTextureRange));
+	return _mm256_mask_i32gather_epi32(texels, (const int*)texture.data.data(), byteOffset, gatherLanes, 1);
+}
+
+// Edge functions of the 8 pixels starting at edgeAtFirstPixel, their barycentric weights, and which of them are inside the triangle.
+TARGET_AVX2 __m256 BlockCoverageAVX2(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, __m256& alpha, __m256& beta, __m256& gamma) {
+
+	const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	__m256i edgeA = _mm256_add_epi32(_mm256_set1_epi32(edgeAtFirstPixel.x), _mm256_mullo_epi32(laneOffsets, _mm256_set1_epi32(pbd.edgeStepX[0])));
+	__m256i edgeB = _mm256_add_epi32(_mm256_set1_epi32(edgeAtFirstPixel.y), _mm256_mullo_epi32(laneOffsets, _mm256_set1_epi32(pbd.edgeStepX[1])));
+	__m256i edgeC = _mm256_add_epi32(_mm256_set1_epi32(edgeAtFirstPixel.z), _mm256_mullo_epi32(laneOffsets, _mm256_set1_epi32(pbd.edgeStepX[2])));
+
+	__m256 invArea = _mm256_set1_ps(pbd.invAreaOfTriangle);
+	alpha = _mm256_mul_ps(_mm256_cvtepi32_ps(edgeA), invArea);
+	beta = _mm256_mul_ps(_mm256_cvtepi32_ps(edgeB), invArea);
+	gamma = _mm256_mul_ps(_mm256_cvtepi32_ps(edgeC), invArea);
+
+	return _mm256_castsi256_ps(_mm256_and_si256(_mm256_and_si256(EdgeInsideMaskAVX2(edgeA, pbd.edgeInsideThreshold[0]), EdgeInsideMaskAVX2(edgeB, pbd.edgeInsideThreshold[1])), EdgeInsideMaskAVX2(edgeC, pbd.edgeInsideThreshold[2])));
+}
+
+// Depth tests the covered lanes and writes the new depth of the ones that pass, returns those lanes.
+TARGET_AVX2 __m256 BlockDepthTestAVX2(const PixelBlockRenderingData& pbd, const __m256& covered, const __m256& alpha, const __m256& beta, const __m256& gamma, float* depthOut, FragmentCounters& fragmentCounters) {
+
+	__m256 depth = _mm256_div_ps(_mm256_set1_ps(1.0f), InterpolateAVX2(alpha, beta, gamma, pbd.invDepth));
+	__m256 passed = _mm256_and_ps(covered, _mm256_cmp_ps(_mm256_loadu_ps(depthOut), depth, _CMP_LT_OQ));
+	int numPassed = CountSetBits(_mm256_movemask_ps(passed));
+	fragmentCounters.fragmentsKilledByDepth += CountSetBits(_mm256_movemask_ps(covered)) - numPassed;
+
+	if (numPassed != 0) {
+		_mm256_maskstore_ps(depthOut, _mm256_castps_si256(passed), depth);
+	}
+	return passed;
+}
+
+// Interpolates what pixelFeatures asks for (never depth) for the lanes in passed, gathers their texels and writes their colours.
+template<unsigned int pixelFeatures>
+TARGET_AVX2 void ShadePixelBlockAVX2(const PixelBlockRenderingData& pbd, const __m256& alpha, const __m256& beta, const __m256& gamma, const __m256& passed, unsigned char* colourOut) {
+
+	const bool textured = (pixelFeatures & PIXEL_FEATURE_TEXTURED) != 0;
+	const bool vertexColour = (pixelFeatures & PIXEL_FEATURE_VERTEX_COLOUR) != 0;
+	const bool lit = (pixelFeatures & PIXEL_FEATURE_LIT) != 0;
+	const bool fixedColour = (pixelFeatures & PIXEL_FEATURE_FIXED_COLOUR) != 0;
+
+	__m256i result;
+	if (fixedColour && !lit) {
+		result = _mm256_set1_epi32(PackColour(pbd.fixedColour) | (int)0xFF000000);
+	}
+	else {
+		__m256 texW = _mm256_div_ps(_mm256_set1_ps(1.0f), InterpolateAVX2(alpha, beta, gamma, pbd.texW));
+
+		__m256 r, g, b;
+		__m256i texelColours;
+		if (fixedColour) {
+			r = _mm256_set1_ps(pbd.fixedColour.r);
+			g = _mm256_set1_ps(pbd.fixedColour.g);
+			b = _mm256_set1_ps(pbd.fixedColour.b);
+		}
+		else if (textured) {
+			__m256 u = _mm256_mul_ps(InterpolateAVX2(alpha, beta, gamma, pbd.texU), texW);
+			__m256 v = _mm256_mul_ps(InterpolateAVX2(alpha, beta, gamma, pbd.texV), texW);
+			texelColours = GatherTexelColoursAVX2(*pbd.curTex, u, v, passed);
+
+			const __m256i channelMask = _mm256_set1_epi32(0xFF);
+			r = _mm256_cvtepi32_ps(_mm256_and_si256(texelColours, channelMask));
+			g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(texelColours, 8), channelMask));
+			b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(texelColours, 16), channelMask));
+		}
+
+		if (vertexColour) {
+			float colourR[3] = { pbd.colour[0].x, pbd.colour[1].x, pbd.colour[2].x };
+			float colourG[3] = { pbd.colour[0].y, pbd.colour[1].y, pbd.colour[2].y };
+			float colourB[3] = { pbd.colour[0].z, pbd.colour[1].z, pbd.colour[2].z };
+			__m256 vertexR = _mm256_mul_ps(InterpolateAVX2(alpha, beta, gamma, colourR), texW);
+			__m256 vertexG = _mm256_mul_ps(InterpolateAVX2(alpha, beta, gamma, colourG), texW);
+			__m256 vertexB = _mm256_mul_ps(InterpolateAVX2(alpha, beta, gamma, colourB), texW);
+
+			if (textured) {
+				__m256 mix = _mm256_set1_ps(colourTextureMixFactor);
+				__m256 oneMinusMix = _mm256_set1_ps(1.0f - colourTextureMixFactor);
+				r = _mm256_add_ps(_mm256_mul_ps(oneMinusMix, r), _mm256_mul_ps(mix, vertexR));
+				g = _mm256_add_ps(_mm256_mul_ps(oneMinusMix, g), _mm256_mul_ps(mix, vertexG));
+				b = _mm256_add_ps(_mm256_mul_ps(oneMinusMix, b), _mm256_mul_ps(mix, vertexB));
+			}
+			else {
+				r = vertexR;
+				g = vertexG;
+				b = vertexB;
+			}
+		}
+
+		if (lit) {
+			__m256 lightDotTriangleNormal = _mm256_mul_ps(InterpolateAVX2(alpha, beta, gamma, pbd.lightDotTriangleNormals), texW);
+			result = PackLitColoursAVX2(_mm256_mul_ps(r, lightDotTriangleNormal), _mm256_mul_ps(g, lightDotTriangleNormal), _mm256_mul_ps(b, lightDotTriangleNormal));
+		}
+		else if (textured && !vertexColour) {
+			result = _mm256_or_si256(texelColours, _mm256_set1_epi32((int)0xFF000000));
+		}
+		else {
+			result = PackLitColoursAVX2(r, g, b);
+		}
+	}
+
+	_mm256_maskstore_epi32((int*)colourOut, _mm256_castps_si256(passed), result);
+}
+
+template<unsigned int pixelFeatures>
+TARGET_AVX2 bool DrawPixelBlockAVX2(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, unsigned char* colourOut, float* depthOut, FragmentCounters& fragmentCounters) {
+
+	__m256 alpha, beta, gamma;
+	__m256 covered = BlockCoverageAVX2(pbd, edgeAtFirstPixel, alpha, beta, gamma);
+	if (_mm256_movemask_ps(covered) == 0) {
+		return false;
+	}
+
+	__m256 passed = BlockDepthTestAVX2(pbd, covered, alpha, beta, gamma, depthOut, fragmentCounters);
+	int numPassed = CountSetBits(_mm256_movemask_ps(passed));
+	if (numPassed == 0 || (pixelFeatures & PIXEL_FEATURE_DEPTH_ONLY)) {
+		return numPassed != 0;
+	}
+	fragmentCounters.fragmentsShaded += numPassed;
+
+	ShadePixelBlockAVX2<pixelFeatures>(pbd, alpha, beta, gamma, passed, colourOut);
+	return true;
+}
+
+TARGET_AVX2 bool DrawVisibilityBlockAVX2(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, unsigned int visibilityID, unsigned int* visibilityOut, float* depthOut, FragmentCounters& fragmentCounters) {
+
+	__m256 alpha, beta, gamma;
+	__m256 covered = BlockCoverageAVX2(pbd, edgeAtFirstPixel, alpha, beta, gamma);
+	if (_mm256_movemask_ps(covered) == 0) {
+		return false;
+	}
+
+	__m256 passed = BlockDepthTestAVX2(pbd, covered, alpha, beta, gamma, depthOut, fragmentCounters);
+	_mm256_maskstore_epi32((int*)visibilityOut, _mm256_castps_si256(passed), _mm256_set1_epi32((int)visibilityID));
+	return _mm256_movemask_ps(passed) != 0;
+}
+
+template<unsigned int pixelFeatures>
+TARGET_AVX2 void ShadePixelBlockWithMaskAVX2(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, const int laneMask[8], unsigned char* colourOut) {
+
+	__m256 alpha, beta, gamma;
+	BlockCoverageAVX2(pbd, edgeAtFirstPixel, alpha, beta, gamma);
+	ShadePixelBlockAVX2<pixelFeatures>(pbd, alpha, beta, gamma, _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)laneMask)), colourOut);
+}
\ No newline at end of file
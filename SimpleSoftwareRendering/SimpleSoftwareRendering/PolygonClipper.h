@@ -0,0 +1,112 @@
+#pragma once
+
+#include <utility>
+
+#include "Geometry.h"
+
+// One corner of a polygon being clipped, with every value that has to be interpolated when a plane cuts an edge.
+// Clipping happens before the perspective divide, clip space is still linear in view space so plain lerps keep every attribute correct.
+struct ClipVertex {
+
+	Vector4 position;		// Clip space, negated so w is the view space depth, see clipSpacePlanesScreen.
+	Vector3 texCoord;
+	Vector4 colour;
+	Vector3 normal;
+	float lightDotNormal;
+};
+
+// A triangle clipped by N planes gains at most one vertex per plane, so 9 covers all six clip space planes.
+const int maxClipPolygonVertices = 9;
+
+// Fixed size polygon that lives on the stack, clipping a triangle never touches the heap.
+struct ClipPolygon {
+
+	ClipVertex vertices[maxClipPolygonVertices];
+	int numVertices = 0;
+};
+
+ClipVertex LerpClipVertex(const ClipVertex& a, const ClipVertex& b, const float& t) {
+
+	ClipVertex result;
+	result.position = a.position + (b.position - a.position) * t;
+	result.texCoord = a.texCoord + (b.texCoord - a.texCoord) * t;
+	result.colour = a.colour + (b.colour - a.colour) * t;
+	result.normal = a.normal + (b.normal - a.normal) * t;
+	result.lightDotNormal = a.lightDotNormal + (b.lightDotNormal - a.lightDotNormal) * t;
+
+	return result;
+}
+
+float DistanceToClipSpacePlane(const Vector4& position, const ClipSpacePlane& plane) {
+	return glm::dot(plane.coefficients, position) + plane.offset;
+}
+
+// Bit i is set when the vertex is on the outside of planes[i].
+unsigned int ComputeClipOutcode(const Vector4& position, const ClipSpacePlane* planes, int numPlanes) {
+
+	unsigned int outcode = 0;
+	for (int i = 0; i < numPlanes; i++)
+	{
+		if (DistanceToClipSpacePlane(position, planes[i]) < 0.0f) {
+			outcode |= 1u << i;
+		}
+	}
+	return outcode;
+}
+
+// One Sutherland-Hodgman pass, keeps the part of inPolygon on the inside of the plane.
+// Plane distances are linear along an edge, so the intersection is found with one divide, no square roots.
+void ClipPolygonAgainstPlane(const ClipPolygon& inPolygon, const ClipSpacePlane& plane, ClipPolygon& outPolygon) {
+
+	outPolygon.numVertices = 0;
+
+	if (inPolygon.numVertices == 0) {
+		return;
+	}
+
+	const ClipVertex* previous = &inPolygon.vertices[inPolygon.numVertices - 1];
+	float previousDistance = DistanceToClipSpacePlane(previous->position, plane);
+
+	for (int i = 0; i < inPolygon.numVertices; i++)
+	{
+		const ClipVertex* current = &inPolygon.vertices[i];
+		float currentDistance = DistanceToClipSpacePlane(current->position, plane);
+
+		bool previousInside = previousDistance >= 0.0f;
+		bool currentInside = currentDistance >= 0.0f;
+
+		if (previousInside != currentInside && outPolygon.numVertices < maxClipPolygonVertices) {
+			float t = previousDistance / (previousDistance - currentDistance);
+			outPolygon.vertices[outPolygon.numVertices++] = LerpClipVertex(*previous, *current, t);
+		}
+
+		if (currentInside && outPolygon.numVertices < maxClipPolygonVertices) {
+			outPolygon.vertices[outPolygon.numVertices++] = *current;
+		}
+
+		previous = current;
+		previousDistance = currentDistance;
+	}
+}
+
+// Clips the polygon in place against every plane whose bit is set in planesToClip, ping-ponging between two stack polygons.
+void ClipPolygonAgainstPlanes(ClipPolygon& polygon, const ClipSpacePlane* planes, int numPlanes, unsigned int planesToClip) {
+
+	ClipPolygon scratch;
+	ClipPolygon* in = &polygon;
+	ClipPolygon* out = &scratch;
+
+	for (int i = 0; i < numPlanes && in->numVertices > 0; i++)
+	{
+		if ((planesToClip & (1u << i)) == 0) {
+			continue;
+		}
+
+		ClipPolygonAgainstPlane(*in, planes[i], *out);
+		std::swap(in, out);
+	}
+
+	if (in != &polygon) {
+		polygon = *in;
+	}
+}
\ No newline at end of file
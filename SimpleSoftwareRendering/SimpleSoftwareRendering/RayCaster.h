@@ -0,0 +1,528 @@
+#pragma once
+
+#include <vector>
+#include <cfloat>
+#include <cstdint>
+#include <algorithm>
+#include <immintrin.h>
+
+#include "Instrumentor.h"
+
+#include "Geometry.h"
+#include "Model.h"
+#include "Texture.h"
+#include "BVH.h"
+#include "ThreadPool.h"
+#include "PixelKernelsSIMD.h"
+#include "RenderGeometry.h"
+#include "TileRenderer.h"
+#include "WorldConstants.h"
+
+// The ray cast render mode, one primary ray per pixel through the model's BVH instead of rasterizing its triangles.
+// It fills imageData/imageDepthData the same way the rasterizer does, so everything reading them afterwards doesn't care which one ran.
+// Every mesh's cull mode is applied to the rays too, so the two modes agree on which side of a triangle can be seen.
+
+// OBJECT SPACE!!! Where every pixel's ray starts and ends, like the BVH. Points on a plane of constant depth are affine in screen space,
+// so the far end of a pixel's ray is the far end of pixel (0, 0)'s plus whole steps in x and y.
+struct RayCastConstants {
+
+	Vector3 rayOrigin;
+	Vector3 farPointAtFirstPixel;
+	Vector3 farPointStepX;
+	Vector3 farPointStepY;
+};
+
+// Same unprojection mouse picking uses, the projection was built for a camera looking down -z so NDC z = 1 lands on the far plane behind ours.
+Vector3 UnprojectToFarPlane(const Mat4x4& inverseModelViewProjectionMatrix, const Vector3& rayOrigin, float ndcX, float ndcY) {
+
+	Vector4 farPointBehind = inverseModelViewProjectionMatrix * Vector4{ ndcX, ndcY, 1.0f, 1.0f };
+	return (2.0f * rayOrigin) - (Vector3(farPointBehind) / farPointBehind.w);
+}
+
+RayCastConstants ComputeRayCastConstants(const DrawConstants& drawConstants, int imageWidth, int imageHeight) {
+
+	Mat4x4 inverseModelViewProjectionMatrix = glm::inverse(drawConstants.modelViewProjectionMatrix);
+
+	RayCastConstants rayCastConstants;
+	rayCastConstants.rayOrigin = drawConstants.cameraPosition;
+
+	float halfPixelX = 1.0f / imageWidth;
+	float halfPixelY = 1.0f / imageHeight;
+	Vector3 firstPixel = UnprojectToFarPlane(inverseModelViewProjectionMatrix, rayCastConstants.rayOrigin, halfPixelX - 1.0f, halfPixelY - 1.0f);
+	Vector3 lastPixelX = UnprojectToFarPlane(inverseModelViewProjectionMatrix, rayCastConstants.rayOrigin, 1.0f - halfPixelX, halfPixelY - 1.0f);
+	Vector3 lastPixelY = UnprojectToFarPlane(inverseModelViewProjectionMatrix, rayCastConstants.rayOrigin, halfPixelX - 1.0f, 1.0f - halfPixelY);
+
+	rayCastConstants.farPointAtFirstPixel = firstPixel;
+	rayCastConstants.farPointStepX = (lastPixelX - firstPixel) / (float)std::max(imageWidth - 1, 1);
+	rayCastConstants.farPointStepY = (lastPixelY - firstPixel) / (float)std::max(imageHeight - 1, 1);
+	return rayCastConstants;
+}
+
+// Unnormalized, so a hit distance of 1 is the far plane. Nothing past it is drawn by the rasterizer either.
+Vector3 GetPixelRayDirection(const RayCastConstants& rayCastConstants, int x, int y) {
+	return (rayCastConstants.farPointAtFirstPixel + (rayCastConstants.farPointStepX * (float)x) + (rayCastConstants.farPointStepY * (float)y)) - rayCastConstants.rayOrigin;
+}
+
+// Per vertex light term exactly like TransformVertex works it out, only for the three vertices of the hit triangle.
+float ComputeVertexLightDotNormal(const DrawConstants& drawConstants, const Point& vertex) {
+
+	Vector3 worldPosition = Vector3(drawConstants.modelMatrix * Vector4(vertex.position, 1.0f));
+	Vector3 worldNormal = glm::normalize(drawConstants.normalMatrix * vertex.normal);
+	Vector3 lightDirFromVertex = glm::normalize(drawConstants.lightPosition - worldPosition);
+	return glm::max(glm::dot(lightDirFromVertex, worldNormal), 0.1f);
+}
+
+// Writes the hit's colour and depth. Barycentrics from the ray are already perspective correct, there's no 1 / w to undo.
+void ShadeRayHit(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, int imageWidth, int x, int y,
+	const Model& model, const DrawConstants& drawConstants, const Vector3& rayOrigin, const Vector3& rayDirection, const RayHit& rayHit) {
+
+	const Mesh& mesh = model.meshes[rayHit.meshIndex];
+	const Point& a = mesh.vertices[mesh.indices[(rayHit.triangleIndex * 3) + 0]];
+	const Point& b = mesh.vertices[mesh.indices[(rayHit.triangleIndex * 3) + 1]];
+	const Point& c = mesh.vertices[mesh.indices[(rayHit.triangleIndex * 3) + 2]];
+
+	float alpha = 1.0f - rayHit.u - rayHit.v;
+	float beta = rayHit.u;
+	float gamma = rayHit.v;
+
+	// Shaded with the same features the rasterizer picks for the mesh, see ShadePixelWithBarycentrics. The flat colour is the triangles' white.
+	unsigned int pixelFeatures = GetMeshPixelFeatures(mesh);
+	const bool textured = (pixelFeatures & PIXEL_FEATURE_TEXTURED) != 0;
+
+	float red = colour_white.r, green = colour_white.g, blue = colour_white.b;
+	if (textured) {
+		Vector2 texCoord = (alpha * Vector2(a.texCoord)) + (beta * Vector2(b.texCoord)) + (gamma * Vector2(c.texCoord));
+		Colour texelColour = GetColourFromTexCoord(Model::textures[mesh.textureIndex], texCoord);
+		red = texelColour.r;
+		green = texelColour.g;
+		blue = texelColour.b;
+	}
+
+	if (pixelFeatures & PIXEL_FEATURE_VERTEX_COLOUR) {
+		Vector4 vertexColour = (alpha * a.colour) + (beta * b.colour) + (gamma * c.colour);
+		float vertexColourWeight = textured ? colourTextureMixFactor : 1.0f;
+		red = ((1.0f - vertexColourWeight) * red) + (vertexColourWeight * vertexColour.r);
+		green = ((1.0f - vertexColourWeight) * green) + (vertexColourWeight * vertexColour.g);
+		blue = ((1.0f - vertexColourWeight) * blue) + (vertexColourWeight * vertexColour.b);
+	}
+
+	if (pixelFeatures & PIXEL_FEATURE_LIT) {
+		float lightDotTriangleNormal = (alpha * ComputeVertexLightDotNormal(drawConstants, a)) + (beta * ComputeVertexLightDotNormal(drawConstants, b)) + (gamma * ComputeVertexLightDotNormal(drawConstants, c));
+		red *= lightDotTriangleNormal;
+		green *= lightDotTriangleNormal;
+		blue *= lightDotTriangleNormal;
+	}
+
+	int index = GetRedFlattenedImageDataSlotForPixel(Vector2Int{ x, y }, imageWidth);
+	imageData[index + 0] = red;
+	imageData[index + 1] = green;
+	imageData[index + 2] = blue;
+	imageData[index + 3] = 255;
+
+	// The depth buffer holds NDC z, bigger is nearer.
+	Vector3 hitPosition = rayOrigin + (rayDirection * rayHit.distance);
+	Vector4 clipPosition = drawConstants.modelViewProjectionMatrix * Vector4(hitPosition, 1.0f);
+	imageDepthData[GetFlattenedImageDataSlotForDepthData(Vector2Int{ x, y }, imageWidth)] = clipPosition.z / clipPosition.w;
+}
+
+//--------------------------------------------------------SSE Packets--------------------------------------------------------
+
+// 4 rays in structure of arrays form, traced through the BVH together. Neighbouring primary rays mostly visit the same nodes,
+// so every node and triangle is loaded once for the whole packet.
+struct RayPacketSSE {
+
+	__m128 originX, originY, originZ;
+	__m128 directionX, directionY, directionZ;
+	__m128 invDirectionX, invDirectionY, invDirectionZ;
+};
+
+struct RayPacketHitsSSE {
+
+	__m128 distance;
+	__m128 u, v;
+	__m128i triangle;	// Into the BVH's triangles, -1 where nothing was hit.
+};
+
+float HorizontalMinSSE(__m128 values) {
+
+	values = _mm_min_ps(values, _mm_shuffle_ps(values, values, _MM_SHUFFLE(2, 3, 0, 1)));
+	values = _mm_min_ps(values, _mm_shuffle_ps(values, values, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(values);
+}
+
+// Lanes that hit the box before their closest hit so far, entry is where each of them gets into it.
+__m128 IntersectRayPacketNodeSSE(const RayPacketSSE& packet, const BVHNode& node, const __m128& maxDistance, __m128& entry) {
+
+	__m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.x), packet.originX), packet.invDirectionX);
+	__m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.x), packet.originX), packet.invDirectionX);
+	__m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.y), packet.originY), packet.invDirectionY);
+	__m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.y), packet.originY), packet.invDirectionY);
+	__m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin.z), packet.originZ), packet.invDirectionZ);
+	__m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax.z), packet.originZ), packet.invDirectionZ);
+
+	__m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+	__m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_min_ps(_mm_max_ps(tz0, tz1), maxDistance));
+
+	entry = tNear;
+	return _mm_cmple_ps(tNear, tFar);
+}
+
+// Moller-Trumbore for all 4 rays against one triangle, lanes that hit it nearer than before take it. Packets are camera rays, so the triangle's cull mode applies.
+void IntersectRayPacketTriangleSSE(const RayPacketSSE& packet, const BVHTriangle& triangle, int triangleIndex, RayPacketHitsSSE& hits) {
+
+	__m128 edge1X = _mm_set1_ps(triangle.edge1.x), edge1Y = _mm_set1_ps(triangle.edge1.y), edge1Z = _mm_set1_ps(triangle.edge1.z);
+	__m128 edge2X = _mm_set1_ps(triangle.edge2.x), edge2Y = _mm_set1_ps(triangle.edge2.y), edge2Z = _mm_set1_ps(triangle.edge2.z);
+
+	__m128 pX = _mm_sub_ps(_mm_mul_ps(packet.directionY, edge2Z), _mm_mul_ps(packet.directionZ, edge2Y));
+	__m128 pY = _mm_sub_ps(_mm_mul_ps(packet.directionZ, edge2X), _mm_mul_ps(packet.directionX, edge2Z));
+	__m128 pZ = _mm_sub_ps(_mm_mul_ps(packet.directionX, edge2Y), _mm_mul_ps(packet.directionY, edge2X));
+
+	__m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, pX), _mm_mul_ps(edge1Y, pY)), _mm_mul_ps(edge1Z, pZ));
+	__m128 invDeterminant = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+
+	__m128 sX = _mm_sub_ps(packet.originX, _mm_set1_ps(triangle.vertex0.x));
+	__m128 sY = _mm_sub_ps(packet.originY, _mm_set1_ps(triangle.vertex0.y));
+	__m128 sZ = _mm_sub_ps(packet.originZ, _mm_set1_ps(triangle.vertex0.z));
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sX, pX), _mm_mul_ps(sY, pY)), _mm_mul_ps(sZ, pZ)), invDeterminant);
+
+	__m128 qX = _mm_sub_ps(_mm_mul_ps(sY, edge1Z), _mm_mul_ps(sZ, edge1Y));
+	__m128 qY = _mm_sub_ps(_mm_mul_ps(sZ, edge1X), _mm_mul_ps(sX, edge1Z));
+	__m128 qZ = _mm_sub_ps(_mm_mul_ps(sX, edge1Y), _mm_mul_ps(sY, edge1X));
+	__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(packet.directionX, qX), _mm_mul_ps(packet.directionY, qY)), _mm_mul_ps(packet.directionZ, qZ)), invDeterminant);
+	__m128 distance = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2X, qX), _mm_mul_ps(edge2Y, qY)), _mm_mul_ps(edge2Z, qZ)), invDeterminant);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	// Same sides culled as IsRayTriangleHitCulled.
+	__m128 hit = triangle.cullMode == CULL_MODE_BACK ? _mm_cmpgt_ps(determinant, zero) : triangle.cullMode == CULL_MODE_FRONT ? _mm_cmplt_ps(determinant, zero) : _mm_cmpneq_ps(determinant, zero);
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+	hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(distance, zero), _mm_cmplt_ps(distance, hits.distance)));
+
+	hits.distance = _mm_or_ps(_mm_and_ps(hit, distance), _mm_andnot_ps(hit, hits.distance));
+	hits.u = _mm_or_ps(_mm_and_ps(hit, u), _mm_andnot_ps(hit, hits.u));
+	hits.v = _mm_or_ps(_mm_and_ps(hit, v), _mm_andnot_ps(hit, hits.v));
+	__m128i hitInt = _mm_castps_si128(hit);
+	hits.triangle = _mm_or_si128(_mm_and_si128(hitInt, _mm_set1_epi32(triangleIndex)), _mm_andnot_si128(hitInt, hits.triangle));
+}
+
+// Closest hit for every lane. A node is visited when any lane gets into it, the nearer child (by its nearest lane) first.
+void TraceRayPacketClosestHitSSE(const BVH& bvh, const RayPacketSSE& packet, float maxDistance, RayPacketHitsSSE& hits) {
+
+	hits.distance = _mm_set1_ps(maxDistance);
+	hits.u = _mm_setzero_ps();
+	hits.v = _mm_setzero_ps();
+	hits.triangle = _mm_set1_epi32(-1);
+
+	if (bvh.triangles.empty()) {
+		return;
+	}
+
+	__m128 entry;
+	if (_mm_movemask_ps(IntersectRayPacketNodeSSE(packet, bvh.nodes[0], hits.distance, entry)) == 0) {
+		return;
+	}
+
+	uint32_t nodeStack[bvhMaxTraversalDepth];
+	int stackSize = 0;
+	nodeStack[stackSize++] = 0;
+
+	__m128 flt_max = _mm_set1_ps(FLT_MAX);
+	while (stackSize > 0)
+	{
+		const BVHNode& node = bvh.nodes[nodeStack[--stackSize]];
+		if (node.numTriangles > 0) {
+			for (uint32_t i = node.leftFirst; i < node.leftFirst + node.numTriangles; i++)
+			{
+				IntersectRayPacketTriangleSSE(packet, bvh.triangles[i], i, hits);
+			}
+			continue;
+		}
+
+		__m128 leftEntry, rightEntry;
+		__m128 leftHit = IntersectRayPacketNodeSSE(packet, bvh.nodes[node.leftFirst], hits.distance, leftEntry);
+		__m128 rightHit = IntersectRayPacketNodeSSE(packet, bvh.nodes[node.leftFirst + 1], hits.distance, rightEntry);
+		bool leftVisited = _mm_movemask_ps(leftHit) != 0;
+		bool rightVisited = _mm_movemask_ps(rightHit) != 0;
+
+		if (leftVisited && rightVisited) {
+			float leftNearest = HorizontalMinSSE(_mm_or_ps(_mm_and_ps(leftHit, leftEntry), _mm_andnot_ps(leftHit, flt_max)));
+			float rightNearest = HorizontalMinSSE(_mm_or_ps(_mm_and_ps(rightHit, rightEntry), _mm_andnot_ps(rightHit, flt_max)));
+			bool leftFirst = leftNearest <= rightNearest;
+			nodeStack[stackSize++] = leftFirst ? node.leftFirst + 1 : node.leftFirst;
+			nodeStack[stackSize++] = leftFirst ? node.leftFirst : node.leftFirst + 1;
+		}
+		else if (leftVisited) {
+			nodeStack[stackSize++] = node.leftFirst;
+		}
+		else if (rightVisited) {
+			nodeStack[stackSize++] = node.leftFirst + 1;
+		}
+	}
+}
+
+//--------------------------------------------------------AVX2 Packets--------------------------------------------------------
+
+struct RayPacketAVX2 {
+
+	__m256 originX, originY, originZ;
+	__m256 directionX, directionY, directionZ;
+	__m256 invDirectionX, invDirectionY, invDirectionZ;
+};
+
+struct RayPacketHitsAVX2 {
+
+	__m256 distance;
+	__m256 u, v;
+	__m256i triangle;	// Into the BVH's triangles, -1 where nothing was hit.
+};
+
+TARGET_AVX2 float HorizontalMinAVX2(__m256 values) {
+
+	__m128 halves = _mm_min_ps(_mm256_castps256_ps128(values), _mm256_extractf128_ps(values, 1));
+	halves = _mm_min_ps(halves, _mm_shuffle_ps(halves, halves, _MM_SHUFFLE(2, 3, 0, 1)));
+	halves = _mm_min_ps(halves, _mm_shuffle_ps(halves, halves, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(halves);
+}
+
+TARGET_AVX2 __m256 IntersectRayPacketNodeAVX2(const RayPacketAVX2& packet, const BVHNode& node, const __m256& maxDistance, __m256& entry) {
+
+	__m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.x), packet.originX), packet.invDirectionX);
+	__m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.x), packet.originX), packet.invDirectionX);
+	__m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.y), packet.originY), packet.invDirectionY);
+	__m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.y), packet.originY), packet.invDirectionY);
+	__m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMin.z), packet.originZ), packet.invDirectionZ);
+	__m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.boundsMax.z), packet.originZ), packet.invDirectionZ);
+
+	__m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)), _mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_setzero_ps()));
+	__m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)), _mm256_min_ps(_mm256_max_ps(tz0, tz1), maxDistance));
+
+	entry = tNear;
+	return _mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ);
+}
+
+TARGET_AVX2 void IntersectRayPacketTriangleAVX2(const RayPacketAVX2& packet, const BVHTriangle& triangle, int triangleIndex, RayPacketHitsAVX2& hits) {
+
+	__m256 edge1X = _mm256_set1_ps(triangle.edge1.x), edge1Y = _mm256_set1_ps(triangle.edge1.y), edge1Z = _mm256_set1_ps(triangle.edge1.z);
+	__m256 edge2X = _mm256_set1_ps(triangle.edge2.x), edge2Y = _mm256_set1_ps(triangle.edge2.y), edge2Z = _mm256_set1_ps(triangle.edge2.z);
+
+	__m256 pX = _mm256_sub_ps(_mm256_mul_ps(packet.directionY, edge2Z), _mm256_mul_ps(packet.directionZ, edge2Y));
+	__m256 pY = _mm256_sub_ps(_mm256_mul_ps(packet.directionZ, edge2X), _mm256_mul_ps(packet.directionX, edge2Z));
+	__m256 pZ = _mm256_sub_ps(_mm256_mul_ps(packet.directionX, edge2Y), _mm256_mul_ps(packet.directionY, edge2X));
+
+	__m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge1X, pX), _mm256_mul_ps(edge1Y, pY)), _mm256_mul_ps(edge1Z, pZ));
+	__m256 invDeterminant = _mm256_div_ps(_mm256_set1_ps(1.0f), determinant);
+
+	__m256 sX = _mm256_sub_ps(packet.originX, _mm256_set1_ps(triangle.vertex0.x));
+	__m256 sY = _mm256_sub_ps(packet.originY, _mm256_set1_ps(triangle.vertex0.y));
+	__m256 sZ = _mm256_sub_ps(packet.originZ, _mm256_set1_ps(triangle.vertex0.z));
+	__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sX, pX), _mm256_mul_ps(sY, pY)), _mm256_mul_ps(sZ, pZ)), invDeterminant);
+
+	__m256 qX = _mm256_sub_ps(_mm256_mul_ps(sY, edge1Z), _mm256_mul_ps(sZ, edge1Y));
+	__m256 qY = _mm256_sub_ps(_mm256_mul_ps(sZ, edge1X), _mm256_mul_ps(sX, edge1Z));
+	__m256 qZ = _mm256_sub_ps(_mm256_mul_ps(sX, edge1Y), _mm256_mul_ps(sY, edge1X));
+	__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(packet.directionX, qX), _mm256_mul_ps(packet.directionY, qY)), _mm256_mul_ps(packet.directionZ, qZ)), invDeterminant);
+	__m256 distance = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edge2X, qX), _mm256_mul_ps(edge2Y, qY)), _mm256_mul_ps(edge2Z, qZ)), invDeterminant);
+
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 hit = triangle.cullMode == CULL_MODE_BACK ? _mm256_cmp_ps(determinant, zero, _CMP_GT_OQ) : triangle.cullMode == CULL_MODE_FRONT ? _mm256_cmp_ps(determinant, zero, _CMP_LT_OQ) : _mm256_cmp_ps(determinant, zero, _CMP_NEQ_OQ);
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(distance, zero, _CMP_GT_OQ), _mm256_cmp_ps(distance, hits.distance, _CMP_LT_OQ)));
+
+	hits.distance = _mm256_blendv_ps(hits.distance, distance, hit);
+	hits.u = _mm256_blendv_ps(hits.u, u, hit);
+	hits.v = _mm256_blendv_ps(hits.v, v, hit);
+	hits.triangle = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(hits.triangle), _mm256_castsi256_ps(_mm256_set1_epi32(triangleIndex)), hit));
+}
+
+TARGET_AVX2 void TraceRayPacketClosestHitAVX2(const BVH& bvh, const RayPacketAVX2& packet, float maxDistance, RayPacketHitsAVX2& hits) {
+
+	hits.distance = _mm256_set1_ps(maxDistance);
+	hits.u = _mm256_setzero_ps();
+	hits.v = _mm256_setzero_ps();
+	hits.triangle = _mm256_set1_epi32(-1);
+
+	if (bvh.triangles.empty()) {
+		return;
+	}
+
+	__m256 entry;
+	if (_mm256_movemask_ps(IntersectRayPacketNodeAVX2(packet, bvh.nodes[0], hits.distance, entry)) == 0) {
+		return;
+	}
+
+	uint32_t nodeStack[bvhMaxTraversalDepth];
+	int stackSize = 0;
+	nodeStack[stackSize++] = 0;
+
+	__m256 flt_max = _mm256_set1_ps(FLT_MAX);
+	while (stackSize > 0)
+	{
+		const BVHNode& node = bvh.nodes[nodeStack[--stackSize]];
+		if (node.numTriangles > 0) {
+			for (uint32_t i = node.leftFirst; i < node.leftFirst + node.numTriangles; i++)
+			{
+				IntersectRayPacketTriangleAVX2(packet, bvh.triangles[i], i, hits);
+			}
+			continue;
+		}
+
+		__m256 leftEntry, rightEntry;
+		__m256 leftHit = IntersectRayPacketNodeAVX2(packet, bvh.nodes[node.leftFirst], hits.distance, leftEntry);
+		__m256 rightHit = IntersectRayPacketNodeAVX2(packet, bvh.nodes[node.leftFirst + 1], hits.distance, rightEntry);
+		bool leftVisited = _mm256_movemask_ps(leftHit) != 0;
+		bool rightVisited = _mm256_movemask_ps(rightHit) != 0;
+
+		if (leftVisited && rightVisited) {
+			float leftNearest = HorizontalMinAVX2(_mm256_blendv_ps(flt_max, leftEntry, leftHit));
+			float rightNearest = HorizontalMinAVX2(_mm256_blendv_ps(flt_max, rightEntry, rightHit));
+			bool leftFirst = leftNearest <= rightNearest;
+			nodeStack[stackSize++] = leftFirst ? node.leftFirst + 1 : node.leftFirst;
+			nodeStack[stackSize++] = leftFirst ? node.leftFirst : node.leftFirst + 1;
+		}
+		else if (leftVisited) {
+			nodeStack[stackSize++] = node.leftFirst;
+		}
+		else if (rightVisited) {
+			nodeStack[stackSize++] = node.leftFirst + 1;
+		}
+	}
+}
+
+//--------------------------------------------------------Tiles--------------------------------------------------------
+
+// Every lane of a packet gets its own ray from the same origin, lanes past the right edge of the image copy the last pixel's and are never written.
+template<int packetWidth>
+void FillPixelRays(const RayCastConstants& rayCastConstants, int startX, int lastX, int y, float originOut[3][packetWidth], float directionOut[3][packetWidth], float invDirectionOut[3][packetWidth]) {
+
+	for (int lane = 0; lane < packetWidth; lane++)
+	{
+		Vector3 direction = GetPixelRayDirection(rayCastConstants, std::min(startX + lane, lastX), y);
+		Vector3 invDirection = 1.0f / direction;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			originOut[axis][lane] = rayCastConstants.rayOrigin[axis];
+			directionOut[axis][lane] = direction[axis];
+			invDirectionOut[axis][lane] = invDirection[axis];
+		}
+	}
+}
+
+// Turns the lanes that hit something back into RayHits for ShadeRayHit.
+template<int packetWidth>
+void ShadeRayPacketHits(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, int imageWidth, int startX, int lastX, int y,
+	const Model& model, const BVH& bvh, const DrawConstants& drawConstants, const RayCastConstants& rayCastConstants,
+	const float distances[packetWidth], const float us[packetWidth], const float vs[packetWidth], const int triangles[packetWidth]) {
+
+	for (int lane = 0; lane < packetWidth && startX + lane <= lastX; lane++)
+	{
+		if (triangles[lane] < 0) {
+			continue;
+		}
+
+		const BVHTriangle& triangle = bvh.triangles[triangles[lane]];
+		RayHit rayHit = { true, distances[lane], us[lane], vs[lane], triangle.meshIndex, triangle.triangleIndex };
+		ShadeRayHit(imageData, imageDepthData, imageWidth, startX + lane, y, model, drawConstants, rayCastConstants.rayOrigin, GetPixelRayDirection(rayCastConstants, startX + lane, y), rayHit);
+	}
+}
+
+void RayCastTileScalar(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, int imageWidth,
+	const Model& model, const BVH& bvh, const DrawConstants& drawConstants, const RayCastConstants& rayCastConstants, const Vector2Int& scissorMin, const Vector2Int& scissorMax) {
+
+	for (int y = scissorMin.y; y <= scissorMax.y; y++)
+	{
+		for (int x = scissorMin.x; x <= scissorMax.x; x++)
+		{
+			Vector3 direction = GetPixelRayDirection(rayCastConstants, x, y);
+			RayHit rayHit;
+			if (TraceRayClosestHit(bvh, MakeRay(rayCastConstants.rayOrigin, direction), 1.0f, rayHit, true)) {
+				ShadeRayHit(imageData, imageDepthData, imageWidth, x, y, model, drawConstants, rayCastConstants.rayOrigin, direction, rayHit);
+			}
+		}
+	}
+}
+
+// Loads a row of rays into a packet, traces it and stores the closest hits back out. Only the tracing is SIMD,
+// so the AVX2 one keeps every other instruction out of AVX code and never mixes it with the SSE the rest of the renderer is built with.
+void TraceRayPacketSSE(const BVH& bvh, const float origin[3][4], const float direction[3][4], const float invDirection[3][4], float maxDistance,
+	float distances[4], float us[4], float vs[4], int triangles[4]) {
+
+	RayPacketSSE packet = { _mm_load_ps(origin[0]), _mm_load_ps(origin[1]), _mm_load_ps(origin[2]),
+							_mm_load_ps(direction[0]), _mm_load_ps(direction[1]), _mm_load_ps(direction[2]),
+							_mm_load_ps(invDirection[0]), _mm_load_ps(invDirection[1]), _mm_load_ps(invDirection[2]) };
+
+	RayPacketHitsSSE hits;
+	TraceRayPacketClosestHitSSE(bvh, packet, maxDistance, hits);
+
+	_mm_store_ps(distances, hits.distance);
+	_mm_store_ps(us, hits.u);
+	_mm_store_ps(vs, hits.v);
+	_mm_store_si128((__m128i*)triangles, hits.triangle);
+}
+
+TARGET_AVX2 void TraceRayPacketAVX2(const BVH& bvh, const float origin[3][8], const float direction[3][8], const float invDirection[3][8], float maxDistance,
+	float distances[8], float us[8], float vs[8], int triangles[8]) {
+
+	RayPacketAVX2 packet = { _mm256_load_ps(origin[0]), _mm256_load_ps(origin[1]), _mm256_load_ps(origin[2]),
+							 _mm256_load_ps(direction[0]), _mm256_load_ps(direction[1]), _mm256_load_ps(direction[2]),
+							 _mm256_load_ps(invDirection[0]), _mm256_load_ps(invDirection[1]), _mm256_load_ps(invDirection[2]) };
+
+	RayPacketHitsAVX2 hits;
+	TraceRayPacketClosestHitAVX2(bvh, packet, maxDistance, hits);
+
+	_mm256_store_ps(distances, hits.distance);
+	_mm256_store_ps(us, hits.u);
+	_mm256_store_ps(vs, hits.v);
+	_mm256_store_si256((__m256i*)triangles, hits.triangle);
+}
+
+// Packets are packetWidth x 1 pixels, the same blocks the pixel kernel of that width works in.
+template<int packetWidth>
+void RayCastTileInPackets(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, int imageWidth,
+	const Model& model, const BVH& bvh, const DrawConstants& drawConstants, const RayCastConstants& rayCastConstants, const Vector2Int& scissorMin, const Vector2Int& scissorMax,
+	void (*traceRayPacket)(const BVH&, const float[3][packetWidth], const float[3][packetWidth], const float[3][packetWidth], float, float[packetWidth], float[packetWidth], float[packetWidth], int[packetWidth])) {
+
+	alignas(32) float origin[3][packetWidth], direction[3][packetWidth], invDirection[3][packetWidth];
+	alignas(32) float distances[packetWidth], us[packetWidth], vs[packetWidth];
+	alignas(32) int triangles[packetWidth];
+
+	for (int y = scissorMin.y; y <= scissorMax.y; y++)
+	{
+		for (int x = scissorMin.x; x <= scissorMax.x; x += packetWidth)
+		{
+			FillPixelRays<packetWidth>(rayCastConstants, x, scissorMax.x, y, origin, direction, invDirection);
+			traceRayPacket(bvh, origin, direction, invDirection, 1.0f, distances, us, vs, triangles);
+			ShadeRayPacketHits<packetWidth>(imageData, imageDepthData, imageWidth, x, scissorMax.x, y, model, bvh, drawConstants, rayCastConstants, distances, us, vs, triangles);
+		}
+	}
+}
+
+// Uses the rasterizer's tiles so the two modes split the screen the same way, every pixel is traced by exactly one thread.
+// The active pixel kernel picks the packet width, scalar traces one ray at a time.
+void RayCastModelInTiles(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, int imageWidth, int imageHeight,
+	const Model& model, const BVH& bvh, const DrawConstants& drawConstants, RenderTileGrid& tileGrid, ThreadPool& threadPool) {
+
+	PROFILE_FUNCTION();
+
+	RayCastConstants rayCastConstants = ComputeRayCastConstants(drawConstants, imageWidth, imageHeight);
+	PixelKernel pixelKernel = activePixelKernel;
+
+	threadPool.ParallelFor(tileGrid.numTiles.x * tileGrid.numTiles.y, [&](int tileIndex) {
+
+		Vector2Int tileCoords = { tileIndex % tileGrid.numTiles.x, tileIndex / tileGrid.numTiles.x };
+		Vector2Int scissorMin = tileCoords * renderTileSize;
+		Vector2Int scissorMax = { std::min(scissorMin.x + renderTileSize, imageWidth) - 1, std::min(scissorMin.y + renderTileSize, imageHeight) - 1 };
+
+		if (pixelKernel == PIXEL_KERNEL_AVX2) {
+			RayCastTileInPackets<8>(imageData, imageDepthData, imageWidth, model, bvh, drawConstants, rayCastConstants, scissorMin, scissorMax, TraceRayPacketAVX2);
+		}
+		else if (pixelKernel == PIXEL_KERNEL_SSE) {
+			RayCastTileInPackets<4>(imageData, imageDepthData, imageWidth, model, bvh, drawConstants, rayCastConstants, scissorMin, scissorMax, TraceRayPacketSSE);
+		}
+		else {
+			RayCastTileScalar(imageData, imageDepthData, imageWidth, model, bvh, drawConstants, rayCastConstants, scissorMin, scissorMax);
+		}
+	});
+}
\ No newline at end of file
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "Instrumentor.h"
+
+#include "Geometry.h"
+#include "BVH.h"
+#include "ThreadPool.h"
+#include "RenderGeometry.h"
+#include "TileRenderer.h"
+#include "WorldConstants.h"
+
+// Hard shadows as a pass over the finished frame. Every pixel with something in the depth buffer is unprojected back onto its surface
+// and an any hit ray is traced from there to the light through the model's BVH, no shadow map so no resolution or memory to run out of.
+// Whatever drew the pixel (rasterized, ray cast or voxels) it is shadowed the same way, only the model in the BVH casts shadows.
+
+// OBJECT SPACE!!! Of the model in the BVH, pixels are unprojected straight into it so the rays need no transforming.
+struct ShadowRayConstants {
+
+	Mat4x4 inverseModelViewProjectionMatrix;
+	Mat4x4 modelMatrix;
+	Mat3x3 normalMatrix;
+	Vector3 worldLightPosition;			// Lighting is done in world space like it is for the vertices.
+	Vector3 lightPosition;
+	Vector3 cameraPosition;
+};
+
+ShadowRayConstants ComputeShadowRayConstants(const DrawConstants& drawConstants) {
+
+	ShadowRayConstants shadowRayConstants;
+	shadowRayConstants.inverseModelViewProjectionMatrix = glm::inverse(drawConstants.modelViewProjectionMatrix);
+	shadowRayConstants.modelMatrix = drawConstants.modelMatrix;
+	shadowRayConstants.normalMatrix = drawConstants.normalMatrix;
+	shadowRayConstants.worldLightPosition = drawConstants.lightPosition;
+	shadowRayConstants.lightPosition = Vector3(glm::inverse(drawConstants.modelMatrix) * Vector4(drawConstants.lightPosition, 1.0f));
+	shadowRayConstants.cameraPosition = drawConstants.cameraPosition;
+	return shadowRayConstants;
+}
+
+// The depth buffer holds NDC z, so the pixel's centre and its depth unproject back to where it was drawn. False where nothing was.
+bool UnprojectPixel(const ShadowRayConstants& shadowRayConstants, const std::vector<float>& imageDepthData, int imageWidth, int imageHeight, int x, int y, Vector3& position) {
+
+	if (x < 0 || y < 0 || x >= imageWidth || y >= imageHeight) {
+		return false;
+	}
+
+	float depth = imageDepthData[GetFlattenedImageDataSlotForDepthData(Vector2Int{ x, y }, imageWidth)];
+	if (depth <= 0.0f) {
+		return false;
+	}
+
+	float ndcX = (((float)x + 0.5f) / imageWidth) * 2.0f - 1.0f;
+	float ndcY = (((float)y + 0.5f) / imageHeight) * 2.0f - 1.0f;
+	Vector4 unprojected = shadowRayConstants.inverseModelViewProjectionMatrix * Vector4{ ndcX, ndcY, depth, 1.0f };
+	position = Vector3(unprojected) / unprojected.w;
+	return true;
+}
+
+// Of the two neighbours along an axis, the one nearer in depth is more likely on the same surface, differences across an edge are thrown out that way.
+// Positions are the tile's plus a one pixel border, step is how far apart two neighbours along the axis are in there.
+bool GetSurfaceTangent(const std::vector<Vector3>& positions, const std::vector<uint8_t>& hasPosition, int pixel, int step, Vector3& tangent) {
+
+	const Vector3& position = positions[pixel];
+	bool hasBefore = hasPosition[pixel - step];
+	bool hasAfter = hasPosition[pixel + step];
+
+	if (hasBefore && hasAfter) {
+		Vector3 toAfter = positions[pixel + step] - position;
+		Vector3 fromBefore = position - positions[pixel - step];
+		tangent = glm::dot(toAfter, toAfter) < glm::dot(fromBefore, fromBefore) ? toAfter : fromBefore;
+	}
+	else if (hasAfter) {
+		tangent = positions[pixel + step] - position;
+	}
+	else if (hasBefore) {
+		tangent = position - positions[pixel - step];
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+// Where a pixel's shadow ray starts and how lit it was drawn. False when no ray is needed, nothing was drawn there or it already faces away from the light.
+bool PrepareShadowRay(const ShadowRayConstants& shadowRayConstants, const std::vector<Vector3>& positions, const std::vector<uint8_t>& hasPosition, int stride, int pixel,
+	Vector3& rayOrigin, float& lightDotNormal) {
+
+	Vector3 tangentX, tangentY;
+	if (!hasPosition[pixel]
+		|| !GetSurfaceTangent(positions, hasPosition, pixel, 1, tangentX)
+		|| !GetSurfaceTangent(positions, hasPosition, pixel, stride, tangentY)) {
+		return false;
+	}
+
+	// Whichever way around the cross product came out, the surface we can see faces the camera.
+	const Vector3& position = positions[pixel];
+	Vector3 normal = glm::cross(tangentX, tangentY);
+	float normalLength = glm::length(normal);
+	if (normalLength == 0.0f) {
+		return false;
+	}
+	normal /= normalLength;
+	Vector3 toCamera = shadowRayConstants.cameraPosition - position;
+	if (glm::dot(normal, toCamera) < 0.0f) {
+		normal = -normal;
+	}
+
+	Vector3 worldPosition = Vector3(shadowRayConstants.modelMatrix * Vector4(position, 1.0f));
+	Vector3 worldNormal = glm::normalize(shadowRayConstants.normalMatrix * normal);
+	Vector3 lightDirFromFragment = glm::normalize(shadowRayConstants.worldLightPosition - worldPosition);
+	lightDotNormal = glm::dot(lightDirFromFragment, worldNormal);
+	if (lightDotNormal <= shadowedLightDotNormal) {
+		return false;
+	}
+
+	rayOrigin = position + (normal * (shadowRayBias * glm::length(toCamera)));
+	return true;
+}
+
+// Every pixel of the tile is unprojected once, along with a one pixel border since the normals need the pixels around each one.
+void UnprojectTileWithBorder(const ShadowRayConstants& shadowRayConstants, const std::vector<float>& imageDepthData, int imageWidth, int imageHeight,
+	const Vector2Int& scissorMin, const Vector2Int& scissorMax, std::vector<Vector3>& positions, std::vector<uint8_t>& hasPosition) {
+
+	int tileWidth = scissorMax.x - scissorMin.x + 1;
+	int tileHeight = scissorMax.y - scissorMin.y + 1;
+	int stride = tileWidth + 2;
+	positions.resize(stride * (tileHeight + 2));
+	hasPosition.resize(stride * (tileHeight + 2));
+
+	for (int y = -1; y <= tileHeight; y++)
+	{
+		for (int x = -1; x <= tileWidth; x++)
+		{
+			int pixel = (x + 1) + ((y + 1) * stride);
+			hasPosition[pixel] = UnprojectPixel(shadowRayConstants, imageDepthData, imageWidth, imageHeight, scissorMin.x + x, scissorMin.y + y, positions[pixel]);
+		}
+	}
+}
+
+// The pixel was drawn as colour * lightDotNormal, fully in shadow it should have been colour * shadowedLightDotNormal. shadowAmount blends between the two.
+void DarkenShadowedPixel(std::vector<unsigned char>& imageData, int imageWidth, int x, int y, float lightDotNormal, float shadowAmount) {
+
+	float shadowFactor = 1.0f - (shadowAmount * (1.0f - (shadowedLightDotNormal / lightDotNormal)));
+	int index = GetRedFlattenedImageDataSlotForPixel(Vector2Int{ x, y }, imageWidth);
+	imageData[index + 0] = imageData[index + 0] * shadowFactor;
+	imageData[index + 1] = imageData[index + 1] * shadowFactor;
+	imageData[index + 2] = imageData[index + 2] * shadowFactor;
+}
+
+// One ray per 2x2 quad first, so every pixel has a result to fall back on, then the rest of each quad while the tile's node budget lasts.
+// A tile full of rays that wander through the whole BVH ends up at quarter resolution instead of stalling the frame.
+void TraceShadowsForTile(std::vector<unsigned char>& imageData, const std::vector<float>& imageDepthData, int imageWidth, int imageHeight,
+	const BVH& bvh, const ShadowRayConstants& shadowRayConstants, const Vector2Int& scissorMin, const Vector2Int& scissorMax, ShadowTileScratch& scratch, FragmentCounters& fragmentCounters) {
+
+	PROFILE_FUNCTION();
+
+	int tileWidth = scissorMax.x - scissorMin.x + 1;
+	int tileHeight = scissorMax.y - scissorMin.y + 1;
+	int numQuadsX = (tileWidth + 1) / 2;
+	int numQuadsY = (tileHeight + 1) / 2;
+
+	int stride = tileWidth + 2;
+	std::vector<Vector3>& positions = scratch.positions;
+	std::vector<uint8_t>& hasPosition = scratch.hasPosition;
+	UnprojectTileWithBorder(shadowRayConstants, imageDepthData, imageWidth, imageHeight, scissorMin, scissorMax, positions, hasPosition);
+
+	std::vector<Vector3>& rayOrigins = scratch.rayOrigins;
+	std::vector<float>& lightDotNormals = scratch.lightDotNormals;		// 0 for pixels that don't need a ray.
+	std::vector<uint8_t>& inShadow = scratch.inShadow;
+	std::vector<int>& quadRayPixel = scratch.quadRayPixel;
+	rayOrigins.resize(tileWidth * tileHeight);
+	lightDotNormals.assign(tileWidth * tileHeight, 0.0f);
+	inShadow.assign(tileWidth * tileHeight, 0);
+	quadRayPixel.assign(numQuadsX * numQuadsY, -1);
+
+	for (int y = 0; y < tileHeight; y++)
+	{
+		for (int x = 0; x < tileWidth; x++)
+		{
+			int pixel = x + (y * tileWidth);
+			if (PrepareShadowRay(shadowRayConstants, positions, hasPosition, stride, (x + 1) + ((y + 1) * stride), rayOrigins[pixel], lightDotNormals[pixel])) {
+				int quad = (x / 2) + ((y / 2) * numQuadsX);
+				if (quadRayPixel[quad] == -1) {
+					quadRayPixel[quad] = pixel;
+				}
+			}
+			else {
+				lightDotNormals[pixel] = 0.0f;
+			}
+		}
+	}
+
+	uint32_t nodesVisited = 0;
+	long long raysTraced = 0;
+	long long raysReused = 0;
+
+	for (int quad = 0; quad < quadRayPixel.size(); quad++)
+	{
+		int pixel = quadRayPixel[quad];
+		if (pixel != -1) {
+			inShadow[pixel] = TraceRayAnyHit(bvh, MakeRay(rayOrigins[pixel], shadowRayConstants.lightPosition - rayOrigins[pixel]), 1.0f, &nodesVisited);
+			raysTraced++;
+		}
+	}
+
+	for (int y = 0; y < tileHeight; y++)
+	{
+		for (int x = 0; x < tileWidth; x++)
+		{
+			int pixel = x + (y * tileWidth);
+			int quadPixel = quadRayPixel[(x / 2) + ((y / 2) * numQuadsX)];
+			if (lightDotNormals[pixel] == 0.0f || pixel == quadPixel) {
+				continue;
+			}
+
+			if (nodesVisited < shadowRayTileNodeBudget) {
+				inShadow[pixel] = TraceRayAnyHit(bvh, MakeRay(rayOrigins[pixel], shadowRayConstants.lightPosition - rayOrigins[pixel]), 1.0f, &nodesVisited);
+				raysTraced++;
+			}
+			else {
+				inShadow[pixel] = inShadow[quadPixel];
+				raysReused++;
+			}
+		}
+	}
+
+	for (int y = 0; y < tileHeight; y++)
+	{
+		for (int x = 0; x < tileWidth; x++)
+		{
+			int pixel = x + (y * tileWidth);
+			if (inShadow[pixel]) {
+				DarkenShadowedPixel(imageData, imageWidth, scissorMin.x + x, scissorMin.y + y, lightDotNormals[pixel], 1.0f);
+			}
+		}
+	}
+
+	// Set rather than added, the ray cast render mode never resets these like RasterizeTile does.
+	fragmentCounters.shadowRaysTraced = raysTraced;
+	fragmentCounters.shadowRaysReused = raysReused;
+}
+
+void TraceShadowsInTiles(std::vector<unsigned char>& imageData, const std::vector<float>& imageDepthData, int imageWidth, int imageHeight,
+	const BVH& bvh, const DrawConstants& drawConstants, RenderTileGrid& tileGrid, ThreadPool& threadPool) {
+
+	PROFILE_FUNCTION();
+
+	ShadowRayConstants shadowRayConstants = ComputeShadowRayConstants(drawConstants);
+
+	// Tiles only write their own pixels, the neighbours they read across the tile edge are depth, which nothing here writes.
+	threadPool.ParallelFor(tileGrid.numTiles.x * tileGrid.numTiles.y, [&](int tileIndex) {
+
+		Vector2Int tileCoords = { tileIndex % tileGrid.numTiles.x, tileIndex / tileGrid.numTiles.x };
+		Vector2Int scissorMin = tileCoords * renderTileSize;
+		Vector2Int scissorMax = { std::min(scissorMin.x + renderTileSize, imageWidth) - 1, std::min(scissorMin.y + renderTileSize, imageHeight) - 1 };
+
+		TraceShadowsForTile(imageData, imageDepthData, imageWidth, imageHeight, bvh, shadowRayConstants, scissorMin, scissorMax, tileGrid.shadowScratchInTile[tileIndex], tileGrid.fragmentCountersInTile[tileIndex]);
+	});
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <queue>
+#include <cfloat>
 
 #include "Instrumentor.h"
 
@@ -8,6 +9,12 @@
 
 #include "WorldConstants.h"
 #include "Model.h"
+#include "PixelKernelsSIMD.h"
+#include "PolygonClipper.h"
+#include "HiZBuffer.h"
+#include "VisibilityBuffer.h"
+#include "DepthSort.h"
+#include "OcclusionCulling.h"
 
 float LerpFloat(const float& a, const float& b, const float& t) {
 	return ((1 - t) * a) + b * t;
@@ -116,6 +123,17 @@ void DrawLineSegmentOnScreen(std::vector<unsigned char>& imageData, int imageWid
 	}
 }
 
+// A clipped triangle that is ready to be rasterized, with everything the pixel stage needs to interpolate across it.
+struct ScreenSpaceTriangle {
+
+	Triangle triangle;
+	Vector3 lightDotTriangleNormals;
+	Vector3 invDepth;
+	Vector3 invW;
+	int textureIndex;
+	unsigned int pixelFeatures;		// See GetMeshPixelFeatures.
+};
+
 struct PixelRenderingData {
 
 	const Vector3& lightDotTriangleNormals;
@@ -125,117 +143,229 @@ struct PixelRenderingData {
 	const Vector3& invW; const Vector3& texWs;
 	//Mat3x3& vertexWorldPositions;
 	const Triangle& curTriangle;
-	const float& colourTextureMixFactor;
-	const Colour& fixedColour; bool drawFixedColour;
+	const Colour& fixedColour;
 	const Texture* curTex;
+	const Vector2Int& scissorMin; const Vector2Int& scissorMax;	// inclusive pixel range this draw is allowed to write to.
+	FragmentCounters& fragmentCounters;
 };
 
-void DrawCurrentPixelWithInterpValues(const float& imageWidth, const float& x, const float& y, const PixelRenderingData& prd, std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData) {
+// Shades one pixel that is already known to be visible, nothing is depth tested or written to the depth buffer.
+// Only what pixelFeatures asks for is interpolated, see ShadePixelBlockSSE for the block version.
+template<unsigned int pixelFeatures>
+void ShadePixelWithBarycentrics(const float& imageWidth, const Vector2Int& curPoint, const float& alpha, const float& beta, const float& gamma, const PixelRenderingData& prd, std::vector<unsigned char>& imageData) {
 
-	//std::cout << "Stuck 4" << std::endl;
+	const bool textured = (pixelFeatures & PIXEL_FEATURE_TEXTURED) != 0;
+	const bool vertexColour = (pixelFeatures & PIXEL_FEATURE_VERTEX_COLOUR) != 0;
+	const bool lit = (pixelFeatures & PIXEL_FEATURE_LIT) != 0;
+	const bool fixedColour = (pixelFeatures & PIXEL_FEATURE_FIXED_COLOUR) != 0;
 
-	Vector2Int curPoint = Vector2Int{ round(x), round(y) };
-	Vector2 curPointFloat = Vector2{ x + 0.5f, y + 0.5f };
+	int index = GetRedFlattenedImageDataSlotForPixel(curPoint, imageWidth);
 
-	float crossAFloat = ((curPointFloat.x * prd.deltaY.x) - (curPointFloat.y * prd.deltaX.x)) + prd.deltaK.x;
-	float crossBFloat = ((curPointFloat.x * prd.deltaY.y) - (curPointFloat.y * prd.deltaX.y)) + prd.deltaK.y;
-	float crossCFloat = ((curPointFloat.x * prd.deltaY.z) - (curPointFloat.y * prd.deltaX.z)) + prd.deltaK.z;
+	if (fixedColour && !lit) {
+		imageData[index + 0] = prd.fixedColour.r;
+		imageData[index + 1] = prd.fixedColour.g;
+		imageData[index + 2] = prd.fixedColour.b;
+		imageData[index + 3] = 255;
+		return;
+	}
 
-	float alpha = crossAFloat / prd.areaOfTriangle;
-	float beta = crossBFloat / prd.areaOfTriangle;
-	float gamma = crossCFloat / prd.areaOfTriangle;
+	float texW = 1.0f / ((alpha * prd.texWs.x) + (beta * prd.texWs.y) + (gamma * prd.texWs.z));
 
-	//std::cout << "alpha := " << alpha << ", beta := " << beta << ", gamma := " << gamma << std::endl;
+	float r = 0.0f, g = 0.0f, b = 0.0f;
+	if (fixedColour) {
+		r = prd.fixedColour.r;
+		g = prd.fixedColour.g;
+		b = prd.fixedColour.b;
+	}
+	else if (textured) {
+		Vector2 texCoord = (alpha * prd.curTriangle.a.texCoord) + (beta * prd.curTriangle.b.texCoord) + (gamma * prd.curTriangle.c.texCoord);
+		texCoord *= texW;
+
+		Colour texelColour = GetColourFromTexCoord(*(prd.curTex), texCoord);
+		r = texelColour.r;
+		g = texelColour.g;
+		b = texelColour.b;
+	}
+
+	if (vertexColour) {
+		// Vertex colours were divided by w at the vertices, so they're multiplied back by the interpolated w like everything else.
+		Vector4 curColour = (alpha * prd.curTriangle.a.colour) + (beta * prd.curTriangle.b.colour) + (gamma * prd.curTriangle.c.colour);
+		curColour *= texW;
+
+		if (textured) {
+			r = ((1.0f - colourTextureMixFactor) * r + (colourTextureMixFactor * curColour.r));
+			g = ((1.0f - colourTextureMixFactor) * g + (colourTextureMixFactor * curColour.g));
+			b = ((1.0f - colourTextureMixFactor) * b + (colourTextureMixFactor * curColour.b));
+		}
+		else {
+			r = curColour.r;
+			g = curColour.g;
+			b = curColour.b;
+		}
+	}
+
+	if (lit) {
+		float lightDotTriangleNormal = (alpha * prd.lightDotTriangleNormals.x) + (beta * prd.lightDotTriangleNormals.y) + (gamma * prd.lightDotTriangleNormals.z);
+		lightDotTriangleNormal *= texW;
+
+		r *= lightDotTriangleNormal;
+		g *= lightDotTriangleNormal;
+		b *= lightDotTriangleNormal;
+	}
+
+	imageData[index + 0] = r;
+	imageData[index + 1] = g;
+	imageData[index + 2] = b;
+	imageData[index + 3] = 255;
+}
+
+// Depth tests and shades one pixel once its barycentric weights are known, curPoint has to already lie inside the scissor.
+// Only depth is interpolated before the test, everything else waits until the pixel is known to be visible. Returns whether it passed.
+template<unsigned int pixelFeatures>
+bool DrawPixelWithBarycentrics(const float& imageWidth, const Vector2Int& curPoint, const float& alpha, const float& beta, const float& gamma, const PixelRenderingData& prd, std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData) {
 
 	float calcDepth = 1.0f / ((alpha * prd.invDepth.x) + (beta * prd.invDepth.y) + (gamma * prd.invDepth.z));
 
 	int depthDataIndex = GetFlattenedImageDataSlotForDepthData(curPoint, imageWidth);
 
-	if (depthDataIndex >= 0 && depthDataIndex < imageDepthData.size() && imageDepthData[depthDataIndex] < calcDepth)
-	{
-		imageDepthData[depthDataIndex] = calcDepth;
-		//std::cout << "Pixel has passed depth test." << std::endl;
-		{
-			//std::cout << "Ready to draw pixel." << std::endl;
-			int index = GetRedFlattenedImageDataSlotForPixel(curPoint, imageWidth);
-			if (index >= 0 && (index + 3) < imageData.size())
-			{
-				float w = 1.0f / ((alpha * prd.invW.x) + (beta * prd.invW.y) + (gamma * prd.invW.z));
-				float texW = 1.0f / ((alpha * prd.texWs.x) + (beta * prd.texWs.y) + (gamma * prd.texWs.z));
+	if (imageDepthData[depthDataIndex] >= calcDepth) {
+		prd.fragmentCounters.fragmentsKilledByDepth++;
+		return false;
+	}
 
-				Vector2 texCoord = (alpha * prd.curTriangle.a.texCoord) + (beta * prd.curTriangle.b.texCoord) + (gamma * prd.curTriangle.c.texCoord);
-				texCoord *= texW;
+	imageDepthData[depthDataIndex] = calcDepth;
+	if (pixelFeatures & PIXEL_FEATURE_DEPTH_ONLY) {
+		return true;
+	}
 
-				Vector3 normal = (alpha * prd.curTriangle.a.normal) + (beta * prd.curTriangle.b.normal) + (gamma * prd.curTriangle.c.normal);
-				normal *= texW;
+	prd.fragmentCounters.fragmentsShaded++;
+	ShadePixelWithBarycentrics<pixelFeatures>(imageWidth, curPoint, alpha, beta, gamma, prd, imageData);
+	return true;
 
-				//Vector3 worldPositionOfFragment = (alpha * GetVector3FromMat3x3(prd.vertexWorldPositions, 0)) + (beta * GetVector3FromMat3x3(prd.vertexWorldPositions, 1)) + (gamma * GetVector3FromMat3x3(prd.vertexWorldPositions, 2));
-				//worldPositionOfFragment *= texW;
+	//else if(depthDataIndex >= 0 && depthDataIndex < imageDepthData.size()){
+	//	std::cout << "Failed test calculated depth := " << depth << ", Existing depth := " << imageDepthData[depthDataIndex] << std::endl;
+	//}
 
-				float lightDotTriangleNormal = (alpha * prd.lightDotTriangleNormals.x) + (beta * prd.lightDotTriangleNormals.y) + (gamma * prd.lightDotTriangleNormals.z);
-				lightDotTriangleNormal *= texW;
+}
 
-				//Vector4 curColour = (alpha * ColourToVector4(curTriangle.a.colour) * invW.x) + (beta * ColourToVector4(curTriangle.b.colour) * invW.y) + (gamma * ColourToVector4(curTriangle.c.colour) * invW.z);
-				Vector4 curColour = (alpha * prd.curTriangle.a.colour) + (beta * prd.curTriangle.b.colour) + (gamma * prd.curTriangle.c.colour);
-				curColour *= texW;
+// Visibility buffer raster pass, depth tests one pixel and only stores which triangle won it.
+bool DrawVisibilityPixelWithBarycentrics(const float& imageWidth, const Vector2Int& curPoint, const float& alpha, const float& beta, const float& gamma, const PixelRenderingData& prd,
+	unsigned int visibilityID, std::vector<unsigned int>& visibilityData, std::vector<float>& imageDepthData) {
 
-				//curColour = { 255, 255, 255, 255 };
+	float calcDepth = 1.0f / ((alpha * prd.invDepth.x) + (beta * prd.invDepth.y) + (gamma * prd.invDepth.z));
 
-				//std::cout << "Drawing pixel." << std::endl;
+	int depthDataIndex = GetFlattenedImageDataSlotForDepthData(curPoint, imageWidth);
 
-				//Colour texelColour = GetColourFromTexCoord(*curTex, curTexCoord);
-				//Colour texelColour = colourTextureMixFactor < 1.0f ? GetColourFromTexCoord(*curTex, texCoord) : colour_black;
-				Colour texelColour = GetColourFromTexCoord(*(prd.curTex), texCoord);
-				float r = ((1.0f - prd.colourTextureMixFactor) * texelColour.r + (prd.colourTextureMixFactor * curColour.r));
-				float g = ((1.0f - prd.colourTextureMixFactor) * texelColour.g + (prd.colourTextureMixFactor * curColour.g));
-				float b = ((1.0f - prd.colourTextureMixFactor) * texelColour.b + (prd.colourTextureMixFactor * curColour.b));
+	if (imageDepthData[depthDataIndex] >= calcDepth) {
+		prd.fragmentCounters.fragmentsKilledByDepth++;
+		return false;
+	}
 
-				//r = texCoord.x * 255;
-				//g = texCoord.y * 255;
-				//b = 0;
+	imageDepthData[depthDataIndex] = calcDepth;
+	visibilityData[depthDataIndex] = visibilityID;
+	return true;
+}
 
-				//imageData[index + 0] = r;
-				//imageData[index + 1] = g;
-				//imageData[index + 2] = b;
-				//imageData[index + 3] = 255;
+// The instantiations of the pixel functions for one combination of PixelFeature flags, picked once per triangle by GetPixelPipeline
+// so the rasterizer's inner loops never look at the features themselves.
+struct PixelPipeline {
 
-				//imageData[index + 0] = 255 * normal.x;
-				//imageData[index + 1] = 255 * normal.y;
-				//imageData[index + 2] = 255 * normal.z;
-				//imageData[index + 3] = 255;
+	bool (*drawPixel)(const float& imageWidth, const Vector2Int& curPoint, const float& alpha, const float& beta, const float& gamma, const PixelRenderingData& prd, std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData);
+	void (*shadePixel)(const float& imageWidth, const Vector2Int& curPoint, const float& alpha, const float& beta, const float& gamma, const PixelRenderingData& prd, std::vector<unsigned char>& imageData);
+	bool (*drawPixelBlockSSE)(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, unsigned char* colourOut, float* depthOut, FragmentCounters& fragmentCounters);
+	bool (*drawPixelBlockAVX2)(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, unsigned char* colourOut, float* depthOut, FragmentCounters& fragmentCounters);
+	void (*shadePixelBlockWithMaskSSE)(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, const int laneMask[4], unsigned char* colourOut);
+	void (*shadePixelBlockWithMaskAVX2)(const PixelBlockRenderingData& pbd, const Vector3Int& edgeAtFirstPixel, const int laneMask[8], unsigned char* colourOut);
+};
 
-				//Vector3 lightPos = { 5.0f, -10.0f, -5.0f };
-				//Vector3 lightDirFromFragment = glm::normalize(lightPos - worldPositionOfFragment);
-				//float lightDotTriangleNormal = glm::max(glm::dot(lightDirFromFragment, normal), 0.1f);
+template<unsigned int pixelFeatures>
+PixelPipeline MakePixelPipeline() {
+	return PixelPipeline{
+		DrawPixelWithBarycentrics<pixelFeatures>, ShadePixelWithBarycentrics<pixelFeatures>,
+		DrawPixelBlockSSE<pixelFeatures>, DrawPixelBlockAVX2<pixelFeatures>,
+		ShadePixelBlockWithMaskSSE<pixelFeatures>, ShadePixelBlockWithMaskAVX2<pixelFeatures>
+	};
+}
 
-				//imageData[index + 0] = 255 * calcDepth;
-				//imageData[index + 1] = 255 * calcDepth;
-				//imageData[index + 2] = 255 * calcDepth;
-				//imageData[index + 3] = 255;
+// Only the combinations GetMeshPixelFeatures can hand out (and depth only) are instantiated.
+PixelPipeline GetPixelPipeline(unsigned int pixelFeatures) {
 
-				imageData[index + 0] = r * lightDotTriangleNormal;
-				imageData[index + 1] = g * lightDotTriangleNormal;
-				imageData[index + 2] = b * lightDotTriangleNormal;
-				imageData[index + 3] = 255;
+	switch (pixelFeatures)
+	{
+	case PIXEL_FEATURE_TEXTURED | PIXEL_FEATURE_LIT:
+		return MakePixelPipeline<PIXEL_FEATURE_TEXTURED | PIXEL_FEATURE_LIT>();
+	case PIXEL_FEATURE_TEXTURED:
+		return MakePixelPipeline<PIXEL_FEATURE_TEXTURED>();
+	case PIXEL_FEATURE_TEXTURED | PIXEL_FEATURE_VERTEX_COLOUR | PIXEL_FEATURE_LIT:
+		return MakePixelPipeline<PIXEL_FEATURE_TEXTURED | PIXEL_FEATURE_VERTEX_COLOUR | PIXEL_FEATURE_LIT>();
+	case PIXEL_FEATURE_TEXTURED | PIXEL_FEATURE_VERTEX_COLOUR:
+		return MakePixelPipeline<PIXEL_FEATURE_TEXTURED | PIXEL_FEATURE_VERTEX_COLOUR>();
+	case PIXEL_FEATURE_VERTEX_COLOUR | PIXEL_FEATURE_LIT:
+		return MakePixelPipeline<PIXEL_FEATURE_VERTEX_COLOUR | PIXEL_FEATURE_LIT>();
+	case PIXEL_FEATURE_VERTEX_COLOUR:
+		return MakePixelPipeline<PIXEL_FEATURE_VERTEX_COLOUR>();
+	case PIXEL_FEATURE_FIXED_COLOUR | PIXEL_FEATURE_LIT:
+		return MakePixelPipeline<PIXEL_FEATURE_FIXED_COLOUR | PIXEL_FEATURE_LIT>();
+	case PIXEL_FEATURE_FIXED_COLOUR:
+		return MakePixelPipeline<PIXEL_FEATURE_FIXED_COLOUR>();
+	case PIXEL_FEATURE_DEPTH_ONLY:
+		return MakePixelPipeline<PIXEL_FEATURE_DEPTH_ONLY>();
+	default:
+		// Anything else would read something the triangle may not have, the flat colour is always there.
+		return MakePixelPipeline<PIXEL_FEATURE_FIXED_COLOUR | PIXEL_FEATURE_LIT>();
+	}
+}
 
-				//imageData[index + 0] = 255 * lightDotTriangleNormal;
-				//imageData[index + 1] = 255 * lightDotTriangleNormal;
-				//imageData[index + 2] = 255 * lightDotTriangleNormal;
-				//imageData[index + 3] = 255;
+// When false every mesh is drawn as if its material were unlit, to compare the unlit pixel functions with the lit ones.
+bool useLighting = true;
 
-				if (prd.drawFixedColour) {
-					imageData[index + 0] = prd.fixedColour.r;
-					imageData[index + 1] = prd.fixedColour.g;
-					imageData[index + 2] = prd.fixedColour.b;
-					imageData[index + 3] = 255;
-				}
-			}
-		}
+// Worked out once per mesh. Vertex colours are only interpolated when they can change the result, a textured mesh ignores them
+// while colourTextureMixFactor is 0, and a mesh with neither a texture nor vertex colours is drawn with its triangles' flat colour.
+unsigned int GetMeshPixelFeatures(const Mesh& mesh) {
+
+	unsigned int pixelFeatures = 0;
+
+	bool textured = mesh.textureIndex >= 0 && mesh.textureIndex < Model::textures.size();
+	if (textured) {
+		pixelFeatures |= PIXEL_FEATURE_TEXTURED;
+	}
+	if (mesh.hasVertexColours && (!textured || colourTextureMixFactor > 0.0f)) {
+		pixelFeatures |= PIXEL_FEATURE_VERTEX_COLOUR;
+	}
+	if (!(pixelFeatures & (PIXEL_FEATURE_TEXTURED | PIXEL_FEATURE_VERTEX_COLOUR))) {
+		pixelFeatures |= PIXEL_FEATURE_FIXED_COLOUR;
+	}
+	if (mesh.isLit && useLighting) {
+		pixelFeatures |= PIXEL_FEATURE_LIT;
 	}
-	//else if(depthDataIndex >= 0 && depthDataIndex < imageDepthData.size()){
-	//	std::cout << "Failed test calculated depth := " << depth << ", Existing depth := " << imageDepthData[depthDataIndex] << std::endl;
-	//}
 
+	return pixelFeatures;
+}
+
+// Only the Bresenham rasterizer still draws one pixel at a time from float positions, through the triangle's pipeline like the tile walker does.
+void DrawCurrentPixelWithInterpValues(const float& imageWidth, const float& x, const float& y, const PixelRenderingData& prd, const PixelPipeline& pipeline, std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData) {
+
+	//std::cout << "Stuck 4" << std::endl;
+
+	Vector2Int curPoint = Vector2Int{ round(x), round(y) };
+
+	if (curPoint.x < prd.scissorMin.x || curPoint.x > prd.scissorMax.x || curPoint.y < prd.scissorMin.y || curPoint.y > prd.scissorMax.y) {
+		return;
+	}
+
+	Vector2 curPointFloat = Vector2{ x + 0.5f, y + 0.5f };
+
+	float crossAFloat = ((curPointFloat.x * prd.deltaY.x) - (curPointFloat.y * prd.deltaX.x)) + prd.deltaK.x;
+	float crossBFloat = ((curPointFloat.x * prd.deltaY.y) - (curPointFloat.y * prd.deltaX.y)) + prd.deltaK.y;
+	float crossCFloat = ((curPointFloat.x * prd.deltaY.z) - (curPointFloat.y * prd.deltaX.z)) + prd.deltaK.z;
+
+	float alpha = crossAFloat / prd.areaOfTriangle;
+	float beta = crossBFloat / prd.areaOfTriangle;
+	float gamma = crossCFloat / prd.areaOfTriangle;
+
+	//std::cout << "alpha := " << alpha << ", beta := " << beta << ", gamma := " << gamma << std::endl;
+
+	pipeline.drawPixel(imageWidth, curPoint, alpha, beta, gamma, prd, imageData, imageDepthData);
 }
 
 void BresenhamLineDrawer(Vector2 start, Vector2 end, std::vector<Vector2>& outputPixels) {
@@ -256,7 +386,8 @@ void BresenhamLineDrawer(Vector2 start, Vector2 end, std::vector<Vector2>& outpu
 	}
 }
 
-void BresenhamTriangleDrawer(const Vector3& c, const Vector3& b, const Vector3& d, const float& imageWidth, PixelRenderingData& prd , std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData) {
+// Legacy scanline path, pixels are drawn with the pipeline DrawTriangleOnScreenFromScreenSpaceBresenhamMethod picked for the triangle.
+void BresenhamTriangleDrawer(const Vector3& c, const Vector3& b, const Vector3& d, const float& imageWidth, PixelRenderingData& prd, const PixelPipeline& pipeline, std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData) {
 
 	std::vector<Vector2> outputPixelsCB;
 	BresenhamLineDrawer(c, b, outputPixelsCB);
@@ -272,22 +403,22 @@ void BresenhamTriangleDrawer(const Vector3& c, const Vector3& b, const Vector3&
 		int x1 = outputPixelsCD[indexPointCD].x;
 
 		int curYCB = outputPixelsCB[indexPointCB].y;
-		while (curYCB == outputPixelsCB[indexPointCB].y) {
+		while (indexPointCB < outputPixelsCB.size() && curYCB == outputPixelsCB[indexPointCB].y) {
 			//DrawCurrentPixelWithInterpValues(imageWidth, outputPixelsCB[indexPointCB].x, outputPixelsCB[indexPointCB].y, lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, vertexWorldPositions, triangle, colourTextureMixFactor, colour_blue, false, curTex, imageData, imageDepthData);
 			//prd.drawFixedColour = true;
 			//prd.drawFixedColour = false;
 			//prd.fixedColour = colour_blue;
-			DrawCurrentPixelWithInterpValues(imageWidth, outputPixelsCB[indexPointCB].x, outputPixelsCB[indexPointCB].y, prd, imageData, imageDepthData);
+			DrawCurrentPixelWithInterpValues(imageWidth, outputPixelsCB[indexPointCB].x, outputPixelsCB[indexPointCB].y, prd, pipeline, imageData, imageDepthData);
 			indexPointCB++;
 		}
 
 		int curYCD = outputPixelsCD[indexPointCD].y;
-		while (curYCB == curYCD && curYCD == outputPixelsCD[indexPointCD].y) {
+		while (indexPointCD < outputPixelsCD.size() && curYCB == curYCD && curYCD == outputPixelsCD[indexPointCD].y) {
 			//DrawCurrentPixelWithInterpValues(imageWidth, outputPixelsCD[indexPointCD].x, outputPixelsCD[indexPointCD].y, lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, vertexWorldPositions, triangle, colourTextureMixFactor, colour_red, false, curTex, imageData, imageDepthData);
 			//prd.drawFixedColour = true;
 			//prd.drawFixedColour = false;
 			//prd.fixedColour = colour_red;
-			DrawCurrentPixelWithInterpValues(imageWidth, outputPixelsCD[indexPointCD].x, outputPixelsCD[indexPointCD].y, prd, imageData, imageDepthData);
+			DrawCurrentPixelWithInterpValues(imageWidth, outputPixelsCD[indexPointCD].x, outputPixelsCD[indexPointCD].y, prd, pipeline, imageData, imageDepthData);
 			indexPointCD++;
 		}
 
@@ -299,12 +430,19 @@ void BresenhamTriangleDrawer(const Vector3& c, const Vector3& b, const Vector3&
 			std::cout << x0 << ", " << x1 << std::endl;
 		}
 
+		if (curYCB < prd.scissorMin.y || curYCB > prd.scissorMax.y) {
+			continue;
+		}
+
+		x0 = std::max(x0, prd.scissorMin.x);
+		x1 = std::min(x1, prd.scissorMax.x + 1);
+
 		//prd.drawFixedColour = false;
 
 		// No need to draw last pixel because the next triangle with the same points and edge to the left will draw it anyway?
 		for (int x = x0; x < x1; x++) {
 			//DrawCurrentPixelWithInterpValues(imageWidth, x, curYCB, lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, vertexWorldPositions, triangle, colourTextureMixFactor, colour_green, false, curTex, imageData, imageDepthData);
-			DrawCurrentPixelWithInterpValues(imageWidth, x, curYCB, prd, imageData, imageDepthData);
+			DrawCurrentPixelWithInterpValues(imageWidth, x, curYCB, prd, pipeline, imageData, imageDepthData);
 		}
 
 	}
@@ -312,7 +450,7 @@ void BresenhamTriangleDrawer(const Vector3& c, const Vector3& b, const Vector3&
 
 // Slower and unstable.
 void BresenhamTriangleDrawerAdvanced(const Vector2& c, const Vector2& b, const Vector2& d,
-									const float& imageWidth, const PixelRenderingData& prd, std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData)
+									const float& imageWidth, const PixelRenderingData& prd, const PixelPipeline& pipeline, std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData)
 {
 
 	float startY = round(c.y);
@@ -361,7 +499,7 @@ void BresenhamTriangleDrawerAdvanced(const Vector2& c, const Vector2& b, const V
 
 				//pixelsToDraw.push_back({(float)round(curXCB), (float)(round(curYCB))});
 				//DrawCurrentPixelWithInterpValues(imageWidth, curXCB, curYCB, lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, vertexWorldPositions, triangle, colourTextureMixFactor, colour_red, false, curTex, imageData, imageDepthData);
-				DrawCurrentPixelWithInterpValues(imageWidth, curXCB, curYCB, prd, imageData, imageDepthData);
+				DrawCurrentPixelWithInterpValues(imageWidth, curXCB, curYCB, prd, pipeline, imageData, imageDepthData);
 
 				curXCB = round(startXCB + (indexStepCB * stepXCB));
 				curYCB = round(startY + (indexStepCB * stepYCB));
@@ -374,7 +512,7 @@ void BresenhamTriangleDrawerAdvanced(const Vector2& c, const Vector2& b, const V
 
 				//pixelsToDraw.push_back({(float)round(curXCD), (float)(round(curYCD))});
 				//DrawCurrentPixelWithInterpValues(imageWidth, curXCD, curYCD, lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, vertexWorldPositions, triangle, colourTextureMixFactor, colour_red, false, curTex, imageData, imageDepthData);
-				DrawCurrentPixelWithInterpValues(imageWidth, curXCD, curYCD, prd, imageData, imageDepthData);
+				DrawCurrentPixelWithInterpValues(imageWidth, curXCD, curYCD, prd, pipeline, imageData, imageDepthData);
 
 				curXCD = round(startXCD + (indexStepCD * stepXCD));
 				curYCD = round(startY + (indexStepCD * stepYCD));
@@ -388,7 +526,7 @@ void BresenhamTriangleDrawerAdvanced(const Vector2& c, const Vector2& b, const V
 			for (int x = x0; x <= x1; x++) {
 				//pixelsToDraw.push_back({ (float)x, (float)curY });
 				//DrawCurrentPixelWithInterpValues(imageWidth, x, curY, lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, vertexWorldPositions, triangle, colourTextureMixFactor, colour_red, false, curTex, imageData, imageDepthData);
-				DrawCurrentPixelWithInterpValues(imageWidth, x, curY, prd, imageData, imageDepthData);
+				DrawCurrentPixelWithInterpValues(imageWidth, x, curY, prd, pipeline, imageData, imageDepthData);
 			}
 
 			curY += dir;
@@ -407,6 +545,16 @@ bool IsLineTopOrLeft(Vector2Int start, Vector2Int end) {
 	return isTopEdge || isLeftEdge;
 }
 
+bool IsLineTopOrLeft(Vector2 start, Vector2 end) {
+
+	Vector2 edge = end - start;
+
+	bool isTopEdge = edge.y == 0 && edge.x > 0;
+	bool isLeftEdge = edge.y < 0;
+
+	return isTopEdge || isLeftEdge;
+}
+
 void DrawCurrentTrianglePixel(const float& imageWidth,
 	const float& x, const float& y,
 	const Vector3& lightDotTriangleNormals,
@@ -436,15 +584,18 @@ void DrawCurrentTrianglePixel(const float& imageWidth,
 
 	float depth = 1.0f / ((alpha * invDepth.x) + (beta * invDepth.y) + (gamma * invDepth.z));
 
-	float w = 1.0f / ((alpha * invW.x) + (beta * invW.y) + (gamma * invW.z));
+	int depthDataIndex = GetFlattenedImageDataSlotForDepthData(curPoint, imageWidth);
+
+	// Nothing but depth is interpolated until the pixel is known to be visible.
+	if (depthDataIndex < 0 || depthDataIndex >= imageDepthData.size() || imageDepthData[depthDataIndex] >= depth) {
+		return;
+	}
+
 	float texW = 1.0f / ((alpha * texWs.x) + (beta * texWs.y) + (gamma * texWs.z));
 
 	Vector2 texCoord = (alpha * curTriangle.a.texCoord) + (beta * curTriangle.b.texCoord) + (gamma * curTriangle.c.texCoord);
 	texCoord *= texW;
 
-	Vector3 normal = (alpha * curTriangle.a.normal) + (beta * curTriangle.b.normal) + (gamma * curTriangle.c.texCoord);
-	normal *= texW;
-
 	//std::cout << lightDotTriangleNormals.x << ", " << lightDotTriangleNormals.y << ", " << lightDotTriangleNormals.z << std::endl;
 
 	float lightDotTriangleNormal = (alpha * lightDotTriangleNormals.x) + (beta * lightDotTriangleNormals.y) + (gamma * lightDotTriangleNormals.z);
@@ -454,14 +605,9 @@ void DrawCurrentTrianglePixel(const float& imageWidth,
 
 	//std::cout << curTriangle.a.normal.x << ", " << curTriangle.a.normal.y << ", " << curTriangle.a.normal.z << std::endl;
 
-	//std::cout << normal.x << ", " << normal.y << ", " << normal.z << std::endl;
-
 	Vector4 curColour = (alpha * curTriangle.a.colour) + (beta * curTriangle.b.colour) + (gamma * curTriangle.c.colour);
 	//curColour *= texW;
 
-	int depthDataIndex = GetFlattenedImageDataSlotForDepthData(curPoint, imageWidth);
-
-	if (depthDataIndex >= 0 && depthDataIndex < imageDepthData.size() && imageDepthData[depthDataIndex] < depth)
 	{
 		//std::cout << "Pixel has passed depth test." << std::endl;
 		float cutOffValueFloat = 1.0f;
@@ -529,11 +675,12 @@ int printCounter = 0;
 
 void DrawTriangleOnScreenFromScreenSpaceBresenhamMethod(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData,
 	int imageWidth, int imageHeight,
-	int curTriangleIndex, int currentTextureIndex,
+	int curTriangleIndex, int currentTextureIndex, unsigned int pixelFeatures,
 	const Triangle& drawTriangle, Vector3 lightDotTriangleNormals,
 	//Mat3x3& vertexWorldPositions,
 	Vector3 invDepth, Vector3 invW,
-	int lineThickness)
+	int lineThickness,
+	const Vector2Int& scissorMin, const Vector2Int& scissorMax)
 {
 	PROFILE_FUNCTION();
 
@@ -568,14 +715,15 @@ void DrawTriangleOnScreenFromScreenSpaceBresenhamMethod(std::vector<unsigned cha
 	//float areaOfTriangle = (cFloat.x * aFloat.y - aFloat.x * cFloat.y) * 0.5f;
 	float areaOfTriangle = EdgeFunction(triangle.a.position, triangle.b.position, triangle.c.position) * 0.5f;
 
-	Texture* curTex = &Model::textures[currentTextureIndex];
+	// A texture index that isn't there draws the flat colour instead of reading past Model::textures.
+	if (currentTextureIndex < 0 || currentTextureIndex >= Model::textures.size()) {
+		pixelFeatures &= ~PIXEL_FEATURE_TEXTURED;
+	}
+	Texture* curTex = (pixelFeatures & PIXEL_FEATURE_TEXTURED) ? &Model::textures[currentTextureIndex] : nullptr;
+	PixelPipeline pipeline = GetPixelPipeline(pixelFeatures);
 
 	int divisionPointY = triangle.b.position.y;
 
-	float colourTextureMixFactor = 0.0f;
-	//colourTextureMixFactor = 1.0f;
-	//colourTextureMixFactor = 0.5f;
-
 	Vector3 texW = { triangle.a.texCoord.z, triangle.b.texCoord.z, triangle.c.texCoord.z };
 
 	float deltaYA = triangle.c.position.y - triangle.b.position.y;
@@ -603,28 +751,31 @@ void DrawTriangleOnScreenFromScreenSpaceBresenhamMethod(std::vector<unsigned cha
 	float x4 = triangle.c.position.x + ((triangle.b.position.y - triangle.c.position.y) / (triangle.a.position.y - triangle.c.position.y)) * (triangle.a.position.x - triangle.c.position.x);
 	Vector3 d = { x4, triangle.b.position.y, 0.0f };
 
-	PixelRenderingData prd = {lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, /*vertexWorldPositions,*/ triangle, colourTextureMixFactor, colour_blue, false, curTex};
+	// This path isn't used by the tile renderer, its counts are dropped.
+	FragmentCounters fragmentCounters;
+
+	PixelRenderingData prd = {lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, /*vertexWorldPositions,*/ triangle, triangle.colour, curTex, scissorMin, scissorMax, fragmentCounters};
 
 	if (round(triangle.a.position.y) == round(triangle.b.position.y)) {
 		//BresenhamTriangleDrawer(triangle.c.position, triangle.a.position, triangle.b.position, imageWidth, lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, vertexWorldPositions, triangle, colourTextureMixFactor, colour_red, false, curTex, imageData, imageDepthData);
-		BresenhamTriangleDrawer(triangle.c.position, triangle.a.position, triangle.b.position, imageWidth, prd, imageData, imageDepthData);
+		BresenhamTriangleDrawer(triangle.c.position, triangle.a.position, triangle.b.position, imageWidth, prd, pipeline, imageData, imageDepthData);
 	}
 	else if (round(triangle.c.position.y) == round(triangle.b.position.y)) {
 		//BresenhamTriangleDrawer(triangle.a.position, triangle.c.position, triangle.b.position, imageWidth, lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, vertexWorldPositions, triangle, colourTextureMixFactor, colour_red, false, curTex, imageData, imageDepthData);
-		BresenhamTriangleDrawer(triangle.a.position, triangle.c.position, triangle.b.position, imageWidth, prd, imageData, imageDepthData);
+		BresenhamTriangleDrawer(triangle.a.position, triangle.c.position, triangle.b.position, imageWidth, prd, pipeline, imageData, imageDepthData);
 	}
 	else {
 		{
 			//Top triangle.
 			//BresenhamTriangleDrawer(triangle.c.position, triangle.b.position, d, imageWidth, lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, vertexWorldPositions, triangle, colourTextureMixFactor, colour_red, false, curTex, imageData, imageDepthData);
-			BresenhamTriangleDrawer(triangle.c.position, triangle.b.position, d, imageWidth, prd, imageData, imageDepthData);
+			BresenhamTriangleDrawer(triangle.c.position, triangle.b.position, d, imageWidth, prd, pipeline, imageData, imageDepthData);
 
 		}
 
 		{
 			//Bottom triangle.
 			//BresenhamTriangleDrawer(triangle.a.position, triangle.b.position, d, imageWidth, lightDotTriangleNormals, deltaY, deltaX, deltaK, areaOfTriangle, invDepth, invW, texW, vertexWorldPositions, triangle, colourTextureMixFactor, colour_red, false, curTex, imageData, imageDepthData);
-			BresenhamTriangleDrawer(triangle.a.position, triangle.b.position, d, imageWidth, prd, imageData, imageDepthData);
+			BresenhamTriangleDrawer(triangle.a.position, triangle.b.position, d, imageWidth, prd, pipeline, imageData, imageDepthData);
 		}
 	}
 
@@ -643,604 +794,896 @@ void DrawTriangleOnScreenFromScreenSpaceBresenhamMethod(std::vector<unsigned cha
 }
 
 
-//int TriangleClipAgainstPlane(const Plane& plane, const Triangle& in_tri, Vector3 inLightDotNormal, Mat3x3& interpWorldVertexPositions, std::vector<Triangle>& outputTriangles, std::vector<Vector3>& outLightDotNormal, std::vector<Mat3x3>& outWorldVertexPositions, bool test = false)
-int TriangleClipAgainstPlane(const Plane& plane, const Triangle& in_tri, Vector3 invDepth, Vector3 inLightDotNormal, std::vector<Triangle>& outputTriangles, std::vector<Vector3>& outLightDotNormal, std::vector<Vector3>& invDepths, bool test = false)
+// Rounds a screen space position to the nearest 28.4 fixed point subpixel position.
+Vector2Int SnapToSubpixelGrid(const Vector3& position) {
+	return Vector2Int{ (int)lroundf(position.x * subpixelSteps), (int)lroundf(position.y * subpixelSteps) };
+}
+
+// Everything about a screen space triangle that stays the same across its pixels, worked out once by SetupScreenSpaceTriangle.
+// Shared by the rasterizer and the visibility buffer shading pass, so both see exactly the same edge functions and barycentrics.
+struct TriangleSetup {
+
+	// b and c are swapped when needed, so every triangle has the same winding.
+	Triangle triangle;
+	Vector3 lightDotTriangleNormals;
+	Vector3 invDepth;
+	Vector3 invW;
+	Vector3 texW;
+
+	// Vertices snapped to 28.4 fixed point and the integer edge function setup, see DrawTriangleOnScreenFromScreenSpaceHalfSpaceMethod.
+	Vector2Int a, b, c;
+	Vector3Int deltaY, deltaX;
+	Vector3Int edgeStepX, edgeStepY;
+	Vector3Int edgeInsideThreshold;
+	float invAreaOfTriangle;
+
+	// Only DrawPixelWithBarycentrics reads these through PixelRenderingData, which doesn't use the edge setup, so they just keep it filled in.
+	Vector3 deltaYFloat, deltaXFloat, deltaKFloat;
+	float areaOfTriangle;
+
+	const Texture* curTex;
+	PixelPipeline pipeline;		// Picked from the triangle's pixel features, so nothing per pixel has to look at them.
+
+	PixelBlockRenderingData pbd;
+};
+
+// False when the snapped triangle has no area, there's nothing to draw then.
+bool SetupScreenSpaceTriangle(int currentTextureIndex, unsigned int pixelFeatures, const Triangle& drawTriangle, const Vector3& lightDotTriangleNormals, const Vector3& invDepth, const Vector3& invW, TriangleSetup& setup) {
+
+	setup.triangle = drawTriangle;
+	setup.lightDotTriangleNormals = lightDotTriangleNormals;
+	setup.invDepth = invDepth;
+	setup.invW = invW;
+
+	setup.a = SnapToSubpixelGrid(setup.triangle.a.position);
+	setup.b = SnapToSubpixelGrid(setup.triangle.b.position);
+	setup.c = SnapToSubpixelGrid(setup.triangle.c.position);
+
+	const Vector2Int& a = setup.a;
+	Vector2Int& b = setup.b;
+	Vector2Int& c = setup.c;
+
+	// Same as EdgeFunction(a, b, c) on the snapped positions, in 24.8 fixed point.
+	long long areaOfTriangleFixed = ((long long)(c.x - a.x) * (b.y - a.y)) - ((long long)(c.y - a.y) * (b.x - a.x));
+
+	if (areaOfTriangleFixed == 0) {
+		return false;
+	}
+
+	// Keep every triangle in the same winding so "inside" is always edge >= 0, whichever way it was submitted.
+	if (areaOfTriangleFixed < 0) {
+		std::swap(setup.triangle.b, setup.triangle.c);
+		std::swap(b, c);
+		std::swap(setup.invDepth.y, setup.invDepth.z);
+		std::swap(setup.invW.y, setup.invW.z);
+		std::swap(setup.lightDotTriangleNormals.y, setup.lightDotTriangleNormals.z);
+		areaOfTriangleFixed = -areaOfTriangleFixed;
+	}
+
+	const Triangle& triangle = setup.triangle;
+
+	setup.curTex = (pixelFeatures & PIXEL_FEATURE_TEXTURED) ? &Model::textures[currentTextureIndex] : nullptr;
+	setup.pipeline = GetPixelPipeline(pixelFeatures);
+
+	setup.texW = { triangle.a.texCoord.z, triangle.b.texCoord.z, triangle.c.texCoord.z };
+
+	// Edge A is b -> c, B is c -> a and C is a -> b, so each edge function is the (scaled) barycentric weight of the opposite vertex.
+	setup.deltaY = { c.y - b.y, a.y - c.y, b.y - a.y };
+	setup.deltaX = { c.x - b.x, a.x - c.x, b.x - a.x };
+
+	// Top-left fill rule, a pixel centre exactly on an edge belongs to the triangle only if that edge is a top or left edge.
+	// Triangles sharing an edge see it with opposite directions, so exactly one of them draws those pixels.
+	// Our winding is the reverse of the one IsLineTopOrLeft expects, hence the swapped start and end.
+	// With integer edge values "edge >= 0" is the same as "edge > -1", so the rule turns into a per edge threshold.
+	setup.edgeInsideThreshold = { IsLineTopOrLeft(c, b) ? -1 : 0, IsLineTopOrLeft(a, c) ? -1 : 0, IsLineTopOrLeft(b, a) ? -1 : 0 };
+
+	setup.invAreaOfTriangle = 1.0f / (float)areaOfTriangleFixed;
+
+	setup.deltaYFloat = Vector3(setup.deltaY);
+	setup.deltaXFloat = Vector3(setup.deltaX);
+	setup.deltaKFloat = Vector3(0.0f);
+	setup.areaOfTriangle = (float)areaOfTriangleFixed;
+
+	// A pixel step is 16 subpixels, so the per pixel and per row edge steps are the edge deltas shifted up by subpixelBits.
+	setup.edgeStepX = setup.deltaY * subpixelSteps;
+	setup.edgeStepY = setup.deltaX * subpixelSteps;
+
+	setup.pbd = {
+		{ setup.edgeStepX.x, setup.edgeStepX.y, setup.edgeStepX.z },
+		{ setup.edgeInsideThreshold.x, setup.edgeInsideThreshold.y, setup.edgeInsideThreshold.z },
+		setup.invAreaOfTriangle,
+		{ setup.invDepth.x, setup.invDepth.y, setup.invDepth.z },
+		{ setup.texW.x, setup.texW.y, setup.texW.z },
+		{ triangle.a.texCoord.x, triangle.b.texCoord.x, triangle.c.texCoord.x },
+		{ triangle.a.texCoord.y, triangle.b.texCoord.y, triangle.c.texCoord.y },
+		{ setup.lightDotTriangleNormals.x, setup.lightDotTriangleNormals.y, setup.lightDotTriangleNormals.z },
+		{ triangle.a.colour, triangle.b.colour, triangle.c.colour },
+		setup.curTex, triangle.colour
+	};
+
+	return true;
+}
+
+// Edge functions at the centre of pixel (x, y), evaluated with multiplies in 64 bit. Only used to start walking, after that they're stepped.
+Vector3Int EdgeFunctionsAtPixel(const Vector2Int& a, const Vector2Int& b, const Vector2Int& c, const Vector3Int& deltaY, const Vector3Int& deltaX, int x, int y) {
+
+	Vector2Int pixelCentre = Vector2Int{ (x << subpixelBits) + (subpixelSteps / 2), (y << subpixelBits) + (subpixelSteps / 2) };
+	return Vector3Int{
+		(int)(((long long)(pixelCentre.x - b.x) * deltaY.x) - ((long long)(pixelCentre.y - b.y) * deltaX.x)),
+		(int)(((long long)(pixelCentre.x - c.x) * deltaY.y) - ((long long)(pixelCentre.y - c.y) * deltaX.y)),
+		(int)(((long long)(pixelCentre.x - a.x) * deltaY.z) - ((long long)(pixelCentre.y - a.y) * deltaX.z))
+	};
+}
+
+Vector3Int EdgeFunctionsAtPixel(const TriangleSetup& setup, int x, int y) {
+	return EdgeFunctionsAtPixel(setup.a, setup.b, setup.c, setup.deltaY, setup.deltaX, x, y);
+}
+
+// Walks the triangle's bounding box (clamped to the scissor) and evaluates the three edge functions at every pixel centre.
+// Vertices are snapped to 28.4 fixed point once, after that the edge functions are exact integers that are set up at the first pixel
+// and then stepped with one integer add per pixel and per row. Two triangles sharing an edge snap it to the same integers,
+// so together with the top-left rule every pixel centre along it is drawn exactly once, no gaps and no double blends.
+// Edge values stay inside 32 bits as long as the triangle spans less than 2^11 pixels, which guard band clipping guarantees.
+// The box is walked in Hi-Z tiles, tiles the triangle misses or that are already covered by nearer pixels are skipped whole.
+void DrawTriangleOnScreenFromScreenSpaceHalfSpaceMethod(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, std::vector<unsigned int>& visibilityData,
+	int imageWidth, int imageHeight,
+	int curTriangleIndex, int currentTextureIndex, unsigned int pixelFeatures,
+	const Triangle& drawTriangle, Vector3 lightDotTriangleNormals,
+	Vector3 invDepth, Vector3 invW,
+	const Vector2Int& scissorMin, const Vector2Int& scissorMax, HiZBuffer& hiZ, FragmentCounters& fragmentCounters)
 {
 	PROFILE_FUNCTION();
 
-	float da = DistanceFromPointToPlane(in_tri.a, plane);
-	float db = DistanceFromPointToPlane(in_tri.b, plane);
-	float dc = DistanceFromPointToPlane(in_tri.c, plane);
-
-	if (da > 0.0f && db > 0.0f && dc > 0.0f) {
-		outputTriangles.push_back(in_tri);
-		outLightDotNormal.push_back(inLightDotNormal);
-		invDepths.push_back(invDepth);
-		//outWorldVertexPositions.push_back(interpWorldVertexPositions);
-		return 1;
+	TriangleSetup setup;
+	if (!SetupScreenSpaceTriangle(currentTextureIndex, pixelFeatures, drawTriangle, lightDotTriangleNormals, invDepth, invW, setup)) {
+		return;
 	}
-	if (da < 0.0f && db < 0.0f && dc < 0.0f) {
-		return 0;
+
+	const Vector2Int& a = setup.a;
+	const Vector2Int& b = setup.b;
+	const Vector2Int& c = setup.c;
+
+	// First and last pixel whose centre (x * 16 + 8 in fixed point) lies inside the snapped bounding box.
+	int startX = std::max((std::min(a.x, std::min(b.x, c.x)) - (subpixelSteps / 2) + (subpixelSteps - 1)) >> subpixelBits, scissorMin.x);
+	int startY = std::max((std::min(a.y, std::min(b.y, c.y)) - (subpixelSteps / 2) + (subpixelSteps - 1)) >> subpixelBits, scissorMin.y);
+	int endX = std::min((std::max(a.x, std::max(b.x, c.x)) - (subpixelSteps / 2)) >> subpixelBits, scissorMax.x);
+	int endY = std::min((std::max(a.y, std::max(b.y, c.y)) - (subpixelSteps / 2)) >> subpixelBits, scissorMax.y);
+
+	if (startX > endX || startY > endY) {
+		return;
 	}
 
-	if (da > 0.0f) {
-
-		//first point is a.
-
-		if (db > 0.0f) {
-
-			// second point is b
-
-			// c is divided into two points d and e which are interpolated from a and b to c respectively.
-			Point d;
-			LinePlaneIntersection(in_tri.a.position, in_tri.c.position, plane, d.position);
-			float ld = glm::length(d.position - in_tri.a.position) / glm::length(in_tri.c.position - in_tri.a.position);
-			d.texCoord = LerpVector3(in_tri.a.texCoord, in_tri.c.texCoord, ld);
-			d.colour = LerpVector4(in_tri.a.colour, in_tri.c.colour, ld);
-			d.normal = LerpVector3(in_tri.a.normal, in_tri.c.normal, ld);
-			
-			float dLightNormal = LerpFloat(inLightDotNormal.x, inLightDotNormal.z, ld);
-			//Vector3 dPosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 0), GetVector3FromMat3x3(interpWorldVertexPositions, 2), ld);
-			float dInvDepth = LerpFloat(invDepth.x, invDepth.z, ld);
-
-			Point e;
-			LinePlaneIntersection(in_tri.b.position, in_tri.c.position, plane, e.position);
-			float le = glm::length(e.position - in_tri.b.position) / glm::length(in_tri.c.position - in_tri.b.position);
-			e.texCoord = LerpVector3(in_tri.b.texCoord, in_tri.c.texCoord, le);
-			e.colour = LerpVector4((in_tri.b.colour), (in_tri.c.colour), le);
-			e.normal = LerpVector3((in_tri.b.normal), (in_tri.c.normal), le);
-
-			float eLightNormal = LerpFloat(inLightDotNormal.y, inLightDotNormal.z, le);
-			//Vector3 ePosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 1), GetVector3FromMat3x3(interpWorldVertexPositions, 2), le);
-			float eInvDepth = LerpFloat(invDepth.y, invDepth.z, le);
-
-			// make two triangles := { a, b, d} & {d, b, e}
-			Triangle clippedTriangleABD;
-			clippedTriangleABD.a = in_tri.a;
-			clippedTriangleABD.b = in_tri.b;
-			clippedTriangleABD.c = d;
-
-			//Mat3x3 outWorldPositions1;
-			//SetVector3InMat3x3(outWorldPositions1, 0, GetVector3FromMat3x3(interpWorldVertexPositions, 0));
-			//SetVector3InMat3x3(outWorldPositions1, 1, GetVector3FromMat3x3(interpWorldVertexPositions, 1));
-			//SetVector3InMat3x3(outWorldPositions1, 2, dPosition);
-
-			outLightDotNormal.push_back({ inLightDotNormal.x, inLightDotNormal.y, dLightNormal });
-			//outWorldVertexPositions.push_back(outWorldPositions1);
-			invDepths.push_back({ invDepth.x, invDepth.y, dInvDepth });
-
-			Triangle clippedTriangleDBE;
-			clippedTriangleDBE.a = d;
-			clippedTriangleDBE.b = in_tri.b;
-			clippedTriangleDBE.c = e;
-
-			//Mat3x3 outWorldPositions2;
-			//SetVector3InMat3x3(outWorldPositions2, 0, dPosition);
-			//SetVector3InMat3x3(outWorldPositions2, 1, GetVector3FromMat3x3(interpWorldVertexPositions, 1));
-			//SetVector3InMat3x3(outWorldPositions2, 2, ePosition);
-
-			outLightDotNormal.push_back({ dLightNormal, inLightDotNormal.y, eLightNormal });
-			//outWorldVertexPositions.push_back(outWorldPositions2);
-			invDepths.push_back({ dInvDepth, invDepth.y, eInvDepth });
-
-			outputTriangles.push_back(clippedTriangleABD);
-			outputTriangles.push_back(clippedTriangleDBE);
-			//std::cout << "Two triangles : = { a, b, d } & { d, b, e }" << std::endl;
-
-			return 2; // Since we are making 2 triangles.
-		}
-		if (dc > 0.0f) {
-
-			// second point is C
-
-			// b is divided into two points d and e which are interpolated from a and c to b respectively.
-			Point d;
-			LinePlaneIntersection(in_tri.a.position, in_tri.b.position, plane, d.position);
-			float ld = glm::length(d.position - in_tri.a.position) / glm::length(in_tri.b.position - in_tri.a.position);
-			d.texCoord = LerpVector3(in_tri.a.texCoord, in_tri.b.texCoord, ld);
-			//d.colour = Vector4ToColour(LerpVector4(ColourToVector4(in_tri.a.colour), ColourToVector4(in_tri.b.colour), ld));
-			d.colour = (LerpVector4((in_tri.a.colour), (in_tri.b.colour), ld));
-			d.normal = (LerpVector3((in_tri.a.normal), (in_tri.b.normal), ld));
-
-			float dLightNormal = LerpFloat(inLightDotNormal.x, inLightDotNormal.y, ld);
-			//Vector3 dPosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 0), GetVector3FromMat3x3(interpWorldVertexPositions, 1), ld);
-			float dInvDepth = LerpFloat(invDepth.x, invDepth.y, ld);
-
-			Point e;
-			LinePlaneIntersection(in_tri.c.position, in_tri.b.position, plane, e.position);
-			float le = glm::length(e.position - in_tri.c.position) / glm::length(in_tri.b.position - in_tri.c.position);
-			e.texCoord = LerpVector3(in_tri.c.texCoord, in_tri.b.texCoord, le);
-			//e.colour = Vector4ToColour(LerpVector4(ColourToVector4(in_tri.c.colour), ColourToVector4(in_tri.b.colour), le));
-			e.colour = (LerpVector4((in_tri.c.colour), (in_tri.b.colour), le));
-			e.normal = (LerpVector3((in_tri.c.normal), (in_tri.b.normal), le));
-
-			float eLightNormal = LerpFloat(inLightDotNormal.z, inLightDotNormal.y, le);
-			//Vector3 ePosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 2), GetVector3FromMat3x3(interpWorldVertexPositions, 1), le);
-			float eInvDepth = LerpFloat(invDepth.z, invDepth.y, le);
-
-			// make two triangles := {a, c, d} & {d, c, e}
-			Triangle clippedTriangleACD;
-			clippedTriangleACD.a = in_tri.a;
-			clippedTriangleACD.b = in_tri.c;
-			clippedTriangleACD.c = d;
-
-			//Mat3x3 outWorldPositions1;
-			//SetVector3InMat3x3(outWorldPositions1, 0, GetVector3FromMat3x3(interpWorldVertexPositions, 0));
-			//SetVector3InMat3x3(outWorldPositions1, 1, GetVector3FromMat3x3(interpWorldVertexPositions, 2));
-			//SetVector3InMat3x3(outWorldPositions1, 2, dPosition);
-
-			outLightDotNormal.push_back({ inLightDotNormal.x, inLightDotNormal.z, dLightNormal });
-			//outWorldVertexPositions.push_back(outWorldPositions1);
-			invDepths.push_back({ invDepth.x, invDepth.z, dInvDepth });
-
-			Triangle clippedTriangleDCE;
-			clippedTriangleDCE.a = d;
-			clippedTriangleDCE.b = in_tri.c;
-			clippedTriangleDCE.c = e;
-
-			//Mat3x3 outWorldPositions2;
-			//SetVector3InMat3x3(outWorldPositions2, 0, dPosition);
-			//SetVector3InMat3x3(outWorldPositions2, 1, GetVector3FromMat3x3(interpWorldVertexPositions, 2));
-			//SetVector3InMat3x3(outWorldPositions2, 2, ePosition);
-
-			outLightDotNormal.push_back({ dLightNormal, inLightDotNormal.z, eLightNormal });
-			//outWorldVertexPositions.push_back(outWorldPositions2);
-			invDepths.push_back({ dInvDepth, invDepth.z, eInvDepth });
-
-			outputTriangles.push_back(clippedTriangleACD);
-			outputTriangles.push_back(clippedTriangleDCE);
-			//std::cout << "Two triangles : = {a, c, d} & {d, c, e}" << std::endl;
-
-			return 2; // Since we are making 2 triangles.
-		}
-		if (db < 0.0f && dc < 0.0f) {
-
-			// second and third points are interpolated between b and c to a.
-			Point d;
-			LinePlaneIntersection(in_tri.a.position, in_tri.b.position, plane, d.position);
-			float ld = glm::length(d.position - in_tri.a.position) / glm::length(in_tri.b.position - in_tri.a.position);
-			d.texCoord = LerpVector3(in_tri.a.texCoord, in_tri.b.texCoord, ld);
-			//d.colour = Vector4ToColour(LerpVector4(ColourToVector4(in_tri.a.colour), ColourToVector4(in_tri.b.colour), ld));
-			d.colour = (LerpVector4((in_tri.a.colour), (in_tri.b.colour), ld));
-			d.normal = (LerpVector3((in_tri.a.normal), (in_tri.b.normal), ld));
-
-			float dLightNormal = LerpFloat(inLightDotNormal.x, inLightDotNormal.y, ld);
-			//Vector3 dPosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 0), GetVector3FromMat3x3(interpWorldVertexPositions, 1), ld);
-			float dInvDepth = LerpFloat(invDepth.x, invDepth.y, ld);
-
-			Point e;
-			LinePlaneIntersection(in_tri.a.position, in_tri.c.position, plane, e.position);
-			float le = glm::length(e.position - in_tri.a.position) / glm::length(in_tri.c.position - in_tri.a.position);
-			e.texCoord = LerpVector3(in_tri.a.texCoord, in_tri.c.texCoord, le);
-			//e.colour = Vector4ToColour(LerpVector4(ColourToVector4(in_tri.a.colour), ColourToVector4(in_tri.c.colour), le));
-			e.colour = (LerpVector4((in_tri.a.colour), (in_tri.c.colour), le));
-			e.normal = (LerpVector3((in_tri.a.normal), (in_tri.c.normal), le));
-
-			float eLightNormal = LerpFloat(inLightDotNormal.x, inLightDotNormal.z, le);
-			//Vector3 ePosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 0), GetVector3FromMat3x3(interpWorldVertexPositions, 2), le);
-			float eInvDepth = LerpFloat(invDepth.x, invDepth.z, le);
-
-			// make one triangle := {a, d, e}
-			Triangle clippedTriangleADE;
-			clippedTriangleADE.a = in_tri.a;
-			clippedTriangleADE.b = d;
-			clippedTriangleADE.c = e;
-
-			//Mat3x3 outWorldPositions1;
-			//SetVector3InMat3x3(outWorldPositions1, 0, GetVector3FromMat3x3(interpWorldVertexPositions, 0));
-			//SetVector3InMat3x3(outWorldPositions1, 1, dPosition);
-			//SetVector3InMat3x3(outWorldPositions1, 2, ePosition);
-
-			outLightDotNormal.push_back({ inLightDotNormal.x, dLightNormal, eLightNormal });
-			//outWorldVertexPositions.push_back(outWorldPositions1);
-			invDepths.push_back({ invDepth.x, dInvDepth, eInvDepth });
-
-			outputTriangles.push_back(clippedTriangleADE);
-			//std::cout << "One triangle : = {a, d, e}" << std::endl;
-
-			return 1; // Since we are making 1 triangles.
+	const Vector3Int& edgeStepX = setup.edgeStepX;
+	const Vector3Int& edgeStepY = setup.edgeStepY;
+	const Vector3Int& edgeInsideThreshold = setup.edgeInsideThreshold;
+	const float& invAreaOfTriangle = setup.invAreaOfTriangle;
+	const PixelBlockRenderingData& pbd = setup.pbd;
+	const PixelPipeline& pipeline = setup.pipeline;
+	invDepth = setup.invDepth;
 
-		}
+	PixelRenderingData prd = { setup.lightDotTriangleNormals, setup.deltaYFloat, setup.deltaXFloat, setup.deltaKFloat, setup.areaOfTriangle, setup.invDepth, setup.invW, setup.texW, setup.triangle,
+							   setup.pbd.fixedColour, setup.curTex, scissorMin, scissorMax, fragmentCounters };
 
+	// In visibility buffer mode pixels only get depth and which triangle they belong to, ShadeVisibilityBufferTile shades them afterwards.
+	bool writeVisibility = activeRenderMode == RENDER_MODE_VISIBILITY_BUFFER;
+	unsigned int visibilityID = GetVisibilityID(curTriangleIndex);
+
+	// Depth is 1 / interpolated invDepth and larger is nearer, so no pixel of the triangle is nearer than its nearest vertex.
+	float triangleNearestDepth = 1.0f / std::min(invDepth.x, std::min(invDepth.y, invDepth.z));
+
+	Vector2Int hiZTileStart = { startX / hiZTileSize, startY / hiZTileSize };
+	Vector2Int hiZTileEnd = { endX / hiZTileSize, endY / hiZTileSize };
+
+	// Whole triangle behind what's already drawn under its bounding box, nothing to walk.
+	// Only the tiles earlier triangles have written depth to since they were last looked at need rescanning first.
+	if (useHiZ) {
+		RefreshDirtyHiZTiles(hiZ, imageDepthData, imageWidth, imageHeight, hiZTileStart, hiZTileEnd);
 	}
-	if (db > 0.0f) {
-
-		if (dc > 0.0f) {
-
-			// second point is c
-
-			// a is divided into two points d and e which are interpolated from b and c to a respectively.
-			Point d;
-			LinePlaneIntersection(in_tri.b.position, in_tri.a.position, plane, d.position);
-			float ld = glm::length(d.position - in_tri.b.position) / glm::length(in_tri.a.position - in_tri.b.position);
-			d.texCoord = LerpVector3(in_tri.b.texCoord, in_tri.a.texCoord, ld);
-			//d.colour = Vector4ToColour(LerpVector4(ColourToVector4(in_tri.b.colour), ColourToVector4(in_tri.a.colour), ld));
-			d.colour = (LerpVector4((in_tri.b.colour), (in_tri.a.colour), ld));
-			d.normal = (LerpVector3((in_tri.b.normal), (in_tri.a.normal), ld));
-
-			float dLightNormal = LerpFloat(inLightDotNormal.y, inLightDotNormal.x, ld);
-			//Vector3 dPosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 1), GetVector3FromMat3x3(interpWorldVertexPositions, 0), ld);
-			float dInvDepth = LerpFloat(invDepth.y, invDepth.x, ld);
-
-
-			Point e;
-			LinePlaneIntersection(in_tri.c.position, in_tri.a.position, plane, e.position);
-			float le = glm::length(e.position - in_tri.c.position) / glm::length(in_tri.a.position - in_tri.c.position);
-			e.texCoord = LerpVector3(in_tri.c.texCoord, in_tri.a.texCoord, le);
-			//e.colour = Vector4ToColour(LerpVector4(ColourToVector4(in_tri.c.colour), ColourToVector4(in_tri.a.colour), le));
-			e.colour = (LerpVector4((in_tri.c.colour), (in_tri.a.colour), le));
-			e.normal = (LerpVector3((in_tri.c.normal), (in_tri.a.normal), le));
-
-			float eLightNormal = LerpFloat(inLightDotNormal.z, inLightDotNormal.x, le);
-			//Vector3 ePosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 2), GetVector3FromMat3x3(interpWorldVertexPositions, 0), le);
-			float eInvDepth = LerpFloat(invDepth.z, invDepth.x, le);
-
-			// make two triangles := {b, c, d} & {d, c, e}
-			Triangle clippedTriangleBCD;
-			clippedTriangleBCD.a = in_tri.b;
-			clippedTriangleBCD.b = in_tri.c;
-			clippedTriangleBCD.c = d;
-
-			//Mat3x3 outWorldPositions1;
-			//SetVector3InMat3x3(outWorldPositions1, 0, GetVector3FromMat3x3(interpWorldVertexPositions, 2));
-			//SetVector3InMat3x3(outWorldPositions1, 1, GetVector3FromMat3x3(interpWorldVertexPositions, 2));
-			//SetVector3InMat3x3(outWorldPositions1, 2, dPosition);
-
-			outLightDotNormal.push_back({ inLightDotNormal.y, inLightDotNormal.z, dLightNormal });
-			//outWorldVertexPositions.push_back(outWorldPositions1);
-			invDepths.push_back({ invDepth.y, invDepth.z, dInvDepth });
-
-			Triangle clippedTriangleDCE;
-			clippedTriangleDCE.a = d;
-			clippedTriangleDCE.b = in_tri.c;
-			clippedTriangleDCE.c = e;
-
-			//Mat3x3 outWorldPositions2;
-			//SetVector3InMat3x3(outWorldPositions2, 0, dPosition);
-			//SetVector3InMat3x3(outWorldPositions2, 1, GetVector3FromMat3x3(interpWorldVertexPositions, 2));
-			//SetVector3InMat3x3(outWorldPositions2, 2, ePosition);
-
-			outLightDotNormal.push_back({ dLightNormal, inLightDotNormal.z, eLightNormal });
-			//outWorldVertexPositions.push_back(outWorldPositions2);
-			invDepths.push_back({ dInvDepth, invDepth.z, eInvDepth });
-
-			outputTriangles.push_back(clippedTriangleBCD);
-			outputTriangles.push_back(clippedTriangleDCE);
-			//std::cout << "Two triangles : = {b, c, d} & {d, c, e}" << std::endl;
-
-			return 2; // Since we are making 2 triangles.
-		}
-		if (dc < 0.0f && da < 0.0f) {
-
-			// second and third points are interpolated between c and a to b.
-			Point d;
-			LinePlaneIntersection(in_tri.c.position, in_tri.b.position, plane, d.position);
-			float ld = glm::length(d.position - in_tri.c.position) / glm::length(in_tri.b.position - in_tri.c.position);
-			d.texCoord = LerpVector3(in_tri.c.texCoord, in_tri.b.texCoord, ld);
-			//d.colour = Vector4ToColour(LerpVector4(ColourToVector4(in_tri.c.colour), ColourToVector4(in_tri.b.colour), ld));
-			d.colour = (LerpVector4((in_tri.c.colour), (in_tri.b.colour), ld));
-			d.normal = (LerpVector3((in_tri.c.normal), (in_tri.b.normal), ld));
-
-			float dLightNormal = LerpFloat(inLightDotNormal.z, inLightDotNormal.y, ld);
-			//Vector3 dPosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 2), GetVector3FromMat3x3(interpWorldVertexPositions, 1), ld);
-			float dInvDepth = LerpFloat(invDepth.z, invDepth.y, ld);
-
-
-			Point e;
-			LinePlaneIntersection(in_tri.a.position, in_tri.b.position, plane, e.position);
-			float le = glm::length(e.position - in_tri.a.position) / glm::length(in_tri.b.position - in_tri.a.position);
-			e.texCoord = LerpVector3(in_tri.a.texCoord, in_tri.b.texCoord, le);
-			//e.colour = Vector4ToColour(LerpVector4(ColourToVector4(in_tri.a.colour), ColourToVector4(in_tri.b.colour), le));
-			e.colour = (LerpVector4((in_tri.a.colour), (in_tri.b.colour), le));
-			e.normal = (LerpVector3((in_tri.a.normal), (in_tri.b.normal), le));
-
-			float eLightNormal = LerpFloat(inLightDotNormal.x, inLightDotNormal.y, le);
-			//Vector3 ePosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 0), GetVector3FromMat3x3(interpWorldVertexPositions, 1), le);
-			float eInvDepth = LerpFloat(invDepth.x, invDepth.y, le);
-
-			// make two triangles := {b, d, e}
-			Triangle clippedTriangleBDE;
-			clippedTriangleBDE.a = in_tri.b;
-			clippedTriangleBDE.b = d;
-			clippedTriangleBDE.c = e;
-
-			//Mat3x3 outWorldPositions1;
-			//SetVector3InMat3x3(outWorldPositions1, 0, GetVector3FromMat3x3(interpWorldVertexPositions, 1));
-			//SetVector3InMat3x3(outWorldPositions1, 1, dPosition);
-			//SetVector3InMat3x3(outWorldPositions1, 2, ePosition);
-
-			outLightDotNormal.push_back({ inLightDotNormal.y, dLightNormal, eLightNormal });
-			//outWorldVertexPositions.push_back(outWorldPositions1);
-			invDepths.push_back({ invDepth.y, dInvDepth, eInvDepth });
-
-			//std::cout << "One triangle : = {b, d, e}" << std::endl;
-			outputTriangles.push_back(clippedTriangleBDE);
-
-			return 1; // Since we are making 1 triangles.
-		}
+	if (useHiZ && IsHiZRegionOccluded(hiZ, hiZTileStart, hiZTileEnd, triangleNearestDepth)) {
+		fragmentCounters.hiZTilesRejected += (hiZTileEnd.x - hiZTileStart.x + 1) * (hiZTileEnd.y - hiZTileStart.y + 1);
+		return;
 	}
-	if (dc > 0.0f) {
-		if (db < 0.0f && da < 0.0f) {
-
-			// second and third points are interpolated between b and a to c.
-			Point d;
-			LinePlaneIntersection(in_tri.a.position, in_tri.c.position, plane, d.position);
-			float ld = glm::length(d.position - in_tri.a.position) / glm::length(in_tri.c.position - in_tri.a.position);
-			d.texCoord = LerpVector3(in_tri.a.texCoord, in_tri.c.texCoord, ld);
-			//d.colour = Vector4ToColour(LerpVector4(ColourToVector4(in_tri.a.colour), ColourToVector4(in_tri.c.colour), ld));
-			d.colour = (LerpVector4((in_tri.a.colour), (in_tri.c.colour), ld));
-			d.normal = (LerpVector3((in_tri.a.normal), (in_tri.c.normal), ld));
-
-			float dLightNormal = LerpFloat(inLightDotNormal.x, inLightDotNormal.z, ld);
-			//Vector3 dPosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 0), GetVector3FromMat3x3(interpWorldVertexPositions, 2), ld);
-			float dInvDepth = LerpFloat(invDepth.x, invDepth.z, ld);
-
-
-			Point e;
-			LinePlaneIntersection(in_tri.b.position, in_tri.c.position, plane, e.position);
-			float le = glm::length(e.position - in_tri.b.position) / glm::length(in_tri.c.position - in_tri.b.position);
-			e.texCoord = LerpVector3(in_tri.b.texCoord, in_tri.c.texCoord, le);
-			//e.colour = Vector4ToColour(LerpVector4(ColourToVector4(in_tri.b.colour), ColourToVector4(in_tri.c.colour), le));
-			e.colour = (LerpVector4((in_tri.b.colour), (in_tri.c.colour), le));
-			e.normal = (LerpVector3((in_tri.b.normal), (in_tri.c.normal), le));
-
-			float eLightNormal = LerpFloat(inLightDotNormal.y, inLightDotNormal.z, le);
-			//Vector3 ePosition = LerpVector3(GetVector3FromMat3x3(interpWorldVertexPositions, 1), GetVector3FromMat3x3(interpWorldVertexPositions, 2), le);
-			float eInvDepth = LerpFloat(invDepth.y, invDepth.z, le);
-
-
-			// make one triangles := {c, d, e}
-			Triangle clippedTriangleCDE;
-			clippedTriangleCDE.a = in_tri.c;
-			clippedTriangleCDE.b = d;
-			clippedTriangleCDE.c = e;
-
-			//Mat3x3 outWorldPositions1;
-			//SetVector3InMat3x3(outWorldPositions1, 0, GetVector3FromMat3x3(interpWorldVertexPositions, 2));
-			//SetVector3InMat3x3(outWorldPositions1, 1, dPosition);
-			//SetVector3InMat3x3(outWorldPositions1, 2, ePosition);
-
-			outLightDotNormal.push_back({ inLightDotNormal.z, dLightNormal, eLightNormal });
-			//outWorldVertexPositions.push_back(outWorldPositions1);
-			invDepths.push_back({ invDepth.z, dInvDepth, eInvDepth });
-
-			outputTriangles.push_back(clippedTriangleCDE);
-			//std::cout << "One triangles : = {c, d, e}" << std::endl;
-
-			return 1;
+
+	PixelKernel pixelKernel = activePixelKernel;
+
+	// Edge functions at the first pixel centre, the only place they are evaluated with multiplies.
+	Vector3Int edgeAtStart = EdgeFunctionsAtPixel(setup, startX, startY);
+
+	// The bounding box is walked one Hi-Z tile at a time, so every tile can be rejected before any of its pixels are looked at.
+	for (int tileY = hiZTileStart.y; tileY <= hiZTileEnd.y; tileY++)
+	{
+		for (int tileX = hiZTileStart.x; tileX <= hiZTileEnd.x; tileX++)
+		{
+			Vector2Int tileOrigin = Vector2Int{ tileX, tileY } * hiZTileSize;
+
+			// Part of the bounding box inside this tile.
+			int tileStartX = std::max(startX, tileOrigin.x);
+			int tileStartY = std::max(startY, tileOrigin.y);
+			int tileEndX = std::min(endX, tileOrigin.x + hiZTileSize - 1);
+			int tileEndY = std::min(endY, tileOrigin.y + hiZTileSize - 1);
+
+			Vector3Int edgeAtTileOrigin = edgeAtStart + ((tileOrigin.x - startX) * edgeStepX) - ((tileOrigin.y - startY) * edgeStepY);
+
+			// Edge functions are linear, so across the tile each one peaks at a corner. If one of them can't get inside anywhere the triangle misses the tile.
+			Vector3Int edgeMaxInTile = edgeAtTileOrigin;
+			bool tileMissesTriangle = false;
+			for (int i = 0; i < 3; i++)
+			{
+				edgeMaxInTile[i] += edgeStepX[i] > 0 ? (tileEndX - tileOrigin.x) * edgeStepX[i] : (tileStartX - tileOrigin.x) * edgeStepX[i];
+				edgeMaxInTile[i] -= edgeStepY[i] > 0 ? (tileStartY - tileOrigin.y) * edgeStepY[i] : (tileEndY - tileOrigin.y) * edgeStepY[i];
+				tileMissesTriangle |= edgeMaxInTile[i] <= edgeInsideThreshold[i];
+			}
+
+			if (tileMissesTriangle) {
+				continue;
+			}
+
+			if (useHiZ) {
+				// Interpolated invDepth is linear in screen space too, its smallest value (the nearest depth) over the tile's corners bounds every pixel in it.
+				// Only usable while it stays positive, past the triangle's edges it's extrapolated and can hit zero.
+				float tileNearestDepth = triangleNearestDepth;
+				float minCornerInvDepth = FLT_MAX;
+				for (int corner = 0; corner < 4; corner++)
+				{
+					int cornerOffsetX = (corner & 1) ? tileEndX - tileOrigin.x : tileStartX - tileOrigin.x;
+					int cornerOffsetY = (corner & 2) ? tileEndY - tileOrigin.y : tileStartY - tileOrigin.y;
+					Vector3Int edgeAtCorner = edgeAtTileOrigin + (cornerOffsetX * edgeStepX) - (cornerOffsetY * edgeStepY);
+					float cornerInvDepth = ((edgeAtCorner.x * invAreaOfTriangle) * invDepth.x) + ((edgeAtCorner.y * invAreaOfTriangle) * invDepth.y) + ((edgeAtCorner.z * invAreaOfTriangle) * invDepth.z);
+					minCornerInvDepth = std::min(minCornerInvDepth, cornerInvDepth);
+				}
+				if (minCornerInvDepth > 0.0f) {
+					tileNearestDepth = std::min(tileNearestDepth, 1.0f / minCornerInvDepth);
+				}
+
+				if (IsHiZTileOccluded(hiZ, tileX, tileY, tileNearestDepth)) {
+					fragmentCounters.hiZTilesRejected++;
+					continue;
+				}
+			}
+
+			// Hi-Z tiles are aligned to pixelBlockWidth, so a tile row is whole blocks as long as it doesn't reach past the scissor.
+			// Blocks start at the tile's left edge rather than the bounding box, the pixels that adds are all outside the triangle.
+			bool drawWithBlocks = pixelKernel != PIXEL_KERNEL_SCALAR && tileOrigin.x + hiZTileSize - 1 <= scissorMax.x;
+			int pixelBlockWidth = pixelKernel == PIXEL_KERNEL_AVX2 ? 8 : 4;
+
+			// Set when any pixel passes the depth test, tiles the triangle only failed in keep their Hi-Z values.
+			bool depthWritten = false;
+
+			Vector3Int edgeRowStart = edgeAtTileOrigin - ((tileStartY - tileOrigin.y) * edgeStepY);
+			for (int y = tileStartY; y <= tileEndY; y++)
+			{
+				if (drawWithBlocks) {
+					Vector3Int edge = edgeRowStart;
+					for (int x = tileOrigin.x; x < tileOrigin.x + hiZTileSize; x += pixelBlockWidth)
+					{
+						int index = GetRedFlattenedImageDataSlotForPixel(Vector2Int{ x, y }, imageWidth);
+						int depthDataIndex = GetFlattenedImageDataSlotForDepthData(Vector2Int{ x, y }, imageWidth);
+						if (writeVisibility) {
+							if (pixelKernel == PIXEL_KERNEL_AVX2) {
+								depthWritten |= DrawVisibilityBlockAVX2(pbd, edge, visibilityID, &visibilityData[depthDataIndex], &imageDepthData[depthDataIndex], fragmentCounters);
+							}
+							else {
+								depthWritten |= DrawVisibilityBlockSSE(pbd, edge, visibilityID, &visibilityData[depthDataIndex], &imageDepthData[depthDataIndex], fragmentCounters);
+							}
+						}
+						else if (pixelKernel == PIXEL_KERNEL_AVX2) {
+							depthWritten |= pipeline.drawPixelBlockAVX2(pbd, edge, &imageData[index], &imageDepthData[depthDataIndex], fragmentCounters);
+						}
+						else {
+							depthWritten |= pipeline.drawPixelBlockSSE(pbd, edge, &imageData[index], &imageDepthData[depthDataIndex], fragmentCounters);
+						}
+
+						edge += pixelBlockWidth * edgeStepX;
+					}
+				}
+				else {
+					Vector3Int edge = edgeRowStart + ((tileStartX - tileOrigin.x) * edgeStepX);
+					for (int x = tileStartX; x <= tileEndX; x++)
+					{
+						if (edge.x > edgeInsideThreshold.x && edge.y > edgeInsideThreshold.y && edge.z > edgeInsideThreshold.z) {
+							if (writeVisibility) {
+								depthWritten |= DrawVisibilityPixelWithBarycentrics(imageWidth, Vector2Int{ x, y }, edge.x * invAreaOfTriangle, edge.y * invAreaOfTriangle, edge.z * invAreaOfTriangle, prd, visibilityID, visibilityData, imageDepthData);
+							}
+							else {
+								depthWritten |= pipeline.drawPixel(imageWidth, Vector2Int{ x, y }, edge.x * invAreaOfTriangle, edge.y * invAreaOfTriangle, edge.z * invAreaOfTriangle, prd, imageData, imageDepthData);
+							}
+						}
+
+						edge += edgeStepX;
+					}
+				}
+
+				edgeRowStart -= edgeStepY;
+			}
+
+			if (depthWritten) {
+				MarkHiZTileDirty(hiZ, tileX, tileY);
+			}
 		}
 	}
 }
 
-void DrawTriangleOnScreenFromWorldTriangleWithClipping(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, int imageWidth, int imageHeight
-	, int curTriangleIndex, int currentTextureIndex, Triangle& modelTriangle, Mat4x4& modelMatrix
-	, Vector3 cameraPosition, Vector3 cameraDirection
-	, const Mat4x4& viewMatrix, const Mat4x4& projectionMatrix
-	, int lineThickness, Colour lineColour, int& totalTrianglesRendered, bool debugDraw = false) {
 
-	//cameraPosition.y *= -1.0f;
+// The part of TriangleSetup a depth only raster needs, the same snapping, winding and fill rule so it covers exactly the pixels the full one would.
+struct DepthOnlyTriangleSetup {
+
+	Vector2Int a, b, c;
+	Vector3Int deltaY, deltaX;
+	Vector3Int edgeStepX, edgeStepY;
+	Vector3Int edgeInsideThreshold;
+	Vector3 invDepth;
+	float invAreaOfTriangle;
+
+	PixelBlockRenderingData pbd;		// Only the edge and depth members are filled in, nothing else is read by the depth only pixel blocks.
+};
+
+bool SetupDepthOnlyTriangle(const Triangle& drawTriangle, const Vector3& invDepth, DepthOnlyTriangleSetup& setup) {
+
+	setup.a = SnapToSubpixelGrid(drawTriangle.a.position);
+	setup.b = SnapToSubpixelGrid(drawTriangle.b.position);
+	setup.c = SnapToSubpixelGrid(drawTriangle.c.position);
+	setup.invDepth = invDepth;
+
+	const Vector2Int& a = setup.a;
+	Vector2Int& b = setup.b;
+	Vector2Int& c = setup.c;
+
+	long long areaOfTriangleFixed = ((long long)(c.x - a.x) * (b.y - a.y)) - ((long long)(c.y - a.y) * (b.x - a.x));
+	if (areaOfTriangleFixed == 0) {
+		return false;
+	}
+
+	if (areaOfTriangleFixed < 0) {
+		std::swap(b, c);
+		std::swap(setup.invDepth.y, setup.invDepth.z);
+		areaOfTriangleFixed = -areaOfTriangleFixed;
+	}
+
+	setup.deltaY = { c.y - b.y, a.y - c.y, b.y - a.y };
+	setup.deltaX = { c.x - b.x, a.x - c.x, b.x - a.x };
+	setup.edgeInsideThreshold = { IsLineTopOrLeft(c, b) ? -1 : 0, IsLineTopOrLeft(a, c) ? -1 : 0, IsLineTopOrLeft(b, a) ? -1 : 0 };
+	setup.invAreaOfTriangle = 1.0f / (float)areaOfTriangleFixed;
+	setup.edgeStepX = setup.deltaY * subpixelSteps;
+	setup.edgeStepY = setup.deltaX * subpixelSteps;
+
+	setup.pbd = PixelBlockRenderingData();
+	setup.pbd.edgeStepX[0] = setup.edgeStepX.x;
+	setup.pbd.edgeStepX[1] = setup.edgeStepX.y;
+	setup.pbd.edgeStepX[2] = setup.edgeStepX.z;
+	setup.pbd.edgeInsideThreshold[0] = setup.edgeInsideThreshold.x;
+	setup.pbd.edgeInsideThreshold[1] = setup.edgeInsideThreshold.y;
+	setup.pbd.edgeInsideThreshold[2] = setup.edgeInsideThreshold.z;
+	setup.pbd.invAreaOfTriangle = setup.invAreaOfTriangle;
+	setup.pbd.invDepth[0] = setup.invDepth.x;
+	setup.pbd.invDepth[1] = setup.invDepth.y;
+	setup.pbd.invDepth[2] = setup.invDepth.z;
+
+	return true;
+}
+
+// Depth only specialization of DrawTriangleOnScreenFromScreenSpaceHalfSpaceMethod for shadow maps. Same walk over the bounding box in 8x8 tiles
+// and the same block kernels for coverage and the depth test, but no texture, colour, lighting or 1 / w is ever interpolated and nothing but depth is written.
+// There's no Hi-Z for shadow maps, the light's view isn't drawn front to back so there'd be little to reject.
+void DrawTriangleDepthOnlyHalfSpaceMethod(std::vector<float>& depthData, int imageWidth, const Triangle& drawTriangle, const Vector3& invDepth,
+	const Vector2Int& scissorMin, const Vector2Int& scissorMax, FragmentCounters& fragmentCounters)
+{
 	PROFILE_FUNCTION();
 
-	Triangle transformedTriangle = ApplyTransformToTriangle(modelTriangle, modelMatrix);
-	transformedTriangle.a.position.y *= -1.0f;
-	transformedTriangle.b.position.y *= -1.0f;
-	transformedTriangle.c.position.y *= -1.0f;
+	DepthOnlyTriangleSetup setup;
+	if (!SetupDepthOnlyTriangle(drawTriangle, invDepth, setup)) {
+		return;
+	}
+
+	const Vector2Int& a = setup.a;
+	const Vector2Int& b = setup.b;
+	const Vector2Int& c = setup.c;
+
+	int startX = std::max((std::min(a.x, std::min(b.x, c.x)) - (subpixelSteps / 2) + (subpixelSteps - 1)) >> subpixelBits, scissorMin.x);
+	int startY = std::max((std::min(a.y, std::min(b.y, c.y)) - (subpixelSteps / 2) + (subpixelSteps - 1)) >> subpixelBits, scissorMin.y);
+	int endX = std::min((std::max(a.x, std::max(b.x, c.x)) - (subpixelSteps / 2)) >> subpixelBits, scissorMax.x);
+	int endY = std::min((std::max(a.y, std::max(b.y, c.y)) - (subpixelSteps / 2)) >> subpixelBits, scissorMax.y);
 
-	Mat4x4 normalTransformMatrix;
-	for (int x = 0; x < 3; x++)
+	if (startX > endX || startY > endY) {
+		return;
+	}
+
+	const Vector3Int& edgeStepX = setup.edgeStepX;
+	const Vector3Int& edgeStepY = setup.edgeStepY;
+	const Vector3Int& edgeInsideThreshold = setup.edgeInsideThreshold;
+
+	PixelKernel pixelKernel = activePixelKernel;
+	int pixelBlockWidth = pixelKernel == PIXEL_KERNEL_AVX2 ? 8 : 4;
+
+	Vector3Int edgeAtStart = EdgeFunctionsAtPixel(a, b, c, setup.deltaY, setup.deltaX, startX, startY);
+
+	for (int tileY = startY / hiZTileSize; tileY <= endY / hiZTileSize; tileY++)
 	{
-		for (int y = 0; y < 4; y++)
+		for (int tileX = startX / hiZTileSize; tileX <= endX / hiZTileSize; tileX++)
 		{
-			normalTransformMatrix[x][y] = modelMatrix[x][y];
+			Vector2Int tileOrigin = Vector2Int{ tileX, tileY } * hiZTileSize;
+
+			int tileStartX = std::max(startX, tileOrigin.x);
+			int tileStartY = std::max(startY, tileOrigin.y);
+			int tileEndX = std::min(endX, tileOrigin.x + hiZTileSize - 1);
+			int tileEndY = std::min(endY, tileOrigin.y + hiZTileSize - 1);
+
+			Vector3Int edgeAtTileOrigin = edgeAtStart + ((tileOrigin.x - startX) * edgeStepX) - ((tileOrigin.y - startY) * edgeStepY);
+
+			Vector3Int edgeMaxInTile = edgeAtTileOrigin;
+			bool tileMissesTriangle = false;
+			for (int i = 0; i < 3; i++)
+			{
+				edgeMaxInTile[i] += edgeStepX[i] > 0 ? (tileEndX - tileOrigin.x) * edgeStepX[i] : (tileStartX - tileOrigin.x) * edgeStepX[i];
+				edgeMaxInTile[i] -= edgeStepY[i] > 0 ? (tileStartY - tileOrigin.y) * edgeStepY[i] : (tileEndY - tileOrigin.y) * edgeStepY[i];
+				tileMissesTriangle |= edgeMaxInTile[i] <= edgeInsideThreshold[i];
+			}
+
+			if (tileMissesTriangle) {
+				continue;
+			}
+
+			bool drawWithBlocks = pixelKernel != PIXEL_KERNEL_SCALAR && tileOrigin.x + hiZTileSize - 1 <= scissorMax.x;
+
+			Vector3Int edgeRowStart = edgeAtTileOrigin - ((tileStartY - tileOrigin.y) * edgeStepY);
+			for (int y = tileStartY; y <= tileEndY; y++)
+			{
+				if (drawWithBlocks) {
+					Vector3Int edge = edgeRowStart;
+					for (int x = tileOrigin.x; x < tileOrigin.x + hiZTileSize; x += pixelBlockWidth)
+					{
+						float* depthOut = &depthData[GetFlattenedImageDataSlotForDepthData(Vector2Int{ x, y }, imageWidth)];
+						if (pixelKernel == PIXEL_KERNEL_AVX2) {
+							DrawPixelBlockAVX2<PIXEL_FEATURE_DEPTH_ONLY>(setup.pbd, edge, nullptr, depthOut, fragmentCounters);
+						}
+						else {
+							DrawPixelBlockSSE<PIXEL_FEATURE_DEPTH_ONLY>(setup.pbd, edge, nullptr, depthOut, fragmentCounters);
+						}
+
+						edge += pixelBlockWidth * edgeStepX;
+					}
+				}
+				else {
+					Vector3Int edge = edgeRowStart + ((tileStartX - tileOrigin.x) * edgeStepX);
+					for (int x = tileStartX; x <= tileEndX; x++)
+					{
+						if (edge.x > edgeInsideThreshold.x && edge.y > edgeInsideThreshold.y && edge.z > edgeInsideThreshold.z) {
+							float calcDepth = 1.0f / (((edge.x * setup.invAreaOfTriangle) * setup.invDepth.x) + ((edge.y * setup.invAreaOfTriangle) * setup.invDepth.y) + ((edge.z * setup.invAreaOfTriangle) * setup.invDepth.z));
+							float& depth = depthData[GetFlattenedImageDataSlotForDepthData(Vector2Int{ x, y }, imageWidth)];
+							if (depth >= calcDepth) {
+								fragmentCounters.fragmentsKilledByDepth++;
+							}
+							else {
+								depth = calcDepth;
+							}
+						}
+
+						edge += edgeStepX;
+					}
+				}
+
+				edgeRowStart -= edgeStepY;
+			}
 		}
 	}
+}
+
+// When false every triangle crossing a screen edge is clipped to it, like before the guard band existed, to compare the two.
+// Only read by ComputeDrawConstants, a draw clips to whatever planes its DrawConstants picked.
+bool useGuardBandClipping = true;
+
+// A mesh vertex after this frame's transforms. Computed once per vertex and shared by every triangle indexing it.
+struct TransformedVertex {
+
+	Vector3 worldPosition;
+	Vector3 worldNormal;
+	Vector4 clipPosition;		// Negated, so w is the view space depth, see clipSpacePlanesScreen.
+	float lightDotNormal;
+
+	unsigned int clipOutcode;		// Against the planes triangles get clipped to, the guard band ones unless it's turned off.
+	unsigned int screenOutcode;		// Against the screen edges, used to reject triangles that are entirely off screen.
+};
+
+// Everything the vertex transform needs from one draw. Built once per mesh per frame by ComputeDrawConstants, the per vertex loops only read it.
+struct DrawConstants {
+
+	Mat4x4 modelMatrix;					// Object to world space, with the world's y flip folded in.
+	Mat4x4 modelViewProjectionMatrix;	// Object to clip space, negated so w is the view space depth, see clipSpacePlanesScreen.
+	Mat3x3 normalMatrix;				// Inverse transpose of modelMatrix's upper 3x3, keeps normals perpendicular to their surface under non uniform scale.
+	Vector3 lightPosition;				// World space, lighting is done there.
+	Frustum frustum;					// The screen clip planes in object space, meshes are tested against it before any of their vertices are touched.
+	Vector3 cameraPosition;				// Object space, for the meshlet normal cones.
+	const ClipSpacePlane* clipPlanes;	// numClipSpacePlanes of them, what triangles crossing the frustum get clipped to. The guard band ones unless it's turned off.
+};
+
+DrawConstants ComputeDrawConstants(const Mat4x4& modelMatrix, const Mat4x4& viewMatrix, const Mat4x4& projectionMatrix, const Vector3& worldLightPosition) {
+
+	// Models are flipped in y once they're in the world.
+	const Mat4x4 flipY = glm::scale(glm::identity<Mat4x4>(), Vector3{ 1.0f, -1.0f, 1.0f });
+
+	DrawConstants drawConstants;
+	drawConstants.modelMatrix = flipY * modelMatrix;
+	// The projection hands out negative w for points in front of our +z looking camera, negating the whole matrix gives the same point after the divide with w > 0.
+	drawConstants.modelViewProjectionMatrix = -(projectionMatrix * viewMatrix * drawConstants.modelMatrix);
+	drawConstants.normalMatrix = glm::transpose(glm::inverse(Mat3x3(drawConstants.modelMatrix)));
+	drawConstants.lightPosition = worldLightPosition;
+	drawConstants.frustum = ExtractFrustum(drawConstants.modelViewProjectionMatrix, clipSpacePlanesScreen, numClipSpacePlanes);
+	drawConstants.cameraPosition = Vector3(glm::inverse(viewMatrix * drawConstants.modelMatrix)[3]);
+	// With the guard band only triangles reaching past it are clipped in x and y, everything else is cut to the screen by the scissor.
+	drawConstants.clipPlanes = useGuardBandClipping ? clipSpacePlanesGuardBand : clipSpacePlanesScreen;
+
+	return drawConstants;
+}
+
+// Scalar transform of vertex i of the streams, used on CPUs without AVX2.
+void TransformVertex(const VertexStreams& streams, int i, const DrawConstants& drawConstants, const ClipSpacePlane* clipPlanes, TransformedVertex& transformedVertex) {
+
+	Vector4 position = { streams.positionX[i], streams.positionY[i], streams.positionZ[i], 1.0f };
+	Vector3 normal = { streams.normalX[i], streams.normalY[i], streams.normalZ[i] };
+
+	transformedVertex.worldPosition = Vector3(drawConstants.modelMatrix * position);
+	transformedVertex.worldNormal = glm::normalize(drawConstants.normalMatrix * normal);
+
+	Vector3 lightDirFromVertex = glm::normalize(drawConstants.lightPosition - transformedVertex.worldPosition);
+	transformedVertex.lightDotNormal = glm::max(glm::dot(lightDirFromVertex, transformedVertex.worldNormal), 0.1f);
+
+	transformedVertex.clipPosition = drawConstants.modelViewProjectionMatrix * position;
+
+	transformedVertex.clipOutcode = ComputeClipOutcode(transformedVertex.clipPosition, clipPlanes, numClipSpacePlanes);
+	transformedVertex.screenOutcode = ComputeClipOutcode(transformedVertex.clipPosition, clipSpacePlanesScreen, numClipSpacePlanes);
+}
+
+// matrix * (x, y, z, w) for 8 vectors at once. Products are summed in the same order glm does, so the batched path matches TransformVertex bit for bit.
+TARGET_AVX2 void TransformVectorsAVX2(const Mat4x4& matrix, const __m256& x, const __m256& y, const __m256& z, const __m256& w, __m256 out[4]) {
+
+	for (int row = 0; row < 4; row++)
+	{
+		__m256 xy = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(matrix[0][row]), x), _mm256_mul_ps(_mm256_set1_ps(matrix[1][row]), y));
+		__m256 zw = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(matrix[2][row]), z), _mm256_mul_ps(_mm256_set1_ps(matrix[3][row]), w));
+		out[row] = _mm256_add_ps(xy, zw);
+	}
+}
+
+// matrix * (x, y, z) for 8 vectors at once, in glm's order like TransformVectorsAVX2.
+TARGET_AVX2 void TransformVectorsAVX2(const Mat3x3& matrix, const __m256& x, const __m256& y, const __m256& z, __m256 out[3]) {
 
-	for (int y = 0; y < 4; y++)
+	for (int row = 0; row < 3; row++)
 	{
-		normalTransformMatrix[3][y] = 0;
+		__m256 xy = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(matrix[0][row]), x), _mm256_mul_ps(_mm256_set1_ps(matrix[1][row]), y));
+		out[row] = _mm256_add_ps(xy, _mm256_mul_ps(_mm256_set1_ps(matrix[2][row]), z));
 	}
+}
+
+// Normalizes 8 vectors in place, 1 / sqrt like glm::normalize rather than the approximate rsqrt.
+TARGET_AVX2 void NormalizeVectorsAVX2(__m256& x, __m256& y, __m256& z) {
 
-	//PrintMat4x4Pos0(normalTransformMatrix);
+	__m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+	__m256 invLength = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(lengthSquared));
+	x = _mm256_mul_ps(x, invLength);
+	y = _mm256_mul_ps(y, invLength);
+	z = _mm256_mul_ps(z, invLength);
+}
 
-	//std::cout << modelTriangle.a.normal.x << ", " << modelTriangle.a.normal.y << ", " << modelTriangle.a.normal.z << std::endl;
-	//std::cout << transformedTriangle.a.normal.x << ", " << transformedTriangle.a.normal.y << ", " << transformedTriangle.a.normal.z << std::endl;
+// Lane i has bit p set when vertex i is on the outside of planes[p], see ComputeClipOutcode.
+TARGET_AVX2 __m256i ComputeClipOutcodesAVX2(const __m256 clipPosition[4], const ClipSpacePlane* planes, int numPlanes) {
 
-	ApplyTransformToTriangleNormals(transformedTriangle, normalTransformMatrix);
-	transformedTriangle.a.normal.y *= -1.0f;
-	transformedTriangle.b.normal.y *= -1.0f;
-	transformedTriangle.c.normal.y *= -1.0f;
-	//std::cout << transformedTriangle.a.normal.x << ", " << transformedTriangle.a.normal.y << ", " << transformedTriangle.a.normal.z << std::endl;
+	__m256i outcodes = _mm256_setzero_si256();
+	for (int p = 0; p < numPlanes; p++)
+	{
+		const ClipSpacePlane& plane = planes[p];
+		__m256 xy = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.coefficients.x), clipPosition[0]), _mm256_mul_ps(_mm256_set1_ps(plane.coefficients.y), clipPosition[1]));
+		__m256 zw = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.coefficients.z), clipPosition[2]), _mm256_mul_ps(_mm256_set1_ps(plane.coefficients.w), clipPosition[3]));
+		__m256 distance = _mm256_add_ps(_mm256_add_ps(xy, zw), _mm256_set1_ps(plane.offset));
 
-	//std::cout << modelTriangle.a.normal.x << ", " << modelTriangle.a.normal.y << ", " << modelTriangle.a.normal.z << std::endl;
+		__m256i outside = _mm256_castps_si256(_mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_LT_OQ));
+		outcodes = _mm256_or_si256(outcodes, _mm256_and_si256(outside, _mm256_set1_epi32(1 << p)));
+	}
+	return outcodes;
+}
 
-	//transformedTriangle.a.texCoord.y *= -1.0f;
-	//transformedTriangle.b.texCoord.y *= -1.0f;
-	//transformedTriangle.c.texCoord.y *= -1.0f;
+// Transforms the 8 vertices starting at firstVertex straight out of the SoA streams, every step of TransformVertex is done on all 8 lanes at once.
+// The streams are padded to whole batches, only the first numVerticesToStore results are written back.
+TARGET_AVX2 void TransformVertexBatchAVX2(const VertexStreams& streams, int firstVertex, int numVerticesToStore, const DrawConstants& drawConstants,
+	const ClipSpacePlane* clipPlanes, TransformedVertex* transformedVertices) {
 
-	Vector3 trianglePos = 0.33f * transformedTriangle.a.position + 0.33f * transformedTriangle.b.position + 0.33f * transformedTriangle.c.position;
-	//Vector3 lightPos = { 150.0f, 50.0f, 150.0f };
-	Vector3 lightPos = { 5.0f, -10.0f, -5.0f };
-	Vector3 lightDirFromTriangleA = glm::normalize(lightPos - transformedTriangle.a.position);
-	Vector3 lightDirFromTriangleB = glm::normalize(lightPos - transformedTriangle.b.position);
-	Vector3 lightDirFromTriangleC = glm::normalize(lightPos - transformedTriangle.c.position);
+	const __m256 one = _mm256_set1_ps(1.0f);
 
-	//Vector3 lightDirFromTriangleA = glm::normalize(lightPos - trianglePos);
-	//Vector3 lightDirFromTriangleB = glm::normalize(lightPos - trianglePos);
-	//Vector3 lightDirFromTriangleC = glm::normalize(lightPos - trianglePos);
+	__m256 positionX = _mm256_load_ps(&streams.positionX[firstVertex]);
+	__m256 positionY = _mm256_load_ps(&streams.positionY[firstVertex]);
+	__m256 positionZ = _mm256_load_ps(&streams.positionZ[firstVertex]);
 
-	Vector3 triangleNorm = 0.33f * transformedTriangle.a.normal + 0.33f * transformedTriangle.b.normal + 0.33f * transformedTriangle.c.normal;
+	__m256 worldPosition[4];
+	TransformVectorsAVX2(drawConstants.modelMatrix, positionX, positionY, positionZ, one, worldPosition);
 
-	//Vector3 trianglePosRelativeToCamera = cameraPosition - transformedTriangle.a.position;
-	//cameraPosition.y *= -1.0f;
-	//Vector3 trianglePosRelativeToCamera = transformedTriangle.a.position - cameraPosition;
-	Vector3 trianglePosRelativeToCamera = trianglePos - cameraPosition;
-	trianglePosRelativeToCamera = glm::normalize(trianglePosRelativeToCamera);
+	__m256 worldNormal[3];
+	TransformVectorsAVX2(drawConstants.normalMatrix, _mm256_load_ps(&streams.normalX[firstVertex]), _mm256_load_ps(&streams.normalY[firstVertex]), _mm256_load_ps(&streams.normalZ[firstVertex]), worldNormal);
+	NormalizeVectorsAVX2(worldNormal[0], worldNormal[1], worldNormal[2]);
 
-	//bool cameraCouldSeeTriangle = glm::dot(trianglePosRelativeToCamera, cameraDirection) > 0.0f;
-	//bool cameraCouldSeeTriangle = glm::dot(triangleNorm, cameraDirection) < 0.0f;
-	bool cameraCouldSeeTriangle = glm::dot(triangleNorm, trianglePosRelativeToCamera) < 0.0f;
+	__m256 lightDirX = _mm256_sub_ps(_mm256_set1_ps(drawConstants.lightPosition.x), worldPosition[0]);
+	__m256 lightDirY = _mm256_sub_ps(_mm256_set1_ps(drawConstants.lightPosition.y), worldPosition[1]);
+	__m256 lightDirZ = _mm256_sub_ps(_mm256_set1_ps(drawConstants.lightPosition.z), worldPosition[2]);
+	NormalizeVectorsAVX2(lightDirX, lightDirY, lightDirZ);
 
-	//std::cout << transformedTriangle.a.normal.x << ", " << transformedTriangle.a.normal.y << ", " << transformedTriangle.a.normal.z << std::endl;
+	__m256 lightDotNormal = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lightDirX, worldNormal[0]), _mm256_mul_ps(lightDirY, worldNormal[1])), _mm256_mul_ps(lightDirZ, worldNormal[2]));
+	lightDotNormal = _mm256_max_ps(lightDotNormal, _mm256_set1_ps(0.1f));
 
+	__m256 clipPosition[4];
+	TransformVectorsAVX2(drawConstants.modelViewProjectionMatrix, positionX, positionY, positionZ, one, clipPosition);
 
-	//if (cameraCouldSeeTriangle || true)
-	if (cameraCouldSeeTriangle)
+	__m256i clipOutcodes = ComputeClipOutcodesAVX2(clipPosition, clipPlanes, numClipSpacePlanes);
+	__m256i screenOutcodes = ComputeClipOutcodesAVX2(clipPosition, clipSpacePlanesScreen, numClipSpacePlanes);
+
+	// Triangles pick their vertices by index, so the results go back out as one TransformedVertex per vertex.
+	alignas(32) float worldPositionOut[3][vertexStreamBatchSize];
+	alignas(32) float worldNormalOut[3][vertexStreamBatchSize];
+	alignas(32) float clipPositionOut[4][vertexStreamBatchSize];
+	alignas(32) float lightDotNormalOut[vertexStreamBatchSize];
+	alignas(32) unsigned int clipOutcodesOut[vertexStreamBatchSize];
+	alignas(32) unsigned int screenOutcodesOut[vertexStreamBatchSize];
+
+	for (int i = 0; i < 3; i++)
 	{
-		//Mat3x3 worldVertexPositions = { transformedTriangle.a.position, transformedTriangle.b.position, transformedTriangle.c.position };
-
-		//Mat4x4 projectionViewMatrix = projectionMatrix * viewMatrix;
-
-		//float lightDotTriangleNormalA = glm::max(glm::dot(lightDirFromTriangleA, triangleNorm), 0.1f);
-		//float lightDotTriangleNormalB = glm::max(glm::dot(lightDirFromTriangleB, triangleNorm), 0.1f);
-		//float lightDotTriangleNormalC = glm::max(glm::dot(lightDirFromTriangleC, triangleNorm), 0.1f);
-		float lightDotTriangleNormalA = glm::max(glm::dot(lightDirFromTriangleA, transformedTriangle.a.normal), 0.1f);
-		float lightDotTriangleNormalB = glm::max(glm::dot(lightDirFromTriangleB, transformedTriangle.b.normal), 0.1f);
-		float lightDotTriangleNormalC = glm::max(glm::dot(lightDirFromTriangleC, transformedTriangle.c.normal), 0.1f);
-
-		Vector3 lightDotTriangleVertexNormal = { lightDotTriangleNormalA, lightDotTriangleNormalB, lightDotTriangleNormalC };
-		//float lightDotTriangleNormal = glm::max(glm::dot(lightDirFromTriangle, normal), 0.1f);
-		//std::cout << lightDotTriangleVertexNormal.x << ", " << lightDotTriangleVertexNormal.y << ", " << lightDotTriangleVertexNormal.z << std::endl;
-
-		// Transform into view space.
-		Vector4 viewTransformedA = { viewMatrix * Vector4{transformedTriangle.a.position, 1.0f} };
-		Vector4 viewTransformedB = { viewMatrix * Vector4{transformedTriangle.b.position, 1.0f} };
-		Vector4 viewTransformedC = { viewMatrix * Vector4{transformedTriangle.c.position, 1.0f} };
-
-		// Clip Viewed Triangle against near plane, this could form two additional
-		// additional triangles.
-		int nClippedTriangles = 0;
-		Triangle curLargeTriangle = Triangle{ {viewTransformedA, modelTriangle.a.texCoord, modelTriangle.a.colour, transformedTriangle.a.normal}, {viewTransformedB, modelTriangle.b.texCoord, modelTriangle.b.colour, transformedTriangle.b.normal}, {viewTransformedC, modelTriangle.c.texCoord, modelTriangle.c.colour, transformedTriangle.c.normal }, colour_white };
-
-		std::vector<Triangle> zClippingOutputTriangles;
-		std::vector<Vector3> zClippingLightDotTriangleVertexNormal;
-		std::vector<Vector3> zClippingInvDepts;
-		//std::vector<Mat3x3> zClippingWorldVertexPositions;
-		//nClippedTriangles = TriangleClipAgainstPlane(planeNear, curLargeTriangle, lightDotTriangleVertexNormal, worldVertexPositions, zClippingOutputTriangles, zClippingLightDotTriangleVertexNormal, zClippingWorldVertexPositions);
-		nClippedTriangles = TriangleClipAgainstPlane(planeNear, curLargeTriangle, {0.0f, 0.0f, 0.0f}, lightDotTriangleVertexNormal, zClippingOutputTriangles, zClippingLightDotTriangleVertexNormal, zClippingInvDepts);
-
-		//if (nClippedTriangles != zClippingLightDotTriangleVertexNormal.size()) {
-		//	std::cout << "NOT EQUAL!!!" << std::endl;
-		//}
+		_mm256_store_ps(worldPositionOut[i], worldPosition[i]);
+		_mm256_store_ps(worldNormalOut[i], worldNormal[i]);
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		_mm256_store_ps(clipPositionOut[i], clipPosition[i]);
+	}
+	_mm256_store_ps(lightDotNormalOut, lightDotNormal);
+	_mm256_store_si256((__m256i*)clipOutcodesOut, clipOutcodes);
+	_mm256_store_si256((__m256i*)screenOutcodesOut, screenOutcodes);
+
+	for (int lane = 0; lane < numVerticesToStore; lane++)
+	{
+		TransformedVertex& transformedVertex = transformedVertices[firstVertex + lane];
+		transformedVertex.worldPosition = { worldPositionOut[0][lane], worldPositionOut[1][lane], worldPositionOut[2][lane] };
+		transformedVertex.worldNormal = { worldNormalOut[0][lane], worldNormalOut[1][lane], worldNormalOut[2][lane] };
+		transformedVertex.clipPosition = { clipPositionOut[0][lane], clipPositionOut[1][lane], clipPositionOut[2][lane], clipPositionOut[3][lane] };
+		transformedVertex.lightDotNormal = lightDotNormalOut[lane];
+		transformedVertex.clipOutcode = clipOutcodesOut[lane];
+		transformedVertex.screenOutcode = screenOutcodesOut[lane];
+	}
+}
+
+// Runs every vertex of the mesh through the draw's transforms and lights it, exactly once per frame.
+// With the AVX2 pixel kernel selected the vertices go through 8 at a time, K switches both back to the scalar path to compare.
+void TransformMeshVertices(const Mesh& currentMesh, const DrawConstants& drawConstants, std::vector<TransformedVertex>& transformedVertices) {
 
+	PROFILE_FUNCTION();
+
+	const ClipSpacePlane* clipPlanes = drawConstants.clipPlanes;
+
+	const VertexStreams& streams = currentMesh.vertexStreams;
+	transformedVertices.resize(streams.numVertices);
+
+	if (activePixelKernel == PIXEL_KERNEL_AVX2) {
+		for (int i = 0; i < streams.numVertices; i += vertexStreamBatchSize)
 		{
-			PROFILE_SCOPE("TESTING FOR CLIPPING.");
-			for (int n = 0; n < nClippedTriangles; n++)
-			{
-				// Transform into Homogeneous space.
-				Vector4 projectedPointA = { projectionMatrix * Vector4 {zClippingOutputTriangles[n].a.position, 1.0f} };
-				Vector4 projectedPointB = { projectionMatrix * Vector4 {zClippingOutputTriangles[n].b.position, 1.0f} };
-				Vector4 projectedPointC = { projectionMatrix * Vector4 {zClippingOutputTriangles[n].c.position, 1.0f} };
-
-				// Get W for interpolation in Screen Space.
-				Vector3 invW = Vector3{ 1.0f / projectedPointA.w, 1.0f / projectedPointB.w, 1.0f / projectedPointC.w };
-				//std::cout << invW.x << ", " << invW.y << ", " << invW.z << std::endl;
-
-
-				//Transform into NDC space.
-				projectedPointA = projectedPointA * invW.x;
-				projectedPointB = projectedPointB * invW.y;
-				projectedPointC = projectedPointC * invW.z;
-
-
-				// Get depth for Z-Buffer
-				Vector3 invDepth = Vector3{ 1.0f / projectedPointA.z, 1.0f / projectedPointB.z, 1.0f / projectedPointC.z };
-				//std::cout << invDepth.x << ", " << invDepth.y << ", " << invDepth.z << std::endl;
-
-				zClippingOutputTriangles[n].a.texCoord *= invW.x;
-				zClippingOutputTriangles[n].b.texCoord *= invW.y;
-				zClippingOutputTriangles[n].c.texCoord *= invW.z;
-
-				zClippingOutputTriangles[n].a.texCoord.z = invW.x;
-				zClippingOutputTriangles[n].b.texCoord.z = invW.y;
-				zClippingOutputTriangles[n].c.texCoord.z = invW.z;
-
-				zClippingLightDotTriangleVertexNormal[n].x *= invW.x;
-				zClippingLightDotTriangleVertexNormal[n].y *= invW.y;
-				zClippingLightDotTriangleVertexNormal[n].z *= invW.z;
-
-				zClippingOutputTriangles[n].a.colour *= invW.x;
-				zClippingOutputTriangles[n].b.colour *= invW.y;
-				zClippingOutputTriangles[n].c.colour *= invW.z;
-
-				zClippingOutputTriangles[n].a.normal *= invW.x;
-				zClippingOutputTriangles[n].b.normal *= invW.y;
-				zClippingOutputTriangles[n].c.normal *= invW.z;
-
-				//MultiplyFloatToVectorInMat3x3(zClippingWorldVertexPositions[n], 0, invW.x);
-				//MultiplyFloatToVectorInMat3x3(zClippingWorldVertexPositions[n], 1, invW.y);
-				//MultiplyFloatToVectorInMat3x3(zClippingWorldVertexPositions[n], 2, invW.z);
-
-				//Transform into Screen Space
-				projectedPointA.x += 1.0f; projectedPointA.y += 1.0f;
-				projectedPointB.x += 1.0f; projectedPointB.y += 1.0f;
-				projectedPointC.x += 1.0f; projectedPointC.y += 1.0f;
-
-				projectedPointA.x *= (0.5 * imageWidth); projectedPointA.y *= (0.5 * imageHeight);
-				projectedPointB.x *= (0.5 * imageWidth); projectedPointB.y *= (0.5 * imageHeight);
-				projectedPointC.x *= (0.5 * imageWidth); projectedPointC.y *= (0.5 * imageHeight);
-
-				//Triangle curLargeScreenSpaceTriangle = { {projectedPointA, clipped[n].a.texCoord * invW.x }, {projectedPointB, clipped[n].b.texCoord * invW.y }, {projectedPointC, clipped[n].c.texCoord * invW.z}, clipped[n].colour};
-				Triangle curLargeScreenSpaceTriangle = { {projectedPointA, zClippingOutputTriangles[n].a.texCoord, zClippingOutputTriangles[n].a.colour, zClippingOutputTriangles[n].a.normal },
-														 {projectedPointB, zClippingOutputTriangles[n].b.texCoord, zClippingOutputTriangles[n].b.colour, zClippingOutputTriangles[n].b.normal },
-														 {projectedPointC, zClippingOutputTriangles[n].c.texCoord, zClippingOutputTriangles[n].c.colour, zClippingOutputTriangles[n].c.normal },
-														 zClippingOutputTriangles[n].colour };
-
-				std::vector<Triangle> bottomScreenPlaneClippingResult;
-				std::vector<Vector3> bottomClippingLightDotTriangleNormal;
-				std::vector<Vector3> bottomClippingInvDepth;
-				//std::vector<Mat3x3> bottomClippingWorldPositions;
-				//TriangleClipAgainstPlane(planeBottomScreenSpace, curLargeScreenSpaceTriangle, zClippingLightDotTriangleVertexNormal[n], zClippingWorldVertexPositions[n], bottomScreenPlaneClippingResult, bottomClippingLightDotTriangleNormal, bottomClippingWorldPositions);
-				TriangleClipAgainstPlane(planeBottomScreenSpace, curLargeScreenSpaceTriangle, invDepth, zClippingLightDotTriangleVertexNormal[n], bottomScreenPlaneClippingResult, bottomClippingLightDotTriangleNormal, bottomClippingInvDepth);
-				
-				std::vector<Triangle> topScreenPlaneClippingResult;
-				std::vector<Vector3> topClippingLightDotTriangleNormal;
-				std::vector<Vector3> topClippingInvDepth;
-				//std::vector<Mat3x3> topClippingWorldPositions;
-				for (int i = 0; i < bottomScreenPlaneClippingResult.size(); i++)
-				{
-					//TriangleClipAgainstPlane(planeTopScreenSpace, bottomScreenPlaneClippingResult[i], bottomClippingLightDotTriangleNormal[i], bottomClippingWorldPositions[i], topScreenPlaneClippingResult, topClippingLightDotTriangleNormal, topClippingWorldPositions);
-					TriangleClipAgainstPlane(planeTopScreenSpace, bottomScreenPlaneClippingResult[i], bottomClippingInvDepth[i], bottomClippingLightDotTriangleNormal[i], topScreenPlaneClippingResult, topClippingLightDotTriangleNormal, topClippingInvDepth);
-				}
+			TransformVertexBatchAVX2(streams, i, std::min(vertexStreamBatchSize, streams.numVertices - i), drawConstants, clipPlanes, transformedVertices.data());
+		}
+	}
+	else {
+		for (int i = 0; i < streams.numVertices; i++)
+		{
+			TransformVertex(streams, i, drawConstants, clipPlanes, transformedVertices[i]);
+		}
+	}
+}
 
-				std::vector<Triangle> leftScreenPlaneClippingResult;
-				std::vector<Vector3> leftClippingLightDotTriangleNormal;
-				std::vector<Vector3> leftClippingInvDepth;
-				//std::vector<Mat3x3> leftClippingWorldPositions;
-				for (int i = 0; i < topScreenPlaneClippingResult.size(); i++)
-				{
-					//TriangleClipAgainstPlane(planeLeftScreenSpace, topScreenPlaneClippingResult[i], topClippingLightDotTriangleNormal[i], topClippingWorldPositions[i], leftScreenPlaneClippingResult, leftClippingLightDotTriangleNormal, leftClippingWorldPositions);
-					TriangleClipAgainstPlane(planeLeftScreenSpace, topScreenPlaneClippingResult[i], topClippingInvDepth[i], topClippingLightDotTriangleNormal[i], leftScreenPlaneClippingResult, leftClippingLightDotTriangleNormal, leftClippingInvDepth);
-				}
+// False when the triangle, once snapped, can't contain a pixel centre. Either it has no area or its bounding box falls between centres.
+// Uses the same snapping and pixel centre rule as the rasterizer, so nothing that would have drawn a pixel is dropped.
+bool CanTriangleCoverAPixelCentre(const Vector3& positionA, const Vector3& positionB, const Vector3& positionC) {
 
-				std::vector<Triangle> rightScreenPlaneClippingResult;
-				std::vector<Vector3> rightClippingLightDotTriangleNormal;
-				std::vector<Vector3> rightClippingInvDepth;
-				//std::vector<Mat3x3> rightClippingWorldPositions;
-				for (int i = 0; i < leftScreenPlaneClippingResult.size(); i++)
-				{
-					//TriangleClipAgainstPlane(planeRightScreenSpace, leftScreenPlaneClippingResult[i], leftClippingLightDotTriangleNormal[i], leftClippingWorldPositions[i], rightScreenPlaneClippingResult, rightClippingLightDotTriangleNormal, rightClippingWorldPositions);
-					TriangleClipAgainstPlane(planeRightScreenSpace, leftScreenPlaneClippingResult[i], leftClippingInvDepth[i], leftClippingLightDotTriangleNormal[i], rightScreenPlaneClippingResult, rightClippingLightDotTriangleNormal, rightClippingInvDepth);
-				}
-				//std::cout << "Drawing something." << std::endl;
-				//DrawTriangleOnScreenFromScreenSpaceBoundingBoxMethod(imageData, imageDepthData, imageWidth, imageHeight, curTriangleIndex, currentTextureIndex, curLargeScreenSpaceTriangle, normal, invDepth, invW, lineThickness);
-				for (int i = 0; i < rightScreenPlaneClippingResult.size(); i++)
-				{
-					totalTrianglesRendered++;
-					//DrawTriangleOnScreenFromScreenSpaceBresenhamMethod(imageData, imageDepthData, imageWidth, imageHeight, curTriangleIndex, currentTextureIndex, rightScreenPlaneClippingResult[i], rightClippingLightDotTriangleNormal[i], rightClippingWorldPositions[i], invDepth, invW, lineThickness);
-					DrawTriangleOnScreenFromScreenSpaceBresenhamMethod(imageData, imageDepthData, imageWidth, imageHeight, curTriangleIndex, currentTextureIndex, rightScreenPlaneClippingResult[i], rightClippingLightDotTriangleNormal[i], rightClippingInvDepth[i], invW, lineThickness);
-				}
+	Vector2Int a = SnapToSubpixelGrid(positionA);
+	Vector2Int b = SnapToSubpixelGrid(positionB);
+	Vector2Int c = SnapToSubpixelGrid(positionC);
+
+	if (((long long)(c.x - a.x) * (b.y - a.y)) - ((long long)(c.y - a.y) * (b.x - a.x)) == 0) {
+		return false;
+	}
+
+	int startX = (std::min(a.x, std::min(b.x, c.x)) - (subpixelSteps / 2) + (subpixelSteps - 1)) >> subpixelBits;
+	int startY = (std::min(a.y, std::min(b.y, c.y)) - (subpixelSteps / 2) + (subpixelSteps - 1)) >> subpixelBits;
+	int endX = (std::max(a.x, std::max(b.x, c.x)) - (subpixelSteps / 2)) >> subpixelBits;
+	int endY = (std::max(a.y, std::max(b.y, c.y)) - (subpixelSteps / 2)) >> subpixelBits;
+
+	return startX <= endX && startY <= endY;
+}
+
+// Culls, clips and projects one triangle whose vertices have already been through TransformMeshVertices.
+// Texture coordinates and colours are read from the mesh's vertex streams at indexA, indexB and indexC.
+// meshInsideFrustum is set when the mesh's bounds are entirely on screen, no vertex can be outside any plane then.
+// clipPlanes have to be the ones the vertices' clip outcodes were computed against, see DrawConstants.
+void DrawTriangleOnScreenFromTransformedVerticesWithClipping(std::vector<ScreenSpaceTriangle>& screenSpaceTriangles, int imageWidth, int imageHeight, int currentTextureIndex, unsigned int pixelFeatures, CullMode cullMode
+	, bool meshInsideFrustum, const ClipSpacePlane* clipPlanes, const VertexStreams& streams, uint32_t indexA, uint32_t indexB, uint32_t indexC
+	, const TransformedVertex& transformedA, const TransformedVertex& transformedB, const TransformedVertex& transformedC
+	, int& totalTrianglesRendered) {
+
+	PROFILE_FUNCTION();
+
+	{
+		// All three vertices outside the same plane, nothing of it can be on screen.
+		if (!meshInsideFrustum && ((transformedA.clipOutcode & transformedB.clipOutcode & transformedC.clipOutcode) != 0 ||
+			(transformedA.screenOutcode & transformedB.screenOutcode & transformedC.screenOutcode) != 0)) {
+			return;
+		}
+
+		// Faces are culled by the winding they'd have on screen rather than by vertex normals, which don't match the face on smoothed meshes.
+		if (IsTriangleCulled(ClipSpaceWindingDeterminant(transformedA.clipPosition, transformedB.clipPosition, transformedC.clipPosition), cullMode)) {
+			return;
+		}
+
+		ClipPolygon polygon;
+		polygon.numVertices = 3;
+		polygon.vertices[0] = { transformedA.clipPosition, GetStreamTexCoord(streams, indexA), GetStreamColour(streams, indexA), transformedA.worldNormal, transformedA.lightDotNormal };
+		polygon.vertices[1] = { transformedB.clipPosition, GetStreamTexCoord(streams, indexB), GetStreamColour(streams, indexB), transformedB.worldNormal, transformedB.lightDotNormal };
+		polygon.vertices[2] = { transformedC.clipPosition, GetStreamTexCoord(streams, indexC), GetStreamColour(streams, indexC), transformedC.worldNormal, transformedC.lightDotNormal };
+
+		// One clip pass against every plane the triangle actually crosses, fully inside triangles skip it.
+		unsigned int planesToClip = transformedA.clipOutcode | transformedB.clipOutcode | transformedC.clipOutcode;
+		if (!meshInsideFrustum && planesToClip != 0) {
+			PROFILE_SCOPE("CLIP SPACE CLIPPING.");
+			ClipPolygonAgainstPlanes(polygon, clipPlanes, numClipSpacePlanes, planesToClip);
+		}
+
+		if (polygon.numVertices < 3) {
+			return;
+		}
+
+		Point screenPoints[maxClipPolygonVertices];
+		float invDepths[maxClipPolygonVertices];
+		float lightDotNormals[maxClipPolygonVertices];
+
+		for (int n = 0; n < polygon.numVertices; n++)
+		{
+			const ClipVertex& vertex = polygon.vertices[n];
+
+			// Get W for interpolation in Screen Space.
+			float invW = 1.0f / vertex.position.w;
+
+			//Transform into NDC space.
+			Vector4 projectedPoint = vertex.position * invW;
+
+			// Get depth for Z-Buffer
+			invDepths[n] = 1.0f / projectedPoint.z;
+
+			screenPoints[n].texCoord = vertex.texCoord * invW;
+			screenPoints[n].texCoord.z = invW;
+			screenPoints[n].colour = vertex.colour * invW;
+			screenPoints[n].normal = vertex.normal * invW;
+			lightDotNormals[n] = vertex.lightDotNormal * invW;
+
+			//Transform into Screen Space
+			projectedPoint.x += 1.0f; projectedPoint.y += 1.0f;
+			projectedPoint.x *= (0.5 * imageWidth); projectedPoint.y *= (0.5 * imageHeight);
+
+			screenPoints[n].position = Vector3(projectedPoint);
+		}
+
+		// The clipped polygon is fanned once into screen space triangles.
+		for (int i = 1; i + 1 < polygon.numVertices; i++)
+		{
+			int fanB = i;
+			int fanC = i + 1;
+
+			// Slivers and triangles smaller than a pixel that miss every pixel centre never reach the rasterizer.
+			if (!CanTriangleCoverAPixelCentre(screenPoints[0].position, screenPoints[fanB].position, screenPoints[fanC].position)) {
+				continue;
 			}
+
+			totalTrianglesRendered++;
+			// Rasterized later by the tile renderer, see RasterizeScreenSpaceTrianglesInTiles.
+			screenSpaceTriangles.push_back({ Triangle{ screenPoints[0], screenPoints[fanB], screenPoints[fanC], colour_white }, Vector3{ lightDotNormals[0], lightDotNormals[fanB], lightDotNormals[fanC] },
+											 Vector3{ invDepths[0], invDepths[fanB], invDepths[fanC] }, Vector3{ screenPoints[0].texCoord.z, screenPoints[fanB].texCoord.z, screenPoints[fanC].texCoord.z }, currentTextureIndex, pixelFeatures });
 		}
 	}
 }
 
-void DrawMeshOnScreenFromWorldWithTransform(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, int imageWidth, int imageHeight, Mesh& currentMesh, Mat4x4& modelMatrix, Vector3 cameraPosition, Vector3 cameraDirection, Mat4x4& viewMatrix, Mat4x4& projectionMatrix, int lineThickness, Colour lineColour, int& totalTrianglesRendered, bool debugDraw = false) {
+// True when every triangle in the meshlet faces away from the camera (or towards it, for meshes culling front faces).
+// Conservative cone test against the bounding sphere, so it holds for the whole meshlet wherever the camera is.
+bool IsMeshletConeCulled(const Meshlet& meshlet, const Vector3& objectSpaceCameraPosition, CullMode cullMode) {
+
+	if (!meshlet.hasNormalCone || cullMode == CULL_MODE_NONE) {
+		return false;
+	}
+
+	Vector3 cameraToCentre = meshlet.boundingSphere.centre - objectSpaceCameraPosition;
+	Vector3 coneAxis = cullMode == CULL_MODE_BACK ? meshlet.coneAxis : -meshlet.coneAxis;
+	return glm::dot(cameraToCentre, coneAxis) >= (meshlet.coneCutoff * glm::length(cameraToCentre)) + meshlet.boundingSphere.radius;
+}
+
+// Transforms every vertex of the mesh once, then culls and clips every triangle. The resulting screen space triangles are appended to screenSpaceTriangles,
+// nothing is written to the image until they are binned and rasterized with RasterizeScreenSpaceTrianglesInTiles.
+void DrawMeshOnScreenFromWorldWithTransform(std::vector<ScreenSpaceTriangle>& screenSpaceTriangles, int imageWidth, int imageHeight, Mesh& currentMesh, const DrawConstants& drawConstants, OcclusionBuffer& occlusionBuffer, int& totalTrianglesRendered) {
 
 	PROFILE_FUNCTION();
 
-	for (int i = 0; i < currentMesh.triangles.size(); i++)
+	// Nothing of the mesh can be on screen, none of its vertices get transformed.
+	FrustumTestResult frustumTestResult = TestBoundsAgainstFrustum(drawConstants.frustum, currentMesh.bounds, currentMesh.boundingSphere);
+	if (frustumTestResult == FRUSTUM_OUTSIDE) {
+		return;
+	}
+	bool meshInsideFrustum = frustumTestResult == FRUSTUM_INSIDE;
+
+	// Hidden behind the occluders drawn into the occlusion buffer this frame.
+	if (IsAABBOccluded(occlusionBuffer, currentMesh.bounds, drawConstants.modelViewProjectionMatrix)) {
+		return;
+	}
+
+	// Meshlets that survive culling, and whether they're entirely inside the frustum.
+	static std::vector<unsigned int> visibleMeshlets;
+	static std::vector<bool> visibleMeshletInsideFrustum;
+	visibleMeshlets.clear();
+	visibleMeshletInsideFrustum.clear();
+
+	for (unsigned int i = 0; i < currentMesh.meshlets.size(); i++)
 	{
-		//std::cout << "READING MESH TEXTURE INDEX 0 : " << currentMesh.textureIndex << std::endl;
-		DrawTriangleOnScreenFromWorldTriangleWithClipping(imageData, imageDepthData, imageWidth, imageHeight, i, currentMesh.textureIndex, currentMesh.triangles[i], modelMatrix, cameraPosition, cameraDirection, viewMatrix, projectionMatrix, lineThickness, lineColour, totalTrianglesRendered, debugDraw);
+		const Meshlet& meshlet = currentMesh.meshlets[i];
+
+		FrustumTestResult meshletFrustumTestResult = meshInsideFrustum ? FRUSTUM_INSIDE : TestBoundsAgainstFrustum(drawConstants.frustum, meshlet.bounds, meshlet.boundingSphere);
+		if (meshletFrustumTestResult == FRUSTUM_OUTSIDE || IsMeshletConeCulled(meshlet, drawConstants.cameraPosition, currentMesh.cullMode)) {
+			continue;
+		}
+
+		if (IsAABBOccluded(occlusionBuffer, meshlet.bounds, drawConstants.modelViewProjectionMatrix)) {
+			continue;
+		}
+
+		visibleMeshlets.push_back(i);
+		visibleMeshletInsideFrustum.push_back(meshletFrustumTestResult == FRUSTUM_INSIDE);
+	}
+
+	if (visibleMeshlets.empty()) {
+		return;
+	}
+
+	// Reused for every mesh and every frame, so it only allocates when a mesh with more vertices than any before it shows up.
+	static std::vector<TransformedVertex> transformedVertices;
+	TransformMeshVertices(currentMesh, drawConstants, transformedVertices);
+
+	// Each meshlet is placed by its nearest vertex, clipPosition.w is already the view depth so this costs no extra transforms.
+	static std::vector<float> meshletViewDepths;
+	static std::vector<DepthSortEntry> meshletOrder;
+	static std::vector<DepthSortEntry> meshletOrderScratch;
+
+	meshletViewDepths.resize(visibleMeshlets.size());
+	for (int i = 0; i < visibleMeshlets.size(); i++)
+	{
+		float nearestViewDepth = FLT_MAX;
+		if (activeDepthSortMode == DEPTH_SORT_MESHES_AND_CLUSTERS) {
+			const Meshlet& meshlet = currentMesh.meshlets[visibleMeshlets[i]];
+			for (uint32_t index = meshlet.firstIndex; index < meshlet.firstIndex + (meshlet.numTriangles * 3); index++)
+			{
+				nearestViewDepth = std::min(nearestViewDepth, transformedVertices[currentMesh.indices[index]].clipPosition.w);
+			}
+		}
+		meshletViewDepths[i] = nearestViewDepth;
+	}
+
+	QuantizeViewDepths(meshletViewDepths, meshletOrder);
+	if (activeDepthSortMode == DEPTH_SORT_MESHES_AND_CLUSTERS) {
+		RadixSortDepthSortEntries(meshletOrder, meshletOrderScratch);
+	}
+
+	// Decides which instantiation of the pixel functions every triangle of the mesh is drawn with.
+	unsigned int meshPixelFeatures = GetMeshPixelFeatures(currentMesh);
+
+	for (int i = 0; i < meshletOrder.size(); i++)
+	{
+		int visibleIndex = meshletOrder[i].index;
+		const Meshlet& meshlet = currentMesh.meshlets[visibleMeshlets[visibleIndex]];
+		bool meshletInsideFrustum = visibleMeshletInsideFrustum[visibleIndex];
+
+		for (uint32_t index = meshlet.firstIndex; index < meshlet.firstIndex + (meshlet.numTriangles * 3); index += 3)
+		{
+			uint32_t indexA = currentMesh.indices[index + 0];
+			uint32_t indexB = currentMesh.indices[index + 1];
+			uint32_t indexC = currentMesh.indices[index + 2];
+
+			DrawTriangleOnScreenFromTransformedVerticesWithClipping(screenSpaceTriangles, imageWidth, imageHeight, currentMesh.textureIndex, meshPixelFeatures, currentMesh.cullMode,
+				meshletInsideFrustum, drawConstants.clipPlanes, currentMesh.vertexStreams, indexA, indexB, indexC,
+				transformedVertices[indexA], transformedVertices[indexB], transformedVertices[indexC],
+				totalTrianglesRendered);
+		}
 	}
 }
\ No newline at end of file
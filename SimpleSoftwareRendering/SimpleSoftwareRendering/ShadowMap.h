@@ -0,0 +1,200 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "Instrumentor.h"
+
+#include "Geometry.h"
+#include "Model.h"
+#include "ThreadPool.h"
+#include "OcclusionCulling.h"
+#include "RenderGeometry.h"
+#include "TileRenderer.h"
+#include "RayTracedShadows.h"
+#include "WorldConstants.h"
+
+// Which pass, if any, puts shadows on the finished frame. Both reconstruct the surface under each pixel from the depth buffer the same way.
+enum ShadowMode {
+	SHADOW_MODE_NONE,
+	SHADOW_MODE_RAY_TRACED,		// An any hit ray per pixel through the model's BVH, see RayTracedShadows.h.
+	SHADOW_MODE_SHADOW_MAP,		// The model's depth as the light sees it, looked up with PCF.
+	NUM_SHADOW_MODES
+};
+
+const char* shadowModeNames[NUM_SHADOW_MODES] = { "Off", "Ray traced", "Shadow map" };
+
+ShadowMode activeShadowMode = SHADOW_MODE_NONE;
+
+// Depth of the model as seen from the light, drawn with the regular vertex and clipping path and the depth only rasterizer.
+// Like the screen it's split into tiles that are rasterized in parallel.
+struct ShadowMap {
+
+	int size;
+	std::vector<float> depthData;		// NDC z like imageDepthData, bigger is nearer the light and 0 is nothing.
+	RenderTileGrid tileGrid;
+	std::vector<ScreenSpaceTriangle> screenSpaceTriangles;
+	OcclusionBuffer noOccluders;		// Never drawn into, the light's view has no occluders picked for it.
+
+	// Of the last RenderShadowMap.
+	DrawConstants lightDrawConstants;
+	float nearPlane, farPlane;
+	float texelSizePerUnitDepth;		// Width of a texel at distance 1 from the light.
+};
+
+void InitShadowMap(ShadowMap& shadowMap, int size) {
+
+	shadowMap.size = size;
+	shadowMap.depthData.resize(size * size);
+	InitRenderTileGrid(shadowMap.tileGrid, size, size);
+	InitOcclusionBuffer(shadowMap.noOccluders);
+}
+
+// WORLD SPACE!!! Looks from the light at the centre of the model's bounding sphere with a square frustum just wide enough for all of it,
+// so the whole map is spent on the one thing that can cast a shadow. Built like the camera's, looking down +z.
+void ComputeLightDrawConstants(ShadowMap& shadowMap, const Model& model, const Mat4x4& modelMatrix, const Vector3& lightPosition) {
+
+	const Mat4x4 flipY = glm::scale(glm::identity<Mat4x4>(), Vector3{ 1.0f, -1.0f, 1.0f });
+	Mat4x4 worldMatrix = flipY * modelMatrix;
+
+	Vector3 centre = Vector3(worldMatrix * Vector4(model.boundingSphere.centre, 1.0f));
+	float scale = std::max(glm::length(Vector3(worldMatrix[0])), std::max(glm::length(Vector3(worldMatrix[1])), glm::length(Vector3(worldMatrix[2]))));
+	float radius = model.boundingSphere.radius * scale * shadowMapFrustumMargin;
+
+	Vector3 toCentre = centre - lightPosition;
+	float distance = glm::length(toCentre);
+	Vector3 forward = distance > 0.0f ? toCentre / distance : worldForward;
+	Vector3 up = std::abs(glm::dot(forward, worldUP)) > 0.99f ? worldForward : worldUP;
+	Vector3 right = glm::normalize(glm::cross(up, forward));
+	up = glm::cross(forward, right);
+
+	Mat4x4 lightTransformMatrix = Mat4x4(Vector4(right, 0.0f), Vector4(up, 0.0f), Vector4(forward, 0.0f), Vector4(lightPosition, 1.0f));
+	Mat4x4 lightViewMatrix = glm::inverse(lightTransformMatrix);
+
+	float maxHalfFov = glm::radians(shadowMapMaxHalfFovDegrees);
+	float halfFov = distance > radius ? std::min(std::asin(radius / distance), maxHalfFov) : maxHalfFov;
+	shadowMap.nearPlane = std::max(distance - radius, nearPlaneDistance);
+	shadowMap.farPlane = std::max(distance + radius, shadowMap.nearPlane * 2.0f);
+	shadowMap.texelSizePerUnitDepth = (2.0f * std::tan(halfFov)) / shadowMap.size;
+
+	Mat4x4 lightProjectionMatrix = glm::perspectiveFovRH_NO(2.0f * halfFov, (float)shadowMap.size, (float)shadowMap.size, shadowMap.nearPlane, shadowMap.farPlane);
+	shadowMap.lightDrawConstants = ComputeDrawConstants(modelMatrix, lightViewMatrix, lightProjectionMatrix, lightPosition);
+	// The guard band is sized for the screen, on a bigger map it would let triangles past the 2048 pixels the edge functions allow.
+	// The caster fits inside the light's frustum anyway, so clipping to it exactly costs nothing.
+	shadowMap.lightDrawConstants.clipPlanes = clipSpacePlanesScreen;
+}
+
+void RenderShadowMap(ShadowMap& shadowMap, Model& model, const Mat4x4& modelMatrix, const Vector3& lightPosition, ThreadPool& threadPool) {
+
+	PROFILE_FUNCTION();
+
+	ComputeLightDrawConstants(shadowMap, model, modelMatrix, lightPosition);
+	std::fill(shadowMap.depthData.begin(), shadowMap.depthData.end(), 0.0f);
+	shadowMap.screenSpaceTriangles.clear();
+	ClearOcclusionBuffer(shadowMap.noOccluders);
+
+	int totalTrianglesRendered = 0;
+	for (int i = 0; i < model.meshes.size(); i++)
+	{
+		DrawMeshOnScreenFromWorldWithTransform(shadowMap.screenSpaceTriangles, shadowMap.size, shadowMap.size, model.meshes[i], shadowMap.lightDrawConstants, shadowMap.noOccluders, totalTrianglesRendered);
+	}
+
+	RasterizeScreenSpaceTrianglesDepthOnlyInTiles(shadowMap.depthData, shadowMap.size, shadowMap.size, shadowMap.screenSpaceTriangles, shadowMap.tileGrid, threadPool);
+}
+
+// What the light's projection turns a distance from the light into, NDC z = (f + n) / (f - n) + 2fn / ((f - n) * w) for our negated one.
+float LightDistanceToShadowMapDepth(const ShadowMap& shadowMap, float distance) {
+
+	float n = shadowMap.nearPlane;
+	float f = shadowMap.farPlane;
+	return ((f + n) / (f - n)) + ((2.0f * f * n) / ((f - n) * distance));
+}
+
+// OBJECT SPACE!!! Fraction of the PCF taps around the point that hold something nearer the light than it, 0 is fully lit.
+// Taps off the map or where nothing was drawn are lit, only the model casts shadows.
+// A texel covers a stretch of surface whose depth changes by tan(angle to the light) texel widths across it, so the bias grows with that slope.
+float SampleShadowMapPCF(const ShadowMap& shadowMap, const Vector3& position, float lightDotNormal) {
+
+	Vector4 clipPosition = shadowMap.lightDrawConstants.modelViewProjectionMatrix * Vector4(position, 1.0f);
+	if (clipPosition.w < shadowMap.nearPlane) {
+		return 0.0f;
+	}
+
+	float invW = 1.0f / clipPosition.w;
+	int centreX = (int)floorf(((clipPosition.x * invW) + 1.0f) * (0.5f * shadowMap.size));
+	int centreY = (int)floorf(((clipPosition.y * invW) + 1.0f) * (0.5f * shadowMap.size));
+	// The bias is worked out as a distance, then compared in NDC z like the map stores it.
+	float slope = std::sqrt(std::max(1.0f - (lightDotNormal * lightDotNormal), 0.0f)) / lightDotNormal;
+	float bias = shadowMapDepthBiasTexels * (1.0f + slope) * shadowMap.texelSizePerUnitDepth * clipPosition.w;
+	float receiverDepth = LightDistanceToShadowMapDepth(shadowMap, clipPosition.w - bias);
+
+	int numTaps = 0;
+	int numOccludedTaps = 0;
+	for (int y = centreY - shadowMapPCFRadius; y <= centreY + shadowMapPCFRadius; y++)
+	{
+		for (int x = centreX - shadowMapPCFRadius; x <= centreX + shadowMapPCFRadius; x++)
+		{
+			numTaps++;
+			if (x < 0 || y < 0 || x >= shadowMap.size || y >= shadowMap.size) {
+				continue;
+			}
+
+			float depth = shadowMap.depthData[GetFlattenedImageDataSlotForDepthData(Vector2Int{ x, y }, shadowMap.size)];
+			if (depth > receiverDepth) {
+				numOccludedTaps++;
+			}
+		}
+	}
+	return (float)numOccludedTaps / numTaps;
+}
+
+// Same surface reconstruction as the ray traced shadows, the point is pushed off the surface along its normal before the lookup so it doesn't shadow itself.
+void ApplyShadowMapToTile(std::vector<unsigned char>& imageData, const std::vector<float>& imageDepthData, int imageWidth, int imageHeight,
+	const ShadowMap& shadowMap, const ShadowRayConstants& shadowRayConstants, const Vector2Int& scissorMin, const Vector2Int& scissorMax, ShadowTileScratch& scratch) {
+
+	PROFILE_FUNCTION();
+
+	int tileWidth = scissorMax.x - scissorMin.x + 1;
+	int tileHeight = scissorMax.y - scissorMin.y + 1;
+	int stride = tileWidth + 2;
+
+	std::vector<Vector3>& positions = scratch.positions;
+	std::vector<uint8_t>& hasPosition = scratch.hasPosition;
+	UnprojectTileWithBorder(shadowRayConstants, imageDepthData, imageWidth, imageHeight, scissorMin, scissorMax, positions, hasPosition);
+
+	for (int y = 0; y < tileHeight; y++)
+	{
+		for (int x = 0; x < tileWidth; x++)
+		{
+			Vector3 lookupPosition;
+			float lightDotNormal;
+			if (!PrepareShadowRay(shadowRayConstants, positions, hasPosition, stride, (x + 1) + ((y + 1) * stride), lookupPosition, lightDotNormal)) {
+				continue;
+			}
+
+			float shadowAmount = SampleShadowMapPCF(shadowMap, lookupPosition, lightDotNormal);
+			if (shadowAmount > 0.0f) {
+				DarkenShadowedPixel(imageData, imageWidth, scissorMin.x + x, scissorMin.y + y, lightDotNormal, shadowAmount);
+			}
+		}
+	}
+}
+
+// drawConstants are the camera's, the pixels are unprojected with them into the same object space the light's view was drawn from.
+void ApplyShadowMapInTiles(std::vector<unsigned char>& imageData, const std::vector<float>& imageDepthData, int imageWidth, int imageHeight,
+	const ShadowMap& shadowMap, const DrawConstants& drawConstants, RenderTileGrid& tileGrid, ThreadPool& threadPool) {
+
+	PROFILE_FUNCTION();
+
+	ShadowRayConstants shadowRayConstants = ComputeShadowRayConstants(drawConstants);
+
+	threadPool.ParallelFor(tileGrid.numTiles.x * tileGrid.numTiles.y, [&](int tileIndex) {
+
+		Vector2Int tileCoords = { tileIndex % tileGrid.numTiles.x, tileIndex / tileGrid.numTiles.x };
+		Vector2Int scissorMin = tileCoords * renderTileSize;
+		Vector2Int scissorMax = { std::min(scissorMin.x + renderTileSize, imageWidth) - 1, std::min(scissorMin.y + renderTileSize, imageHeight) - 1 };
+
+		ApplyShadowMapToTile(imageData, imageDepthData, imageWidth, imageHeight, shadowMap, shadowRayConstants, scissorMin, scissorMax, tileGrid.shadowScratchInTile[tileIndex]);
+	});
+}
\ No newline at end of file
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+// Fixed set of worker threads that are kept alive for the whole run, so handing out work every frame doesn't pay for thread creation.
+// The thread calling ParallelFor works on the jobs too, so a pool created for N hardware threads only spawns N - 1 workers.
+class ThreadPool
+{
+	std::vector<std::thread>			m_workers;
+	std::mutex							m_lock;
+	std::condition_variable				m_wakeCondition;
+	std::condition_variable				m_doneCondition;
+
+	const std::function<void(int)>*		m_job = nullptr;
+	int									m_jobCount = 0;
+	std::atomic<int>					m_nextJobIndex{ 0 };
+	unsigned int						m_busyWorkers = 0;
+	unsigned long long					m_generation = 0;
+	bool								m_stop = false;
+
+	void RunJobs()
+	{
+		for (int jobIndex = m_nextJobIndex++; jobIndex < m_jobCount; jobIndex = m_nextJobIndex++)
+		{
+			(*m_job)(jobIndex);
+		}
+	}
+
+	void WorkerLoop()
+	{
+		unsigned long long seenGeneration = 0;
+
+		while (true)
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_wakeCondition.wait(lock, [&]() { return m_stop || m_generation != seenGeneration; });
+
+			if (m_stop) { return; }
+
+			seenGeneration = m_generation;
+			lock.unlock();
+
+			RunJobs();
+
+			lock.lock();
+			if (--m_busyWorkers == 0) { m_doneCondition.notify_all(); }
+		}
+	}
+
+public:
+
+	ThreadPool(unsigned int numThreads = std::thread::hardware_concurrency())
+	{
+		for (unsigned int i = 1; i < numThreads; i++)
+		{
+			m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stop = true;
+		}
+		m_wakeCondition.notify_all();
+
+		for (int i = 0; i < m_workers.size(); i++)
+		{
+			m_workers[i].join();
+		}
+	}
+
+	unsigned int NumThreads() const
+	{
+		return m_workers.size() + 1;
+	}
+
+	// Calls job(i) for every i in [0, count) and only returns once all of them have finished.
+	// Indices are handed out one at a time so uneven jobs (busy vs empty screen tiles) still balance across threads.
+	void ParallelFor(int count, const std::function<void(int)>& job)
+	{
+		if (count <= 0) { return; }
+
+		if (m_workers.empty() || count == 1)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				job(i);
+			}
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_job = &job;
+			m_jobCount = count;
+			m_nextJobIndex = 0;
+			m_busyWorkers = m_workers.size();
+			m_generation++;
+		}
+		m_wakeCondition.notify_all();
+
+		RunJobs();
+
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_doneCondition.wait(lock, [&]() { return m_busyWorkers == 0; });
+		m_job = nullptr;
+	}
+};
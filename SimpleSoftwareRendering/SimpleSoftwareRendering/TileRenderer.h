@@ -0,0 +1,257 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "ThreadPool.h"
+#include "RenderGeometry.h"
+
+// Working memory of the shadow passes, one per tile so threads never share it. Kept between frames, once every tile
+// has been through a pass at full size they stop allocating.
+struct ShadowTileScratch {
+
+	std::vector<Vector3> positions;			// With a one pixel border, see UnprojectTileWithBorder.
+	std::vector<uint8_t> hasPosition;
+	std::vector<Vector3> rayOrigins;
+	std::vector<float> lightDotNormals;
+	std::vector<uint8_t> inShadow;
+	std::vector<int> quadRayPixel;
+};
+
+// Screen is split into fixed size tiles, every screen space triangle is added to each tile its bounding box touches.
+// Tiles never share pixels, so each one can be rasterized by a different thread without any locking on imageData/imageDepthData.
+struct RenderTileGrid {
+
+	Vector2Int numTiles;
+	std::vector<std::vector<unsigned int>> triangleIndicesInTile;
+	std::vector<FragmentCounters> fragmentCountersInTile;	// Of the last frame, see SumFragmentCounters.
+	std::vector<ShadowTileScratch> shadowScratchInTile;
+};
+
+int GetRenderTileIndex(const int& xCoord, const int& yCoord, const int& numTilesX) {
+	return xCoord + (yCoord * numTilesX);
+}
+
+void InitRenderTileGrid(RenderTileGrid& tileGrid, int imageWidth, int imageHeight) {
+
+	tileGrid.numTiles = { (imageWidth + renderTileSize - 1) / renderTileSize, (imageHeight + renderTileSize - 1) / renderTileSize };
+	tileGrid.triangleIndicesInTile.resize(tileGrid.numTiles.x * tileGrid.numTiles.y);
+	tileGrid.fragmentCountersInTile.resize(tileGrid.numTiles.x * tileGrid.numTiles.y);
+	tileGrid.shadowScratchInTile.resize(tileGrid.numTiles.x * tileGrid.numTiles.y);
+}
+
+FragmentCounters SumFragmentCounters(const RenderTileGrid& tileGrid) {
+
+	FragmentCounters total;
+	for (int i = 0; i < tileGrid.fragmentCountersInTile.size(); i++)
+	{
+		total += tileGrid.fragmentCountersInTile[i];
+	}
+	return total;
+}
+
+void BinScreenSpaceTrianglesIntoTiles(RenderTileGrid& tileGrid, const std::vector<ScreenSpaceTriangle>& screenSpaceTriangles, int imageWidth, int imageHeight) {
+
+	PROFILE_FUNCTION();
+
+	for (int i = 0; i < tileGrid.triangleIndicesInTile.size(); i++)
+	{
+		// clear() keeps the capacity around, so after the first few frames binning doesn't allocate.
+		tileGrid.triangleIndicesInTile[i].clear();
+	}
+
+	for (unsigned int i = 0; i < screenSpaceTriangles.size(); i++)
+	{
+		const Triangle& curTriangle = screenSpaceTriangles[i].triangle;
+
+		float minX = std::min(curTriangle.a.position.x, std::min(curTriangle.b.position.x, curTriangle.c.position.x));
+		float minY = std::min(curTriangle.a.position.y, std::min(curTriangle.b.position.y, curTriangle.c.position.y));
+		float maxX = std::max(curTriangle.a.position.x, std::max(curTriangle.b.position.x, curTriangle.c.position.x));
+		float maxY = std::max(curTriangle.a.position.y, std::max(curTriangle.b.position.y, curTriangle.c.position.y));
+
+		int startPixelX = std::max((int)floor(minX), 0);
+		int startPixelY = std::max((int)floor(minY), 0);
+		int endPixelX = std::min((int)ceil(maxX), imageWidth - 1);
+		int endPixelY = std::min((int)ceil(maxY), imageHeight - 1);
+
+		if (startPixelX > endPixelX || startPixelY > endPixelY) {
+			continue;
+		}
+
+		for (int y = startPixelY / renderTileSize; y <= endPixelY / renderTileSize; y++)
+		{
+			for (int x = startPixelX / renderTileSize; x <= endPixelX / renderTileSize; x++)
+			{
+				tileGrid.triangleIndicesInTile[GetRenderTileIndex(x, y, tileGrid.numTiles.x)].push_back(i);
+			}
+		}
+	}
+}
+
+void RasterizeTile(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, std::vector<unsigned int>& visibilityData, int imageWidth, int imageHeight,
+	const std::vector<ScreenSpaceTriangle>& screenSpaceTriangles, RenderTileGrid& tileGrid, HiZBuffer& hiZ, int tileIndex) {
+
+	PROFILE_FUNCTION();
+
+	Vector2Int tileCoords = { tileIndex % tileGrid.numTiles.x, tileIndex / tileGrid.numTiles.x };
+	Vector2Int scissorMin = tileCoords * renderTileSize;
+	Vector2Int scissorMax = { std::min(scissorMin.x + renderTileSize, imageWidth) - 1, std::min(scissorMin.y + renderTileSize, imageHeight) - 1 };
+
+	FragmentCounters& fragmentCounters = tileGrid.fragmentCountersInTile[tileIndex];
+	fragmentCounters = FragmentCounters();
+
+	// Only this tile's pixels are ever read back by ShadeVisibilityBufferTile, so it clears them itself instead of a whole screen clear.
+	if (activeRenderMode == RENDER_MODE_VISIBILITY_BUFFER) {
+		for (int y = scissorMin.y; y <= scissorMax.y; y++)
+		{
+			int rowStart = GetFlattenedImageDataSlotForDepthData(Vector2Int{ scissorMin.x, y }, imageWidth);
+			std::fill(visibilityData.begin() + rowStart, visibilityData.begin() + rowStart + (scissorMax.x - scissorMin.x + 1), emptyVisibilityID);
+		}
+	}
+
+	// Triangles are binned in submission order, so each pixel sees the same sequence of depth tests as a single threaded draw would.
+	const std::vector<unsigned int>& triangleIndices = tileGrid.triangleIndicesInTile[tileIndex];
+	for (int i = 0; i < triangleIndices.size(); i++)
+	{
+		const ScreenSpaceTriangle& curTriangle = screenSpaceTriangles[triangleIndices[i]];
+		DrawTriangleOnScreenFromScreenSpaceHalfSpaceMethod(imageData, imageDepthData, visibilityData, imageWidth, imageHeight, triangleIndices[i], curTriangle.textureIndex, curTriangle.pixelFeatures,
+			curTriangle.triangle, curTriangle.lightDotTriangleNormals, curTriangle.invDepth, curTriangle.invW, scissorMin, scissorMax, hiZ, fragmentCounters);
+	}
+
+	// Tiles written by the bin's last triangles haven't been looked at since, they're rebuilt once so the Hi-Z buffer matches the finished tile.
+	RefreshDirtyHiZTiles(hiZ, imageDepthData, imageWidth, imageHeight, scissorMin / hiZTileSize, scissorMax / hiZTileSize);
+}
+
+// Depth only version of RasterizeTile, for shadow maps. Fragment counters are kept per tile like the main pass, they just count the light's view.
+void RasterizeTileDepthOnly(std::vector<float>& depthData, int imageWidth, int imageHeight, const std::vector<ScreenSpaceTriangle>& screenSpaceTriangles, RenderTileGrid& tileGrid, int tileIndex) {
+
+	PROFILE_FUNCTION();
+
+	Vector2Int tileCoords = { tileIndex % tileGrid.numTiles.x, tileIndex / tileGrid.numTiles.x };
+	Vector2Int scissorMin = tileCoords * renderTileSize;
+	Vector2Int scissorMax = { std::min(scissorMin.x + renderTileSize, imageWidth) - 1, std::min(scissorMin.y + renderTileSize, imageHeight) - 1 };
+
+	FragmentCounters& fragmentCounters = tileGrid.fragmentCountersInTile[tileIndex];
+	fragmentCounters = FragmentCounters();
+
+	const std::vector<unsigned int>& triangleIndices = tileGrid.triangleIndicesInTile[tileIndex];
+	for (int i = 0; i < triangleIndices.size(); i++)
+	{
+		const ScreenSpaceTriangle& curTriangle = screenSpaceTriangles[triangleIndices[i]];
+		DrawTriangleDepthOnlyHalfSpaceMethod(depthData, imageWidth, curTriangle.triangle, curTriangle.invDepth, scissorMin, scissorMax, fragmentCounters);
+	}
+}
+
+// Second pass of the visibility buffer mode, shades every covered pixel of the tile exactly once with the triangle that won its depth test.
+// Pixels are walked in the same blocks the rasterizer uses, a block with pixels from several triangles is shaded once per triangle with only that triangle's lanes enabled.
+void ShadeVisibilityBufferTile(std::vector<unsigned char>& imageData, const std::vector<unsigned int>& visibilityData, int imageWidth, int imageHeight,
+	const std::vector<ScreenSpaceTriangle>& screenSpaceTriangles, RenderTileGrid& tileGrid, int tileIndex) {
+
+	PROFILE_FUNCTION();
+
+	Vector2Int tileCoords = { tileIndex % tileGrid.numTiles.x, tileIndex / tileGrid.numTiles.x };
+	Vector2Int scissorMin = tileCoords * renderTileSize;
+	Vector2Int scissorMax = { std::min(scissorMin.x + renderTileSize, imageWidth) - 1, std::min(scissorMin.y + renderTileSize, imageHeight) - 1 };
+
+	FragmentCounters& fragmentCounters = tileGrid.fragmentCountersInTile[tileIndex];
+
+	PixelKernel pixelKernel = activePixelKernel;
+	int pixelBlockWidth = pixelKernel == PIXEL_KERNEL_AVX2 ? 8 : 4;
+
+	// Neighbouring pixels mostly belong to the same triangle, so the setup is only redone when the ID changes.
+	TriangleSetup setup;
+	unsigned int setupID = emptyVisibilityID;
+	bool setupValid = false;
+
+	for (int y = scissorMin.y; y <= scissorMax.y; y++)
+	{
+		for (int blockStartX = scissorMin.x; blockStartX <= scissorMax.x; blockStartX += hiZTileSize)
+		{
+			// Same choice as the rasterizer makes, so a pixel goes through the same (scalar or SIMD) shading in both modes.
+			bool shadeWithBlocks = pixelKernel != PIXEL_KERNEL_SCALAR && blockStartX + hiZTileSize - 1 <= scissorMax.x;
+			int blockWidth = shadeWithBlocks ? pixelBlockWidth : 1;
+			int blockEndX = std::min(blockStartX + hiZTileSize - 1, scissorMax.x);
+
+			for (int x = blockStartX; x <= blockEndX; x += blockWidth)
+			{
+				int depthDataIndex = GetFlattenedImageDataSlotForDepthData(Vector2Int{ x, y }, imageWidth);
+				const unsigned int* blockIDs = &visibilityData[depthDataIndex];
+
+				// Each distinct ID in the block gets one shading call, lanes already handled are marked done.
+				int laneDone[8] = { 0 };
+				for (int lane = 0; lane < blockWidth; lane++)
+				{
+					unsigned int visibilityID = blockIDs[lane];
+					if (laneDone[lane] || visibilityID == emptyVisibilityID) {
+						continue;
+					}
+
+					int laneMask[8] = { 0 };
+					for (int otherLane = lane; otherLane < blockWidth; otherLane++)
+					{
+						if (blockIDs[otherLane] == visibilityID) {
+							laneMask[otherLane] = -1;
+							laneDone[otherLane] = 1;
+							fragmentCounters.fragmentsShaded++;
+						}
+					}
+
+					if (visibilityID != setupID) {
+						const ScreenSpaceTriangle& curTriangle = screenSpaceTriangles[GetScreenSpaceTriangleIndex(visibilityID)];
+						setupValid = SetupScreenSpaceTriangle(curTriangle.textureIndex, curTriangle.pixelFeatures, curTriangle.triangle, curTriangle.lightDotTriangleNormals, curTriangle.invDepth, curTriangle.invW, setup);
+						setupID = visibilityID;
+					}
+
+					// Can't happen for an ID the rasterizer wrote, a zero area triangle never covers a pixel.
+					if (!setupValid) {
+						continue;
+					}
+
+					Vector3Int edge = EdgeFunctionsAtPixel(setup, x, y);
+					int index = GetRedFlattenedImageDataSlotForPixel(Vector2Int{ x, y }, imageWidth);
+					if (!shadeWithBlocks) {
+						PixelRenderingData prd = { setup.lightDotTriangleNormals, setup.deltaYFloat, setup.deltaXFloat, setup.deltaKFloat, setup.areaOfTriangle, setup.invDepth, setup.invW, setup.texW, setup.triangle,
+												   setup.pbd.fixedColour, setup.curTex, scissorMin, scissorMax, fragmentCounters };
+						setup.pipeline.shadePixel(imageWidth, Vector2Int{ x, y }, edge.x * setup.invAreaOfTriangle, edge.y * setup.invAreaOfTriangle, edge.z * setup.invAreaOfTriangle, prd, imageData);
+					}
+					else if (pixelKernel == PIXEL_KERNEL_AVX2) {
+						setup.pipeline.shadePixelBlockWithMaskAVX2(setup.pbd, edge, laneMask, &imageData[index]);
+					}
+					else {
+						setup.pipeline.shadePixelBlockWithMaskSSE(setup.pbd, edge, laneMask, &imageData[index]);
+					}
+				}
+			}
+		}
+	}
+}
+
+void RasterizeScreenSpaceTrianglesInTiles(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, std::vector<unsigned int>& visibilityData, int imageWidth, int imageHeight,
+	const std::vector<ScreenSpaceTriangle>& screenSpaceTriangles, RenderTileGrid& tileGrid, HiZBuffer& hiZ, ThreadPool& threadPool) {
+
+	PROFILE_FUNCTION();
+
+	BinScreenSpaceTrianglesIntoTiles(tileGrid, screenSpaceTriangles, imageWidth, imageHeight);
+
+	threadPool.ParallelFor(tileGrid.triangleIndicesInTile.size(), [&](int tileIndex) {
+		RasterizeTile(imageData, imageDepthData, visibilityData, imageWidth, imageHeight, screenSpaceTriangles, tileGrid, hiZ, tileIndex);
+	});
+
+	if (activeRenderMode == RENDER_MODE_VISIBILITY_BUFFER) {
+		threadPool.ParallelFor(tileGrid.triangleIndicesInTile.size(), [&](int tileIndex) {
+			ShadeVisibilityBufferTile(imageData, visibilityData, imageWidth, imageHeight, screenSpaceTriangles, tileGrid, tileIndex);
+		});
+	}
+}
+
+void RasterizeScreenSpaceTrianglesDepthOnlyInTiles(std::vector<float>& depthData, int imageWidth, int imageHeight, const std::vector<ScreenSpaceTriangle>& screenSpaceTriangles,
+	RenderTileGrid& tileGrid, ThreadPool& threadPool) {
+
+	PROFILE_FUNCTION();
+
+	BinScreenSpaceTrianglesIntoTiles(tileGrid, screenSpaceTriangles, imageWidth, imageHeight);
+
+	threadPool.ParallelFor(tileGrid.triangleIndicesInTile.size(), [&](int tileIndex) {
+		RasterizeTileDepthOnly(depthData, imageWidth, imageHeight, screenSpaceTriangles, tileGrid, tileIndex);
+	});
+}
@@ -247,18 +247,22 @@ void UpdateUIRectStates(UI_Rect& uiRect, const float& mouseX, const float& mouse
 	}
 }
 
-void UpdateUITreeStates(UI_Rect& uiRect, const float& mouseX, const float& mouseY) {
+// True when the mouse is over uiRect or any of its children.
+bool UpdateUITreeStates(UI_Rect& uiRect, const float& mouseX, const float& mouseY) {
 
 	//HighlightMouseHoveringOverRect(oldMouseX, oldMouseY, mouseX, mouseY);
 	//HighlightMouseHoveringOverRect(mouseX, mouseY, mouseX, mouseY);
 
 	UpdateUIRectStates(uiRect, mouseX, mouseY);
 	//SetUIRectState(uiRect, mouseX, mouseY);
+	bool mouseOverTree = uiRect.uiRectState == UI_RectState::OnHoverEnter || uiRect.uiRectState == UI_RectState::OnHovering;
 	if (uiRect.uiRectState != UI_RectState::OnNotHovering)
 	{
 		for (int i = 0; i < uiRect.children.size(); i++)
 		{
-			UpdateUITreeStates(UI_Rect::uiRects[uiRect.children[i]], mouseX, mouseY);
+			if (UpdateUITreeStates(UI_Rect::uiRects[uiRect.children[i]], mouseX, mouseY)) {
+				mouseOverTree = true;
+			}
 		}
 	}
 	else
@@ -273,6 +277,8 @@ void UpdateUITreeStates(UI_Rect& uiRect, const float& mouseX, const float& mouse
 	//{
 	//	SetUIRectState(UI_Rect::uiRects[i], mouseX, mouseY);
 	//}
+
+	return mouseOverTree;
 }
 
 void MakeHoveringUIRectsFollowCursorMovement(const int& childIndex, const float& mouseDeltaX, const float& mouseDeltaY) {
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <new>
+#include <vector>
+#include <immintrin.h>
+
+#include "Geometry.h"
+
+// std::vector storage that starts on an Alignment byte boundary, so whole batches can be loaded with aligned SIMD loads.
+template <typename T, size_t Alignment>
+struct AlignedAllocator {
+
+	typedef T value_type;
+
+	template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() = default;
+	template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(size_t count) {
+		void* memory = _mm_malloc(count * sizeof(T), Alignment);
+		if (memory == nullptr) {
+			throw std::bad_alloc();
+		}
+		return (T*)memory;
+	}
+
+	void deallocate(T* memory, size_t) {
+		_mm_free(memory);
+	}
+};
+
+template <typename T, typename U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return true; }
+
+template <typename T, typename U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return false; }
+
+typedef std::vector<float, AlignedAllocator<float, 32>> AlignedFloatVector;
+
+// Vertices are transformed 8 at a time (one AVX register per component), streams are padded up to a multiple of this.
+const int vertexStreamBatchSize = 8;
+
+// Structure of arrays copy of a mesh's vertices, one tightly packed and 32 byte aligned array per component.
+// Lane i of every stream belongs to vertex i, entries past numVertices are zero padding.
+struct VertexStreams {
+
+	int numVertices = 0;
+
+	AlignedFloatVector positionX, positionY, positionZ;
+	AlignedFloatVector normalX, normalY, normalZ;
+	AlignedFloatVector texCoordU, texCoordV;
+	AlignedFloatVector colourR, colourG, colourB, colourA;
+};
+
+// Built once at load time from the loader's vertex list.
+void BuildVertexStreams(const std::vector<Point>& vertices, VertexStreams& streams) {
+
+	streams.numVertices = vertices.size();
+
+	int paddedSize = ((streams.numVertices + vertexStreamBatchSize - 1) / vertexStreamBatchSize) * vertexStreamBatchSize;
+
+	AlignedFloatVector* allStreams[] = { &streams.positionX, &streams.positionY, &streams.positionZ,
+										 &streams.normalX, &streams.normalY, &streams.normalZ,
+										 &streams.texCoordU, &streams.texCoordV,
+										 &streams.colourR, &streams.colourG, &streams.colourB, &streams.colourA };
+	for (AlignedFloatVector* stream : allStreams)
+	{
+		stream->assign(paddedSize, 0.0f);
+	}
+
+	for (int i = 0; i < streams.numVertices; i++)
+	{
+		const Point& vertex = vertices[i];
+
+		streams.positionX[i] = vertex.position.x;
+		streams.positionY[i] = vertex.position.y;
+		streams.positionZ[i] = vertex.position.z;
+
+		streams.normalX[i] = vertex.normal.x;
+		streams.normalY[i] = vertex.normal.y;
+		streams.normalZ[i] = vertex.normal.z;
+
+		streams.texCoordU[i] = vertex.texCoord.x;
+		streams.texCoordV[i] = vertex.texCoord.y;
+
+		streams.colourR[i] = vertex.colour.x;
+		streams.colourG[i] = vertex.colour.y;
+		streams.colourB[i] = vertex.colour.z;
+		streams.colourA[i] = vertex.colour.w;
+	}
+}
+
+Vector3 GetStreamTexCoord(const VertexStreams& streams, int i) {
+	return { streams.texCoordU[i], streams.texCoordV[i], 0.0f };
+}
+
+Vector4 GetStreamColour(const VertexStreams& streams, int i) {
+	return { streams.colourR[i], streams.colourG[i], streams.colourB[i], streams.colourA[i] };
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+// How the tile renderer turns screen space triangles into pixels.
+enum RenderMode {
+	RENDER_MODE_FORWARD,				// Every fragment that passes the depth test is shaded straight away.
+	RENDER_MODE_VISIBILITY_BUFFER,		// The raster pass only writes depth and which triangle won each pixel, a second pass shades each visible pixel once.
+	RENDER_MODE_RAY_CAST,				// Nothing is rasterized, every pixel casts a ray through the model's BVH instead (see RayCaster.h).
+	NUM_RENDER_MODES
+};
+
+const char* renderModeNames[NUM_RENDER_MODES] = { "Forward", "Visibility buffer", "Ray cast" };
+
+RenderMode activeRenderMode = RENDER_MODE_FORWARD;
+
+// A visibility buffer entry is the index of the frame's screen space triangle that covers the pixel, plus one so 0 can mean nothing was drawn there.
+// Screen space triangles are built per mesh and already carry everything that differs between meshes (texture, clipped attributes),
+// so this one index is enough to get back to both the triangle and the mesh it came from.
+const unsigned int emptyVisibilityID = 0;
+
+unsigned int GetVisibilityID(unsigned int screenSpaceTriangleIndex) {
+	return screenSpaceTriangleIndex + 1;
+}
+
+unsigned int GetScreenSpaceTriangleIndex(unsigned int visibilityID) {
+	return visibilityID - 1;
+}
\ No newline at end of file
@@ -0,0 +1,480 @@
+#pragma once
+
+#include <vector>
+#include <cfloat>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+
+#include "Instrumentor.h"
+
+#include "Geometry.h"
+#include "Colour.h"
+#include "Model.h"
+#include "Bounds.h"
+#include "Texture.h"
+#include "Meshlets.h"
+#include "ThreadPool.h"
+#include "RenderGeometry.h"
+#include "TileRenderer.h"
+#include "RayCaster.h"
+#include "WorldConstants.h"
+
+// Voxel art exported as triangles (every visible voxel face is two of them) turned back into voxels and drawn by marching rays through them.
+// Bricks of voxelBrickSize^3 voxels are only stored where there's something in them, the rest of the grid is one index per brick.
+// OBJECT SPACE!!! Like the model it was imported from, voxel (0, 0, 0) has its min corner at origin.
+struct VoxelGrid {
+
+	Vector3 origin;
+	float voxelSize = 0.0f;
+	Vector3Int numBricks = { 0, 0, 0 };
+
+	std::vector<uint32_t> brickSlots;			// One per brick in the grid, emptyBrickSlot where the brick has no voxels.
+	std::vector<uint8_t> brickVoxels;			// voxelsPerBrick palette indices per stored brick, 0 is empty.
+	std::vector<Colour> palette;				// palette[0] is never used.
+
+	AABB bounds;
+};
+
+bool useVoxelObject = false;
+
+const uint32_t emptyBrickSlot = 0xFFFFFFFF;
+const int voxelsPerBrick = voxelBrickSize * voxelBrickSize * voxelBrickSize;
+
+bool IsVoxelGridEmpty(const VoxelGrid& voxelGrid) {
+	return voxelGrid.brickVoxels.empty();
+}
+
+int GetBrickIndex(const VoxelGrid& voxelGrid, const Vector3Int& brick) {
+	return brick.x + (voxelGrid.numBricks.x * (brick.y + (voxelGrid.numBricks.y * brick.z)));
+}
+
+// Voxel coordinates are for the whole grid, only their position inside the brick matters here.
+int GetVoxelIndexInBrick(const Vector3Int& voxel) {
+
+	Vector3Int local = { voxel.x % voxelBrickSize, voxel.y % voxelBrickSize, voxel.z % voxelBrickSize };
+	return local.x + (voxelBrickSize * (local.y + (voxelBrickSize * local.z)));
+}
+
+uint8_t GetVoxel(const VoxelGrid& voxelGrid, uint32_t brickSlot, const Vector3Int& voxel) {
+	return voxelGrid.brickVoxels[(brickSlot * voxelsPerBrick) + GetVoxelIndexInBrick(voxel)];
+}
+
+void SetVoxel(VoxelGrid& voxelGrid, const Vector3Int& voxel, uint8_t paletteIndex) {
+
+	Vector3Int brick = { voxel.x / voxelBrickSize, voxel.y / voxelBrickSize, voxel.z / voxelBrickSize };
+	uint32_t& brickSlot = voxelGrid.brickSlots[GetBrickIndex(voxelGrid, brick)];
+	if (brickSlot == emptyBrickSlot) {
+		brickSlot = voxelGrid.brickVoxels.size() / voxelsPerBrick;
+		voxelGrid.brickVoxels.resize(voxelGrid.brickVoxels.size() + voxelsPerBrick, 0);
+	}
+	voxelGrid.brickVoxels[(brickSlot * voxelsPerBrick) + GetVoxelIndexInBrick(voxel)] = paletteIndex;
+}
+
+// Exact colours get their own entry until the palette is full, after that the nearest one is reused.
+uint8_t GetPaletteIndex(VoxelGrid& voxelGrid, std::unordered_map<uint32_t, uint8_t>& paletteLookup, const Colour& colour) {
+
+	uint32_t packedColour = ((uint32_t)colour.r << 16) | ((uint32_t)colour.g << 8) | (uint32_t)colour.b;
+	auto found = paletteLookup.find(packedColour);
+	if (found != paletteLookup.end()) {
+		return found->second;
+	}
+
+	if (voxelGrid.palette.size() < maxVoxelPaletteColours) {
+		uint8_t paletteIndex = voxelGrid.palette.size();
+		voxelGrid.palette.push_back(colour);
+		paletteLookup[packedColour] = paletteIndex;
+		return paletteIndex;
+	}
+
+	uint8_t nearestIndex = 1;
+	int nearestDistance = INT32_MAX;
+	for (int i = 1; i < voxelGrid.palette.size(); i++)
+	{
+		int dr = (int)voxelGrid.palette[i].r - colour.r;
+		int dg = (int)voxelGrid.palette[i].g - colour.g;
+		int db = (int)voxelGrid.palette[i].b - colour.b;
+		int distance = (dr * dr) + (dg * dg) + (db * db);
+		if (distance < nearestDistance) {
+			nearestDistance = distance;
+			nearestIndex = i;
+		}
+	}
+	paletteLookup[packedColour] = nearestIndex;
+	return nearestIndex;
+}
+
+// Every vertex of voxel art sits on a voxel corner, so the smallest gap between two different vertex coordinates on any axis is one voxel.
+float DetectVoxelSize(const Model& model) {
+
+	float voxelSize = FLT_MAX;
+	std::vector<float> coordinates;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		coordinates.clear();
+		for (int m = 0; m < model.meshes.size(); m++)
+		{
+			for (int i = 0; i < model.meshes[m].vertices.size(); i++)
+			{
+				coordinates.push_back(model.meshes[m].vertices[i].position[axis]);
+			}
+		}
+		std::sort(coordinates.begin(), coordinates.end());
+
+		for (int i = 1; i < coordinates.size(); i++)
+		{
+			float gap = coordinates[i] - coordinates[i - 1];
+			if (gap > voxelSizeDetectionEpsilon) {
+				voxelSize = std::min(voxelSize, gap);
+			}
+		}
+	}
+	return voxelSize == FLT_MAX ? 0.0f : voxelSize;
+}
+
+// Each axis aligned face marks the voxel right behind it as solid, coloured like the face is at that voxel's centre.
+// Voxels that never show a face stay empty, nothing can see them anyway.
+void ImportVoxelGridFromModel(const Model& model, VoxelGrid& voxelGrid) {
+
+	PROFILE_FUNCTION();
+
+	voxelGrid = VoxelGrid();
+	voxelGrid.voxelSize = DetectVoxelSize(model);
+	if (voxelGrid.voxelSize <= 0.0f || IsAABBEmpty(model.bounds)) {
+		return;
+	}
+
+	voxelGrid.origin = model.bounds.min;
+	Vector3 extentInVoxels = (model.bounds.max - model.bounds.min) / voxelGrid.voxelSize;
+	Vector3Int numVoxels = { std::max((int)roundf(extentInVoxels.x), 1), std::max((int)roundf(extentInVoxels.y), 1), std::max((int)roundf(extentInVoxels.z), 1) };
+	voxelGrid.numBricks = { (numVoxels.x + voxelBrickSize - 1) / voxelBrickSize, (numVoxels.y + voxelBrickSize - 1) / voxelBrickSize, (numVoxels.z + voxelBrickSize - 1) / voxelBrickSize };
+	voxelGrid.brickSlots.assign(voxelGrid.numBricks.x * voxelGrid.numBricks.y * voxelGrid.numBricks.z, emptyBrickSlot);
+	voxelGrid.palette.push_back(colour_black);
+	std::unordered_map<uint32_t, uint8_t> paletteLookup;
+
+	for (int m = 0; m < model.meshes.size(); m++)
+	{
+		const Mesh& mesh = model.meshes[m];
+		const Texture* texture = mesh.textureIndex >= 0 && mesh.textureIndex < Model::textures.size() ? &Model::textures[mesh.textureIndex] : nullptr;
+
+		for (int i = 0; i + 2 < mesh.indices.size(); i += 3)
+		{
+			const Point& a = mesh.vertices[mesh.indices[i + 0]];
+			const Point& b = mesh.vertices[mesh.indices[i + 1]];
+			const Point& c = mesh.vertices[mesh.indices[i + 2]];
+
+			// Counter clockwise is the outside, the solid voxel is on the other side of the face.
+			Vector3 faceNormal = ComputeFaceNormal(a.position, b.position, c.position);
+			Vector3 absNormal = glm::abs(faceNormal);
+			int axis = absNormal.x >= absNormal.y && absNormal.x >= absNormal.z ? 0 : (absNormal.y >= absNormal.z ? 1 : 2);
+			if (absNormal[axis] == 0.0f) {
+				continue;
+			}
+			int axisU = (axis + 1) % 3;
+			int axisV = (axis + 2) % 3;
+
+			Vector3 voxelA = (a.position - voxelGrid.origin) / voxelGrid.voxelSize;
+			Vector3 voxelB = (b.position - voxelGrid.origin) / voxelGrid.voxelSize;
+			Vector3 voxelC = (c.position - voxelGrid.origin) / voxelGrid.voxelSize;
+
+			int plane = (int)roundf((voxelA[axis] + voxelB[axis] + voxelC[axis]) / 3.0f);
+			int layer = faceNormal[axis] > 0.0f ? plane - 1 : plane;
+			if (layer < 0 || layer >= numVoxels[axis]) {
+				continue;
+			}
+
+			Vector2 a2 = { voxelA[axisU], voxelA[axisV] };
+			Vector2 b2 = { voxelB[axisU], voxelB[axisV] };
+			Vector2 c2 = { voxelC[axisU], voxelC[axisV] };
+			float area = ((b2.x - a2.x) * (c2.y - a2.y)) - ((b2.y - a2.y) * (c2.x - a2.x));
+			if (area == 0.0f) {
+				continue;
+			}
+
+			int startU = std::max((int)floorf(std::min(a2.x, std::min(b2.x, c2.x))), 0);
+			int startV = std::max((int)floorf(std::min(a2.y, std::min(b2.y, c2.y))), 0);
+			int endU = std::min((int)ceilf(std::max(a2.x, std::max(b2.x, c2.x))), numVoxels[axisU]);
+			int endV = std::min((int)ceilf(std::max(a2.y, std::max(b2.y, c2.y))), numVoxels[axisV]);
+
+			for (int v = startV; v < endV; v++)
+			{
+				for (int u = startU; u < endU; u++)
+				{
+					// Voxel centres never sit on a face's edge, so there's no fill rule to worry about between the two triangles of a face.
+					Vector2 centre = { u + 0.5f, v + 0.5f };
+					float beta = (((centre.x - a2.x) * (c2.y - a2.y)) - ((centre.y - a2.y) * (c2.x - a2.x))) / area;
+					float gamma = (((b2.x - a2.x) * (centre.y - a2.y)) - ((b2.y - a2.y) * (centre.x - a2.x))) / area;
+					float alpha = 1.0f - beta - gamma;
+					if (alpha < 0.0f || beta < 0.0f || gamma < 0.0f) {
+						continue;
+					}
+
+					Colour voxelColour;
+					if (texture != nullptr) {
+						Vector2 texCoord = (alpha * Vector2(a.texCoord)) + (beta * Vector2(b.texCoord)) + (gamma * Vector2(c.texCoord));
+						voxelColour = GetColourFromTexCoord(*texture, texCoord);
+					}
+					else {
+						Vector4 vertexColour = (alpha * a.colour) + (beta * b.colour) + (gamma * c.colour);
+						voxelColour = { (unsigned char)vertexColour.x, (unsigned char)vertexColour.y, (unsigned char)vertexColour.z, 255 };
+					}
+
+					Vector3Int voxel;
+					voxel[axis] = layer;
+					voxel[axisU] = u;
+					voxel[axisV] = v;
+					SetVoxel(voxelGrid, voxel, GetPaletteIndex(voxelGrid, paletteLookup, voxelColour));
+				}
+			}
+		}
+	}
+
+	voxelGrid.bounds.min = voxelGrid.origin;
+	voxelGrid.bounds.max = voxelGrid.origin + (Vector3(voxelGrid.numBricks * voxelBrickSize) * voxelGrid.voxelSize);
+}
+
+// Heap memory the grid holds on to, to compare with the triangles it replaces.
+size_t GetVoxelGridMemoryBytes(const VoxelGrid& voxelGrid) {
+	return (voxelGrid.brickSlots.size() * sizeof(uint32_t)) + voxelGrid.brickVoxels.size() + (voxelGrid.palette.size() * sizeof(Colour));
+}
+
+//--------------------------------------------------------Ray Marching--------------------------------------------------------
+
+struct VoxelHit {
+
+	float distance;			// In units of the ray's direction, like RayHit.
+	uint8_t paletteIndex;
+	Vector3 normal;			// OBJECT SPACE!!! Of the voxel face the ray went in through.
+};
+
+// One step of a 3D DDA, moves to whichever neighbouring cell the ray reaches first and returns the axis it crossed.
+int StepDDA(Vector3Int& cell, Vector3& tMax, const Vector3& tDelta, const Vector3Int& step) {
+
+	int axis = tMax.x < tMax.y ? (tMax.x < tMax.z ? 0 : 2) : (tMax.y < tMax.z ? 1 : 2);
+	cell[axis] += step[axis];
+	tMax[axis] += tDelta[axis];
+	return axis;
+}
+
+// Sets up a DDA through cells of cellSize voxels for a ray starting in cell. Axes the ray doesn't move along never get stepped.
+void InitDDA(const Vector3& rayOrigin, const Vector3& rayDirection, const Vector3& invRayDirection, const Vector3Int& cell, float cellSize, Vector3Int& step, Vector3& tMax, Vector3& tDelta) {
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (rayDirection[axis] == 0.0f) {
+			step[axis] = 0;
+			tMax[axis] = FLT_MAX;
+			tDelta[axis] = FLT_MAX;
+			continue;
+		}
+
+		step[axis] = rayDirection[axis] > 0.0f ? 1 : -1;
+		float nextBoundary = (cell[axis] + (rayDirection[axis] > 0.0f ? 1 : 0)) * cellSize;
+		tMax[axis] = (nextBoundary - rayOrigin[axis]) * invRayDirection[axis];
+		tDelta[axis] = cellSize * fabsf(invRayDirection[axis]);
+	}
+}
+
+// Marches the voxels of one brick between t and tExit, the ray is in voxel units. enteredAxis is the axis it came in through, -1 if it started in there.
+bool MarchVoxelBrick(const VoxelGrid& voxelGrid, uint32_t brickSlot, const Vector3Int& brick, const Vector3& rayOrigin, const Vector3& rayDirection, const Vector3& invRayDirection,
+	float t, float tExit, int enteredAxis, VoxelHit& voxelHit) {
+
+	Vector3Int brickMin = brick * voxelBrickSize;
+	Vector3 entry = rayOrigin + (rayDirection * t);
+	Vector3Int voxel = glm::clamp(Vector3Int(glm::floor(entry)), brickMin, brickMin + (voxelBrickSize - 1));
+
+	Vector3Int step;
+	Vector3 tMax, tDelta;
+	InitDDA(rayOrigin, rayDirection, invRayDirection, voxel, 1.0f, step, tMax, tDelta);
+
+	int axis = enteredAxis;
+	while (true)
+	{
+		uint8_t paletteIndex = GetVoxel(voxelGrid, brickSlot, voxel);
+		if (paletteIndex != 0) {
+			voxelHit.distance = t;
+			voxelHit.paletteIndex = paletteIndex;
+			voxelHit.normal = Vector3(0.0f);
+			if (axis >= 0) {
+				voxelHit.normal[axis] = (float)-step[axis];
+			}
+			return true;
+		}
+
+		t = std::min(tMax.x, std::min(tMax.y, tMax.z));
+		if (t > tExit) {
+			return false;
+		}
+
+		axis = StepDDA(voxel, tMax, tDelta, step);
+		if (voxel[axis] < brickMin[axis] || voxel[axis] >= brickMin[axis] + voxelBrickSize) {
+			return false;
+		}
+	}
+}
+
+// Two level DDA, whole empty bricks are crossed in one step and only stored bricks are marched voxel by voxel.
+// Costs O(cells crossed) however many triangles the model was exported with.
+bool MarchVoxelGrid(const VoxelGrid& voxelGrid, const Vector3& origin, const Vector3& direction, float maxDistance, VoxelHit& voxelHit) {
+
+	if (IsVoxelGridEmpty(voxelGrid)) {
+		return false;
+	}
+
+	// Distances along the ray don't change when it's scaled into voxel units, only where it is.
+	Vector3 rayOrigin = (origin - voxelGrid.origin) / voxelGrid.voxelSize;
+	Vector3 rayDirection = direction / voxelGrid.voxelSize;
+	Vector3 invRayDirection = 1.0f / rayDirection;
+	Vector3 gridSize = Vector3(voxelGrid.numBricks * voxelBrickSize);
+
+	float tEnter = 0.0f;
+	float tExit = maxDistance;
+	int enteredAxis = -1;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (rayDirection[axis] == 0.0f) {
+			if (rayOrigin[axis] < 0.0f || rayOrigin[axis] > gridSize[axis]) {
+				return false;
+			}
+			continue;
+		}
+
+		float t0 = (0.0f - rayOrigin[axis]) * invRayDirection[axis];
+		float t1 = (gridSize[axis] - rayOrigin[axis]) * invRayDirection[axis];
+		if (t0 > t1) {
+			std::swap(t0, t1);
+		}
+		if (t0 > tEnter) {
+			tEnter = t0;
+			enteredAxis = axis;
+		}
+		tExit = std::min(tExit, t1);
+	}
+	if (tEnter > tExit) {
+		return false;
+	}
+
+	Vector3 entry = rayOrigin + (rayDirection * tEnter);
+	Vector3Int brick = glm::clamp(Vector3Int(glm::floor(entry / (float)voxelBrickSize)), Vector3Int(0), voxelGrid.numBricks - 1);
+
+	Vector3Int step;
+	Vector3 tMax, tDelta;
+	InitDDA(rayOrigin, rayDirection, invRayDirection, brick, (float)voxelBrickSize, step, tMax, tDelta);
+
+	float t = tEnter;
+	int axis = enteredAxis;
+	while (true)
+	{
+		float tBrickExit = std::min(tMax.x, std::min(tMax.y, tMax.z));
+
+		uint32_t brickSlot = voxelGrid.brickSlots[GetBrickIndex(voxelGrid, brick)];
+		if (brickSlot != emptyBrickSlot && MarchVoxelBrick(voxelGrid, brickSlot, brick, rayOrigin, rayDirection, invRayDirection, t, std::min(tBrickExit, tExit), axis, voxelHit)) {
+			return true;
+		}
+
+		t = tBrickExit;
+		if (t > tExit) {
+			return false;
+		}
+
+		axis = StepDDA(brick, tMax, tDelta, step);
+		if (brick[axis] < 0 || brick[axis] >= voxelGrid.numBricks[axis]) {
+			return false;
+		}
+	}
+}
+
+//--------------------------------------------------------Tiles--------------------------------------------------------
+
+// Pixels the grid's box can cover, so rays that can't hit it are never marched. The whole screen when part of the box is behind the camera.
+void GetVoxelGridScreenRect(const VoxelGrid& voxelGrid, const DrawConstants& drawConstants, int imageWidth, int imageHeight, Vector2Int& rectMin, Vector2Int& rectMax) {
+
+	rectMin = { 0, 0 };
+	rectMax = { imageWidth - 1, imageHeight - 1 };
+
+	Vector2 screenMin = Vector2(FLT_MAX);
+	Vector2 screenMax = Vector2(-FLT_MAX);
+	for (int corner = 0; corner < 8; corner++)
+	{
+		Vector3 position = { (corner & 1) ? voxelGrid.bounds.max.x : voxelGrid.bounds.min.x, (corner & 2) ? voxelGrid.bounds.max.y : voxelGrid.bounds.min.y, (corner & 4) ? voxelGrid.bounds.max.z : voxelGrid.bounds.min.z };
+		Vector4 clipPosition = drawConstants.modelViewProjectionMatrix * Vector4(position, 1.0f);
+		if (clipPosition.w < nearPlaneDistance) {
+			return;
+		}
+
+		Vector2 screenPosition = { ((clipPosition.x / clipPosition.w) + 1.0f) * 0.5f * imageWidth, ((clipPosition.y / clipPosition.w) + 1.0f) * 0.5f * imageHeight };
+		screenMin = glm::min(screenMin, screenPosition);
+		screenMax = glm::max(screenMax, screenPosition);
+	}
+
+	rectMin = { std::max((int)floorf(screenMin.x), 0), std::max((int)floorf(screenMin.y), 0) };
+	rectMax = { std::min((int)ceilf(screenMax.x), imageWidth - 1), std::min((int)ceilf(screenMax.y), imageHeight - 1) };
+}
+
+// Lit like a vertex of a rasterized mesh, only per pixel with the voxel face's normal.
+void ShadeVoxelHit(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, int imageWidth, int x, int y,
+	const VoxelGrid& voxelGrid, const DrawConstants& drawConstants, const Vector3& rayOrigin, const Vector3& rayDirection, const VoxelHit& voxelHit) {
+
+	Vector3 hitPosition = rayOrigin + (rayDirection * voxelHit.distance);
+
+	// Depth tested against whatever was rasterized or ray cast before, nearer is bigger.
+	Vector4 clipPosition = drawConstants.modelViewProjectionMatrix * Vector4(hitPosition, 1.0f);
+	float depth = clipPosition.z / clipPosition.w;
+	int depthDataIndex = GetFlattenedImageDataSlotForDepthData(Vector2Int{ x, y }, imageWidth);
+	if (imageDepthData[depthDataIndex] >= depth) {
+		return;
+	}
+	imageDepthData[depthDataIndex] = depth;
+
+	// A ray that starts inside a voxel didn't go through any face, it's lit as if it faced the camera.
+	Vector3 normal = voxelHit.normal;
+	if (normal == Vector3(0.0f)) {
+		normal = -glm::normalize(rayDirection);
+	}
+
+	Vector3 worldPosition = Vector3(drawConstants.modelMatrix * Vector4(hitPosition, 1.0f));
+	Vector3 worldNormal = glm::normalize(drawConstants.normalMatrix * normal);
+	Vector3 lightDirFromFragment = glm::normalize(drawConstants.lightPosition - worldPosition);
+	float lightDotNormal = glm::max(glm::dot(lightDirFromFragment, worldNormal), 0.1f);
+
+	const Colour& voxelColour = voxelGrid.palette[voxelHit.paletteIndex];
+	int index = GetRedFlattenedImageDataSlotForPixel(Vector2Int{ x, y }, imageWidth);
+	imageData[index + 0] = voxelColour.r * lightDotNormal;
+	imageData[index + 1] = voxelColour.g * lightDotNormal;
+	imageData[index + 2] = voxelColour.b * lightDotNormal;
+	imageData[index + 3] = 255;
+}
+
+// Runs after the meshes are drawn and only writes pixels where a voxel is nearer, so the two composite through the depth buffer.
+void RayMarchVoxelGridInTiles(std::vector<unsigned char>& imageData, std::vector<float>& imageDepthData, int imageWidth, int imageHeight,
+	const VoxelGrid& voxelGrid, const DrawConstants& drawConstants, RenderTileGrid& tileGrid, ThreadPool& threadPool) {
+
+	PROFILE_FUNCTION();
+
+	if (IsVoxelGridEmpty(voxelGrid) || TestBoundsAgainstFrustum(drawConstants.frustum, voxelGrid.bounds, BoundingSphere{ GetAABBCentre(voxelGrid.bounds), glm::length(GetAABBHalfExtents(voxelGrid.bounds)) }) == FRUSTUM_OUTSIDE) {
+		return;
+	}
+
+	RayCastConstants rayCastConstants = ComputeRayCastConstants(drawConstants, imageWidth, imageHeight);
+	Vector2Int rectMin, rectMax;
+	GetVoxelGridScreenRect(voxelGrid, drawConstants, imageWidth, imageHeight, rectMin, rectMax);
+
+	threadPool.ParallelFor(tileGrid.numTiles.x * tileGrid.numTiles.y, [&](int tileIndex) {
+
+		Vector2Int tileCoords = { tileIndex % tileGrid.numTiles.x, tileIndex / tileGrid.numTiles.x };
+		Vector2Int scissorMin = glm::max(tileCoords * renderTileSize, rectMin);
+		Vector2Int scissorMax = glm::min(Vector2Int{ std::min((tileCoords.x + 1) * renderTileSize, imageWidth) - 1, std::min((tileCoords.y + 1) * renderTileSize, imageHeight) - 1 }, rectMax);
+
+		for (int y = scissorMin.y; y <= scissorMax.y; y++)
+		{
+			for (int x = scissorMin.x; x <= scissorMax.x; x++)
+			{
+				Vector3 direction = GetPixelRayDirection(rayCastConstants, x, y);
+				VoxelHit voxelHit;
+				if (MarchVoxelGrid(voxelGrid, rayCastConstants.rayOrigin, direction, 1.0f, voxelHit)) {
+					ShadeVoxelHit(imageData, imageDepthData, imageWidth, x, y, voxelGrid, drawConstants, rayCastConstants.rayOrigin, direction, voxelHit);
+				}
+			}
+		}
+	});
+}
\ No newline at end of file
@@ -13,6 +13,8 @@ const float nearPlaneDistance = 0.1f;
 
 const Plane planeNear = { {0.0f, 0.0f, 1.0f}, {{0.0f, 0.0f, nearPlaneDistance}} };    // CAMERA SPACE!!!
 
+const float farPlaneDistance = 1000.0f;
+
 const float bias = 0.0f;
 const Plane planeBottom = { {0.0f, 1.0f, 0.0f }, {{ 0.0f, -(1.0f + bias) , 0.0f }} };             // NDC SPACE!!!!!!
 const Plane planeTop = { { 0.0f, -1.0f, 0.0f }, {{ 0.0f, 1.0f + bias, 0.0f }} };
@@ -24,6 +26,32 @@ const Plane planeTopScreenSpace = { { 0.0f, -1.0f, 0.0f }, {{ 0.0f, screenHeight
 const Plane planeLeftScreenSpace = { { 1.0f, 0.0f, 0.0f }, {{ 0.0f, 0.0f, 0.0f }} };
 const Plane planeRightScreenSpace = { { -1.0f, 0.0f, 0.0f }, {{ screenWidth - 1, 0.0f, 0.0f } } };
 
+// Triangles are only clipped in x and y once they reach this far past the screen edges, up to there the rasterizer's scissor does it for free.
+// Snapped 28.4 edge functions stay inside 32 bits while a triangle spans less than 2048 pixels, so screenWidth + 2 * guardBandPixels has to stay below that.
+const int guardBandPixels = 512;
+
+const float guardBandNDCExtentX = 1.0f + ((2.0f * guardBandPixels) / screenWidth);
+const float guardBandNDCExtentY = 1.0f + ((2.0f * guardBandPixels) / screenHeight);
+
+// CLIP SPACE!!! These take the clip space position negated, our camera looks down +z so that makes w the (positive) view space depth.
+// Near and far are the only planes that don't scale with w.
+const int numClipSpacePlanes = 6;
+const ClipSpacePlane clipSpacePlanesScreen[numClipSpacePlanes] = {
+	{ { 0.0f, 0.0f, 0.0f, 1.0f }, -nearPlaneDistance },
+	{ { 0.0f, 0.0f, 0.0f, -1.0f }, farPlaneDistance },
+	{ { 1.0f, 0.0f, 0.0f, 1.0f }, 0.0f },
+	{ { -1.0f, 0.0f, 0.0f, 1.0f }, 0.0f },
+	{ { 0.0f, 1.0f, 0.0f, 1.0f }, 0.0f },
+	{ { 0.0f, -1.0f, 0.0f, 1.0f }, 0.0f }
+};
+const ClipSpacePlane clipSpacePlanesGuardBand[numClipSpacePlanes] = {
+	{ { 0.0f, 0.0f, 0.0f, 1.0f }, -nearPlaneDistance },
+	{ { 0.0f, 0.0f, 0.0f, -1.0f }, farPlaneDistance },
+	{ { 1.0f, 0.0f, 0.0f, guardBandNDCExtentX }, 0.0f },
+	{ { -1.0f, 0.0f, 0.0f, guardBandNDCExtentX }, 0.0f },
+	{ { 0.0f, 1.0f, 0.0f, guardBandNDCExtentY }, 0.0f },
+	{ { 0.0f, -1.0f, 0.0f, guardBandNDCExtentY }, 0.0f }
+};
 
 // Colours
 const Colour colour_white = { 255, 255, 255, 255 };
@@ -39,6 +67,60 @@ const Colour colour_pink = { 238, 130, 238, 255 };
 const Vector3 worldUP = Vector3{ 0.0f, 1.0f, 0.0f };
 const Vector3 worldForward = Vector3{ 0.0f, 0.0f, 1.0f };
 
+// Lighting
+const Vector3 lightPosition = { 5.0f, -10.0f, -5.0f };	// WORLD SPACE!!! After the y flip every model gets, see ComputeDrawConstants.
+
+
+// Render Tiles
+const int renderTileSize = 64;
+
+// Hi-Z
+const int hiZTileSize = 8;		// Has to divide renderTileSize, so no Hi-Z tile is shared between two render tiles.
+
+// Rasterizer
+const int subpixelBits = 4;
+const int subpixelSteps = 1 << subpixelBits;	// Screen space vertices are snapped to 28.4 fixed point, 16 positions per pixel in x and y.
+const float colourTextureMixFactor = 0.0f;		// How much of the vertex colour is mixed into a textured mesh's texels, at 0 they aren't interpolated at all.
+
+// Meshlets
+const int maxMeshletTriangles = 128;	// Meshlets grow until they reach this or run out of connected triangles.
+
+// Occlusion Culling
+const int occlusionBufferWidth = 256;		// Has to be a multiple of 8, the occluder rasterizer works in whole 8 pixel blocks.
+const int occlusionBufferHeight = 128;
+const float occluderMinRadiusFraction = 0.25f;	// Meshes at least this big next to their model's bounding sphere are occluders, see MarkLargeMeshesAsOccluders.
+
+// BVH
+const int bvhNumBins = 16;							// Candidate split planes per axis are the boundaries between these.
+const float bvhTraversalCost = 1.0f;				// Cost of visiting a node next to testing one triangle, for the SAH.
+const uint32_t bvhMaxLeafTriangles = 16;			// Leaves are split past this even when SAH says keeping them is cheaper.
+const uint32_t bvhMinParallelSubtreeTriangles = 2048;	// Subtrees smaller than this aren't worth handing to another thread.
+const int bvhMaxTraversalDepth = 64;				// Size of the traversal stacks, BuildBVHSubtree stops splitting before a tree can outgrow them.
+
+// Voxels
+const int voxelBrickSize = 8;						// Voxels along each side of a brick, bricks with nothing in them aren't stored.
+const int maxVoxelPaletteColours = 256;				// Voxels are one byte palette indices, 0 is empty.
+const float voxelSizeDetectionEpsilon = 1e-4f;		// Vertex coordinates closer than this are the same voxel corner.
+
+// Shadows
+const float shadowedLightDotNormal = 0.1f;			// Same floor the vertex lighting clamps to, a pixel the light can't reach is lit like one facing away from it.
+const float shadowRayBias = 0.002f;					// Shadow rays start this far off the surface per unit of distance from the camera, depth gets less precise further away.
+const uint32_t shadowRayTileNodeBudget = 200000;	// BVH nodes a tile may visit before its remaining pixels reuse the ray traced for their 2x2 quad.
+const int shadowMapSize = 1024;
+const int shadowMapPCFRadius = 1;					// Texels sampled on each side of the nearest one, 1 is a 3x3 filter.
+const float shadowMapDepthBiasTexels = 1.5f;		// Depth compare slack in texel widths at the receiver's distance, so it scales with the map's resolution there.
+const float shadowMapFrustumMargin = 1.05f;			// The light's frustum is fitted around the caster's bounding sphere grown by this.
+const float shadowMapMaxHalfFovDegrees = 60.0f;		// Past this the light is too close to fit the caster and the map just covers what it can.
+
+// Ambient occlusion
+const int ssaoNumSamples = 8;
+const float ssaoRadius = 1.0f;						// World units around a pixel that can occlude it.
+const float ssaoMaxRadiusPixels = 32.0f;			// Half resolution pixels, up close the radius is clamped to this so the cost stays the same.
+const float ssaoIntensity = 2.0f;
+const float ssaoAngleBias = 0.15f;					// Cosine a sample has to rise above the surface by before it occludes, flat faceted surfaces would darken themselves otherwise.
+const int ssaoBlurRadius = 4;						// Half resolution pixels on each side.
+const float ssaoBlurDepthSharpness = 8.0f;			// Blur taps stop counting once their depth is off by more than 1 / this of the pixel's.
+
 
 // UI Collision Grid
 const Vector2Int collisionGridCellSize = { 80.0f, 80.0f };
@@ -13,9 +13,16 @@
 #include "UIGeometry.h"
 #include "Model.h"
 #include "RenderGeometry.h"
+#include "TileRenderer.h"
 #include "RenderUI.h"
 #include "MeshLoader.h"
 #include "CameraUtils.h"
+#include "BVH.h"
+#include "RayCaster.h"
+#include "VoxelGrid.h"
+#include "RayTracedShadows.h"
+#include "ShadowMap.h"
+#include "AmbientOcclusion.h"
 
 std::vector<Texture> Model::textures;
 std::vector<UI_Rect> UI_Rect::uiRects;
@@ -95,6 +102,39 @@ void UpdateKeyStates(GLFWwindow* window) {
     int oKeyState = glfwGetKey(window, GLFW_KEY_O);
     SetKeyBasedOnState(KEY_O, oKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
 
+    int kKeyState = glfwGetKey(window, GLFW_KEY_K);
+    SetKeyBasedOnState(KEY_K, kKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
+
+    int gKeyState = glfwGetKey(window, GLFW_KEY_G);
+    SetKeyBasedOnState(KEY_G, gKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
+
+    int hKeyState = glfwGetKey(window, GLFW_KEY_H);
+    SetKeyBasedOnState(KEY_H, hKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
+
+    int fKeyState = glfwGetKey(window, GLFW_KEY_F);
+    SetKeyBasedOnState(KEY_F, fKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
+
+    int vKeyState = glfwGetKey(window, GLFW_KEY_V);
+    SetKeyBasedOnState(KEY_V, vKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
+
+    int zKeyState = glfwGetKey(window, GLFW_KEY_Z);
+    SetKeyBasedOnState(KEY_Z, zKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
+
+    int cKeyState = glfwGetKey(window, GLFW_KEY_C);
+    SetKeyBasedOnState(KEY_C, cKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
+
+    int lKeyState = glfwGetKey(window, GLFW_KEY_L);
+    SetKeyBasedOnState(KEY_L, lKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
+
+    int jKeyState = glfwGetKey(window, GLFW_KEY_J);
+    SetKeyBasedOnState(KEY_J, jKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
+
+    int xKeyState = glfwGetKey(window, GLFW_KEY_X);
+    SetKeyBasedOnState(KEY_X, xKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
+
+    int uKeyState = glfwGetKey(window, GLFW_KEY_U);
+    SetKeyBasedOnState(KEY_U, uKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
+
     int leftShiftKeyState = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT);
     SetKeyBasedOnState(KEY_LEFT_SHIFT, leftShiftKeyState > 0 ? PRESSED_OR_HELD : RELEASED);
 
@@ -163,9 +203,25 @@ int main()
 
     std::vector<unsigned char> imageData(screenWidth * screenHeight * NUM_COMPONENTS_IN_PIXEL);
     std::vector<float> imageDepthData(screenWidth * screenHeight);
+    std::vector<unsigned int> visibilityData(screenWidth * screenHeight);
+    std::vector<unsigned int> meshDrawOrder;
+    OcclusionBuffer occlusionBuffer;
+    InitOcclusionBuffer(occlusionBuffer);
     ClearImage(imageData, screenWidth, screenHeight, backgroundColour);
     ClearImageDepth(imageDepthData, screenWidth, screenHeight, 0.0f);
 
+    ThreadPool renderThreadPool;
+    RenderTileGrid renderTileGrid;
+    InitRenderTileGrid(renderTileGrid, screenWidth, screenHeight);
+    HiZBuffer hiZBuffer;
+    InitHiZBuffer(hiZBuffer, screenWidth, screenHeight);
+    ClearHiZBuffer(hiZBuffer, 0.0f);
+    std::vector<ScreenSpaceTriangle> screenSpaceTriangles;
+    ShadowMap shadowMap;
+    InitShadowMap(shadowMap, shadowMapSize);
+    AmbientOcclusionBuffers ambientOcclusionBuffers;
+    InitAmbientOcclusionBuffers(ambientOcclusionBuffers, screenWidth, screenHeight);
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -277,6 +333,7 @@ int main()
     int frame = 0;
 
     Vector3 objectPosition = { 0.0f, 0.0f, 4.0f };
+    Vector3 voxelObjectPosition = { 0.0f, -6.0f, 20.0f };
 
     Vector3 cameraPosition = Vector3{ 0.0f, -3.0f, 0.0f };
     Vector3 cameraTargetPosition = cameraPosition + worldForward;
@@ -312,6 +369,28 @@ int main()
     //LoadModel(modelsPath + monu2FileName, testCubeModel);
     //LoadModel(modelsPath + LowPolyForestTerrainFileName, testCubeModel);
     LoadModel(modelsPath + texturedSuzanneFileName, testModel);
+    MarkLargeMeshesAsOccluders(testModel);
+    // OBJECT SPACE!!! Built once, the model's transform is applied to the ray instead.
+    BVH testModelBVH;
+    BuildBVH(testModelBVH, testModel, renderThreadPool);
+    std::cout << "BVH built, " << testModelBVH.triangles.size() << " triangles in " << testModelBVH.nodes.size() << " nodes." << std::endl;
+
+    VoxelGrid voxelGrid;
+    {
+        // Only loaded to be turned into voxels, its triangles are never drawn. The palette is all the grid keeps of its
+        // texture, so that's dropped from the shared list and the model freed as soon as the grid is built.
+        const size_t numTexturesBeforeVoxelSource = Model::textures.size();
+        Model voxelSourceModel;
+        LoadModel(modelsPath + monu2FileName, voxelSourceModel);
+        ImportVoxelGridFromModel(voxelSourceModel, voxelGrid);
+        size_t voxelSourceTriangleBytes = 0;
+        for (int i = 0; i < voxelSourceModel.meshes.size(); i++)
+        {
+            voxelSourceTriangleBytes += voxelSourceModel.meshes[i].vertices.size() * sizeof(Point) + voxelSourceModel.meshes[i].indices.size() * sizeof(uint32_t);
+        }
+        std::cout << "Voxel grid built, " << voxelGrid.brickVoxels.size() / voxelsPerBrick << " of " << voxelGrid.brickSlots.size() << " bricks stored, " << GetVoxelGridMemoryBytes(voxelGrid) << " bytes vs " << voxelSourceTriangleBytes << " bytes of triangles." << std::endl;
+        Model::textures.erase(Model::textures.begin() + numTexturesBeforeVoxelSource, Model::textures.end());
+    }
 
 
     const int rootUIRectIndex = UI_Rect::uiRects.size();
@@ -437,6 +516,7 @@ int main()
 
         ClearImage(imageData, screenWidth, screenHeight, backgroundColour);
         ClearImageDepth(imageDepthData, screenWidth, screenHeight, 0.0f);
+        ClearHiZBuffer(hiZBuffer, 0.0f);
 
         //freezeRotation = (GetKeyHeld(KEY_P));
         if (GetKeyPressedInThisFrame(KEY_P)) {
@@ -451,6 +531,66 @@ int main()
             rotationSpeed -= rotationSpeedDelta;
         }
 
+        // Cycles scalar -> SSE -> AVX2 pixel kernels, to compare them on the same view.
+        if (GetKeyPressedInThisFrame(KEY_K)) {
+            activePixelKernel = GetNextSupportedPixelKernel(activePixelKernel);
+            std::cout << "Pixel kernel := " << pixelKernelNames[activePixelKernel] << std::endl;
+        }
+
+        if (GetKeyPressedInThisFrame(KEY_G)) {
+            useGuardBandClipping = !useGuardBandClipping;
+            std::cout << "Guard band clipping := " << (useGuardBandClipping ? "On" : "Off") << std::endl;
+        }
+
+        if (GetKeyPressedInThisFrame(KEY_H)) {
+            useHiZ = !useHiZ;
+            std::cout << "Hi-Z rejection := " << (useHiZ ? "On" : "Off") << std::endl;
+        }
+
+        if (GetKeyPressedInThisFrame(KEY_V)) {
+            activeRenderMode = (RenderMode)((activeRenderMode + 1) % NUM_RENDER_MODES);
+            std::cout << "Render mode := " << renderModeNames[activeRenderMode] << std::endl;
+        }
+
+        if (GetKeyPressedInThisFrame(KEY_Z)) {
+            activeDepthSortMode = (DepthSortMode)((activeDepthSortMode + 1) % NUM_DEPTH_SORT_MODES);
+            std::cout << "Depth sort := " << depthSortModeNames[activeDepthSortMode] << std::endl;
+        }
+
+        if (GetKeyPressedInThisFrame(KEY_C)) {
+            useOcclusionCulling = !useOcclusionCulling;
+            std::cout << "Occlusion culling := " << (useOcclusionCulling ? "On" : "Off") << std::endl;
+        }
+
+        if (GetKeyPressedInThisFrame(KEY_L)) {
+            activeShadowMode = (ShadowMode)((activeShadowMode + 1) % NUM_SHADOW_MODES);
+            std::cout << "Shadows := " << shadowModeNames[activeShadowMode] << std::endl;
+        }
+
+        if (GetKeyPressedInThisFrame(KEY_J)) {
+            useAmbientOcclusion = !useAmbientOcclusion;
+            std::cout << "Ambient occlusion := " << (useAmbientOcclusion ? "On" : "Off") << std::endl;
+        }
+
+        if (GetKeyPressedInThisFrame(KEY_U)) {
+            useLighting = !useLighting;
+            std::cout << "Lighting := " << (useLighting ? "On" : "Off") << std::endl;
+        }
+
+        if (GetKeyPressedInThisFrame(KEY_X)) {
+            useVoxelObject = !useVoxelObject;
+            std::cout << "Voxel object := " << (useVoxelObject ? "On" : "Off") << std::endl;
+        }
+
+        // Counts are from the frame drawn last, they're only summed up when asked for.
+        if (GetKeyPressedInThisFrame(KEY_F)) {
+            FragmentCounters fragmentCounters = SumFragmentCounters(renderTileGrid);
+            std::cout << "Fragments shaded := " << fragmentCounters.fragmentsShaded << ", killed by early depth test := " << fragmentCounters.fragmentsKilledByDepth
+                << ", Hi-Z tiles rejected := " << fragmentCounters.hiZTilesRejected << std::endl;
+            std::cout << "Bounds tested for occlusion := " << occlusionBuffer.numBoundsTested << ", occluded := " << occlusionBuffer.numBoundsOccluded << std::endl;
+            std::cout << "Shadow rays traced := " << fragmentCounters.shadowRaysTraced << ", reused from their quad := " << fragmentCounters.shadowRaysReused << std::endl;
+        }
+
         if (!freezeRotation) {
             //angle -= rotationSpeed * deltaTime;
             //if (angle <= 0.0f) {
@@ -511,6 +651,13 @@ int main()
             glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
         }
 
+        if (GetKeyReleasedInThisFrame(MOUSE_BUTTON_LEFT)) {
+            curSelectedUIRectIndex = -1;
+        }
+
+        // Before drawing so a click on the UI isn't also taken as picking the model behind it.
+        bool mouseOverUI = UpdateUITreeStates(UI_Rect::uiRects[rootUIRectIndex], mouseX, mouseY);
+
         {
             //PROFILE_SCOPE("MODEL, VIEW AND PROJECTION MATRIX CREATION");
 
@@ -544,9 +691,67 @@ int main()
             {
                 //PROFILE_SCOPE("RENDERING");
                 int totalTrianglesRendered = 0;
-                for (int i = 0; i < testModel.meshes.size(); i++)
-                {
-                    DrawMeshOnScreenFromWorldWithTransform(imageData, imageDepthData, screenWidth, screenHeight, testModel.meshes[i], modelMat, cameraPosition, cameraLookingDirection, cameraViewMatrix, perspectiveProjectionMatrix, lineThickness, red, totalTrianglesRendered);
+                screenSpaceTriangles.clear();
+                // Every mesh of the model shares its transform, so the draw constants are only built once.
+                DrawConstants drawConstants = ComputeDrawConstants(modelMat, cameraViewMatrix, perspectiveProjectionMatrix, lightPosition);
+                if (activeRenderMode == RENDER_MODE_RAY_CAST) {
+                    if (TestBoundsAgainstFrustum(drawConstants.frustum, testModel.bounds, testModel.boundingSphere) != FRUSTUM_OUTSIDE) {
+                        RayCastModelInTiles(imageData, imageDepthData, screenWidth, screenHeight, testModel, testModelBVH, drawConstants, renderTileGrid, renderThreadPool);
+                    }
+                }
+                else {
+                    // Nearest mesh first, so the early depth test rejects as much of the rest as it can before it's shaded.
+                    meshDrawOrder.clear();
+                    if (TestBoundsAgainstFrustum(drawConstants.frustum, testModel.bounds, testModel.boundingSphere) != FRUSTUM_OUTSIDE) {
+                        SortMeshesFrontToBack(testModel, drawConstants.modelViewProjectionMatrix, meshDrawOrder);
+                    }
+                    BuildOcclusionBuffer(occlusionBuffer, testModel, meshDrawOrder, drawConstants.modelViewProjectionMatrix);
+                    for (int i = 0; i < meshDrawOrder.size(); i++)
+                    {
+                        DrawMeshOnScreenFromWorldWithTransform(screenSpaceTriangles, screenWidth, screenHeight, testModel.meshes[meshDrawOrder[i]], drawConstants, occlusionBuffer, totalTrianglesRendered);
+                    }
+                    RasterizeScreenSpaceTrianglesInTiles(imageData, imageDepthData, visibilityData, screenWidth, screenHeight, screenSpaceTriangles, renderTileGrid, hiZBuffer, renderThreadPool);
+                }
+
+                // Marched after the meshes are in the depth buffer so it composites with them.
+                if (useVoxelObject) {
+                    Mat4x4 voxelModelMat = glm::translate(glm::identity<Mat4x4>(), voxelObjectPosition);
+                    DrawConstants voxelDrawConstants = ComputeDrawConstants(voxelModelMat, cameraViewMatrix, perspectiveProjectionMatrix, lightPosition);
+                    RayMarchVoxelGridInTiles(imageData, imageDepthData, screenWidth, screenHeight, voxelGrid, voxelDrawConstants, renderTileGrid, renderThreadPool);
+                }
+
+                // Last, everything that can receive a shadow has to be in the depth buffer by now.
+                if (activeShadowMode == SHADOW_MODE_RAY_TRACED) {
+                    TraceShadowsInTiles(imageData, imageDepthData, screenWidth, screenHeight, testModelBVH, drawConstants, renderTileGrid, renderThreadPool);
+                }
+                else if (activeShadowMode == SHADOW_MODE_SHADOW_MAP) {
+                    RenderShadowMap(shadowMap, testModel, modelMat, lightPosition, renderThreadPool);
+                    ApplyShadowMapInTiles(imageData, imageDepthData, screenWidth, screenHeight, shadowMap, drawConstants, renderTileGrid, renderThreadPool);
+                }
+
+                if (useAmbientOcclusion) {
+                    ApplyAmbientOcclusionInTiles(imageData, imageDepthData, screenWidth, screenHeight, ambientOcclusionBuffers, perspectiveProjectionMatrix, renderTileGrid, renderThreadPool);
+                }
+
+                // Picking, the pixel under the mouse is unprojected onto the far plane and the ray from the camera to there is traced through the model's BVH.
+                // Image rows go bottom up, the centre of the pixel under the mouse is half a pixel below screenHeight - mouseY.
+                if (GetKeyPressedInThisFrame(MOUSE_BUTTON_LEFT) && !mouseOverUI && curSelectedUIRectIndex == -1) {
+                    float ndcX = (((float)mouseX + 0.5f) / screenWidth) * 2.0f - 1.0f;
+                    float ndcY = (((screenHeight - (float)mouseY) - 0.5f) / screenHeight) * 2.0f - 1.0f;
+                    Vector3 rayStart = drawConstants.cameraPosition;
+                    Vector3 rayEnd = UnprojectToFarPlane(glm::inverse(drawConstants.modelViewProjectionMatrix), rayStart, ndcX, ndcY);
+
+                    auto pickStartTime = std::chrono::high_resolution_clock::now();
+                    RayHit pickHit;
+                    TraceRayClosestHit(testModelBVH, MakeRay(rayStart, rayEnd - rayStart), 1.0f, pickHit);
+                    std::chrono::duration<double, std::micro> pickTime = std::chrono::high_resolution_clock::now() - pickStartTime;
+
+                    if (pickHit.hit) {
+                        std::cout << "Picked mesh " << pickHit.meshIndex << ", triangle " << pickHit.triangleIndex << " at " << pickHit.distance * glm::length(rayEnd - rayStart) << " units, " << pickTime.count() << " us." << std::endl;
+                    }
+                    else {
+                        std::cout << "Picked nothing, " << pickTime.count() << " us." << std::endl;
+                    }
                 }
                 //std::cout << "Total triangles rendered := " << totalTrianglesRendered << std::endl;
             }
@@ -554,11 +759,6 @@ int main()
 
         //std::cout << (int)mouseX / (int)collisionGridCellSize.x << ", " << (int)(screenHeight - mouseY) / (int)collisionGridCellSize.y << std::endl;
 
-        if (GetKeyReleasedInThisFrame(MOUSE_BUTTON_LEFT)) {
-            curSelectedUIRectIndex = -1;
-        }
-
-        UpdateUITreeStates(UI_Rect::uiRects[rootUIRectIndex], mouseX, mouseY);
         HandleUIEvents(mouseX - mouseXFromPreviousFrame, mouseY - mouseYFromPreviousFrame);
         RenderUITree(UI_Rect::uiRects[rootUIRectIndex], screenWidth, screenHeight, imageData);
 